@@ -37,6 +37,7 @@ extern "C"
 
 #define	SIP_CR			'\r'
 #define	SIP_SP			' '
+#define	SIP_HTAB		'\t'
 #define	SIP_HCOLON		':'
 #define	SIP_SEMI		';'
 #define	SIP_COMMA		','
@@ -129,7 +130,10 @@ extern "C"
 
 #define	SIP_IS_TIMER_RUNNING(timer)	((timer).sip_timerid != 0)
 
-/* This is the transaction list */
+/*
+ * This is the transaction list, the entries are embedded in the
+ * transactions (sip_xaction_conn_link).
+ */
    typedef struct sip_conn_cache_s
    {
       void *obj;
@@ -137,11 +141,63 @@ extern "C"
       struct sip_conn_cache_s *prev;
    } sip_conn_cache_t;
 
+/*
+ * TCP segments are appended to a chunk, the complete messages in it are
+ * handed out as slices that each hold a reference to the chunk.
+ */
+#define	SIP_REASS_CHUNK_SZ	8192
+
+   typedef struct sip_reass_chunk_s
+   {
+      int sip_chunk_ref;
+      size_t sip_chunk_size;    /* of sip_chunk_data, less the NUL */
+      char sip_chunk_data[1];
+   } sip_reass_chunk_t;
+
+/*
+ * Offsets of the start line, header lines and the empty line of a message,
+ * recorded by the framer so that sip_setup_header_pointers() need not look
+ * for the CRLFs again. sip_lines_n is -1 if the message has more lines or
+ * a line not ended by CRLF.
+ */
+#define	SIP_REASS_LINES	64
+
+   typedef struct sip_reass_lines_s
+   {
+      int sip_lines_n;
+      uint32_t sip_lines_off[SIP_REASS_LINES];
+   } sip_reass_lines_t;
+
+/* A complete message handed out by sip_get_tcp_msgs() */
+   typedef struct sip_reass_slice_s
+   {
+      char *sip_slice_buf;
+      size_t sip_slice_len;
+      sip_reass_chunk_t *sip_slice_chunk;       /* holds sip_slice_buf */
+      sip_reass_lines_t sip_slice_lines;
+   } sip_reass_slice_t;
+
+/*
+ * Framing state of the message being reassembled, so that each segment
+ * only scans the bytes it added. Offsets are from sip_reass_start. All
+ * zero is the initial state.
+ */
+   typedef struct sip_reass_frame_s
+   {
+      size_t sip_frame_scan;    /* start of the first unscanned line */
+      size_t sip_frame_hlen;    /* header length, 0 until CRLFCRLF seen */
+      size_t sip_frame_clen;    /* Content-Length, 0 if absent */
+      boolean_t sip_frame_start;        /* start line seen */
+      sip_reass_lines_t sip_frame_lines;
+   } sip_reass_frame_t;
+
 /* TCP fragment entry */
    typedef struct sip_reass_entry_s
    {
-      char *sip_reass_msg;
-      int sip_reass_msglen;
+      sip_reass_chunk_t *sip_reass_chunk;
+      size_t sip_reass_start;   /* first byte not handed out */
+      size_t sip_reass_end;     /* end of the data appended */
+      sip_reass_frame_t sip_reass_frame;
    } sip_reass_entry_t;
 
 /* Library data in stored in connection object */
@@ -154,11 +210,14 @@ extern "C"
    } sip_conn_obj_pvt_t;
 
    extern boolean_t sip_manage_dialog;
+   extern boolean_t sip_eager_parse;
 
 /* To salt the hash function */
    extern uint64_t sip_hash_salt;
 
-   extern void sip_timeout_init ();
+   extern int sip_timeout_init (int, boolean_t, uint64_t (*)(void));
+   extern void sip_timeout_fini ();
+   extern int sip_timeout_affinity (void (*)(void *), void *(*)(void *));
    extern uint_t sip_timeout (void *, void (*)(void *), struct timeval *);
    extern boolean_t sip_untimeout (uint_t);
    extern void sip_md5_hash (char *, int, char *, int, char *, int, char *, int, char *, int, char *, int, uchar_t *);
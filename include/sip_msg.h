@@ -50,6 +50,9 @@ extern "C"
 #define	SIP_HEADER_DELETED	0x1
 #define	SIP_HEADER_DELETED_VAL	0x2
 
+/* Entries in sip_header_function_table, the terminating one included */
+#define	MAX_SIP_HEADERS (SIP_HDR_MAX + 1)
+
 /* List of registered sent-by values */
    typedef struct sent_by_list_s
    {
@@ -73,6 +76,9 @@ extern "C"
       /* True if header was allocated */
       boolean_t sip_hdr_allocated;
       sip_header_function_t *sip_header_functions;
+      int sip_hdr_id;           /* see sip_index_headers() */
+      struct sip_header *sip_hdr_id_next;       /* next one with this id */
+      char *sip_hdr_unparsed;   /* values not parsed yet, see sip_parse_next_value() */
    } _sip_header_t;
 
 /* Structure for the SIP message body */
@@ -305,12 +311,38 @@ extern "C"
    typedef sip_hdr_value_t sip_pxy_author_value_t;
    typedef sip_hdr_value_t sip_3w_authen_value_t;
 
+/*
+ * The RFC 3261 mandatory headers of a received message, parsed while it
+ * is indexed when the stack runs with SIP_STACK_EAGER_PARSE, for the
+ * stack to read instead of looking them up again. The first header of
+ * each kind counts; a value is NULL if there is none or it did not parse.
+ * The strings point into the parsed values.
+ */
+   typedef struct sip_msg_core
+   {
+      _sip_header_t *sip_core_via_hdr;  /* the top one */
+      _sip_header_t *sip_core_from_hdr;
+      _sip_header_t *sip_core_to_hdr;
+      _sip_header_t *sip_core_callid_hdr;
+      _sip_header_t *sip_core_cseq_hdr;
+      sip_hdr_value_t *sip_core_via;
+      sip_hdr_value_t *sip_core_from;
+      sip_hdr_value_t *sip_core_to;
+      sip_hdr_value_t *sip_core_callid;
+      sip_hdr_value_t *sip_core_cseq;
+      const sip_str_t *sip_core_branch; /* of the top Via */
+      const sip_str_t *sip_core_from_tag;
+      const sip_str_t *sip_core_to_tag;
+      int sip_core_maxf;        /* -1 if none */
+      int sip_core_clen;        /* -1 if none */
+   } sip_msg_core_t;
+
 /* SIP request line structure */
    typedef struct sip_request
    {
       sip_method_t sip_request_method;
       sip_str_t sip_request_uri;
-      sip_uri_t sip_parse_uri;
+      sip_uri_t sip_parse_uri;  /* parsed on first use */
    } sip_request_t;
 
 /* SIP response line structure */
@@ -371,9 +403,46 @@ extern "C"
       _sip_header_t *sip_msg_start_line;
       sip_message_type_t *sip_msg_req_res;
       int sip_msg_ref_cnt;
+      struct sip_reass_chunk_s *sip_msg_chunk;  /* TCP, holds sip_msg_buf */
+      const struct sip_reass_lines_s *sip_msg_lines;    /* TCP, until set up */
+      char *sip_msg_borrowed;   /* sip_msg_buf from sip_process_packet_buf */
+      void (*sip_msg_release) (void *, void *);        /* to give it back */
+      void *sip_msg_release_arg;
+      /* Lookup digests worked out ahead, see sip_process_new_packets() */
+      int sip_msg_digests;
+      uint16_t sip_msg_xaction_digest[8];
+      uint16_t sip_msg_dialog_digest[8];
+      /* First header of each id, if sip_msg_hdr_indexed */
+      boolean_t sip_msg_hdr_indexed;
+      _sip_header_t *sip_msg_hdr_index[MAX_SIP_HEADERS];
+      /* Set up by sip_index_headers(), dropped once the message changes */
+      boolean_t sip_msg_core_parsed;
+      sip_msg_core_t sip_msg_core;
    } _sip_msg_t;
 
-   extern char *sip_get_tcp_msg (sip_conn_object_t, char *, size_t *);
+/* sip_msg_digests */
+#define	SIP_MSG_XACTION_DIGEST	0x0001
+#define	SIP_MSG_DIALOG_DIGEST	0x0002
+
+   struct sip_reass_slice_s;
+
+   extern int sip_get_tcp_msgs (sip_conn_object_t, char *, size_t, struct sip_reass_slice_s *, int);
+   extern void sip_reass_chunk_rele (struct sip_reass_chunk_s *);
+   extern void sip_reass_free_buf (struct sip_reass_chunk_s *, char *);
+   extern const char *sip_reass_hdr_value (const char *, const char *, const char *, char);
+
+/* sip_overload_check() */
+#define	SIP_OVERLOAD_ACCEPT	0
+#define	SIP_OVERLOAD_REJECT	1
+#define	SIP_OVERLOAD_DROP	2
+
+/* Retry-After in the 503s when sip_overload_init() is given none, secs */
+#define	SIP_OVERLOAD_RETRY_AFTER	5
+
+   extern int sip_overload_check (_sip_msg_t *, int *);
+   extern uint64_t sip_overload_now ();
+   extern void sip_overload_enqueue ();
+   extern void sip_overload_dequeue (uint64_t);
    extern char *sip_msg_to_msgbuf (_sip_msg_t * msg, int *error);
    extern char *_sip_startline_to_str (_sip_msg_t * sip_msg, int *error);
    extern int sip_adjust_msgbuf (_sip_msg_t * msg);
@@ -383,6 +452,10 @@ extern "C"
    extern int _sip_find_and_copy_header (_sip_msg_t *, _sip_msg_t *, char *, char *);
    extern int _sip_find_and_copy_all_header (_sip_msg_t *, _sip_msg_t *, char *header_name);
    extern _sip_header_t *sip_search_for_header (_sip_msg_t *, char *, _sip_header_t *);
+   extern _sip_header_t *sip_search_for_header_id (_sip_msg_t *, int, _sip_header_t *);
+   extern int sip_header_names_init ();
+   extern int sip_header_id (const char *, int);
+   extern void sip_index_headers (_sip_msg_t *, boolean_t);
    extern void _sip_add_header (_sip_msg_t *, _sip_header_t *, boolean_t, boolean_t, char *);
    extern _sip_header_t *sip_new_header (int);
    extern int sip_create_nonOKack (sip_msg_t, sip_msg_t, sip_msg_t);
@@ -426,6 +499,8 @@ extern "C"
    extern int sip_parse_date_header (_sip_header_t *, sip_parsed_header_t **);
    extern int sip_parse_warn_header (_sip_header_t *, sip_parsed_header_t **);
    extern int sip_parse_cftr_header (_sip_header_t *, sip_parsed_header_t **);
+   extern int sip_parse_route_header (_sip_header_t *, sip_parsed_header_t **);
+   extern int sip_parse_next_value (_sip_header_t *);
    extern int sip_parse_cseq_header (_sip_header_t *, sip_parsed_header_t **);
    extern int sip_parse_cid_header (_sip_header_t *, sip_parsed_header_t **);
    extern int sip_parse_first_line (_sip_header_t *, sip_message_type_t **);
@@ -365,6 +365,68 @@ extern "C"
       void (*header_free) (struct sip_parsed_header *);
    } sip_header_function_t;
 
+/*
+ * Well-known header ids, the index of each header in the built-in
+ * header function table.
+ */
+   typedef enum
+   {
+      SIP_HDR_UNKNOWN = 0,
+      SIP_HDR_CONTACT,
+      SIP_HDR_FROM,
+      SIP_HDR_TO,
+      SIP_HDR_CONTENT_LENGTH,
+      SIP_HDR_CONTENT_TYPE,
+      SIP_HDR_CALL_ID,
+      SIP_HDR_CSEQ,
+      SIP_HDR_VIA,
+      SIP_HDR_MAX_FORWARDS,
+      SIP_HDR_RECORD_ROUTE,
+      SIP_HDR_ROUTE,
+      SIP_HDR_ACCEPT,
+      SIP_HDR_ACCEPT_ENCODE,
+      SIP_HDR_ACCEPT_LANG,
+      SIP_HDR_ALERT_INFO,
+      SIP_HDR_ALLOW,
+      SIP_HDR_CALL_INFO,
+      SIP_HDR_CONTENT_DIS,
+      SIP_HDR_CONTENT_ENCODE,
+      SIP_HDR_CONTENT_LANG,
+      SIP_HDR_DATE,
+      SIP_HDR_ERROR_INFO,
+      SIP_HDR_EXPIRE,
+      SIP_HDR_IN_REPLY_TO,
+      SIP_HDR_MIN_EXPIRE,
+      SIP_HDR_MIME_VERSION,
+      SIP_HDR_ORGANIZATION,
+      SIP_HDR_PRIORITY,
+      SIP_HDR_REQUIRE,
+      SIP_HDR_REPLYTO,
+      SIP_HDR_RETRY_AFTER,
+      SIP_HDR_SERVER,
+      SIP_HDR_SUBJECT,
+      SIP_HDR_TIMESTAMP,
+      SIP_HDR_UNSUPPORT,
+      SIP_HDR_SUPPORT,
+      SIP_HDR_USER_AGENT,
+      SIP_HDR_WARNING,
+      SIP_HDR_ALLOW_EVENTS,
+      SIP_HDR_EVENT,
+      SIP_HDR_SUBSCRIPTION_STATE,
+      SIP_HDR_AUTHOR,
+      SIP_HDR_AUTHEN_INFO,
+      SIP_HDR_PROXY_AUTHOR,
+      SIP_HDR_PROXY_AUTHEN,
+      SIP_HDR_PROXY_REQ,
+      SIP_HDR_WWW_AUTHEN,
+      SIP_HDR_RSEQ,
+      SIP_HDR_RACK,
+      SIP_HDR_PASSERTEDID,
+      SIP_HDR_PPREFERREDID,
+      SIP_HDR_PRIVACY,
+      SIP_HDR_MAX
+   } sip_header_id_t;
+
 /* Connection Manager interface */
    typedef struct sip_io_pointers_s
    {
@@ -382,7 +444,10 @@ extern "C"
       int (*sip_conn_timerd) (sip_conn_object_t);
    } sip_io_pointers_t;
 
-/* Upper layer registerations */
+/*
+ * Upper layer registerations. The arg passed to sip_ulp_timeout() is
+ * owned by the stack, sip_ulp_untimeout() must not free it.
+ */
    typedef struct sip_ulp_pointers_s
    {
       void (*sip_ulp_recv) (const sip_conn_object_t, sip_msg_t, const sip_dialog_t);
@@ -394,6 +459,32 @@ extern "C"
       void (*sip_ulp_dlg_state_cb) (sip_dialog_t, sip_msg_t, int, int);
    } sip_ulp_pointers_t;
 
+/*
+ * A received packet for sip_process_new_packets(). With a NULL
+ * sip_pkt_release the packet is copied, otherwise the stack uses the
+ * buffer in place and gives it back with sip_pkt_release(sip_pkt_buf,
+ * sip_pkt_arg).
+ */
+   typedef struct sip_packet_s
+   {
+      void *sip_pkt_buf;
+      size_t sip_pkt_len;
+      void (*sip_pkt_release) (void *, void *);
+      void *sip_pkt_arg;
+   } sip_packet_t;
+
+/*
+ * Overload control limits, for sip_overload_init(). The stack sheds load
+ * while any non-zero limit is passed.
+ */
+   typedef struct sip_overload_s
+   {
+      int sip_ovl_max_queue;    /* messages waiting for rx threads */
+      int sip_ovl_max_latency;  /* their average wait, msecs */
+      int sip_ovl_max_load;     /* of sip_overload_load() */
+      int sip_ovl_retry_after;  /* secs, in the 503s, 0 for 5 */
+   } sip_overload_t;
+
 /* SIP stack initialization structure */
    typedef struct sip_stack_init_s
    {
@@ -402,13 +493,45 @@ extern "C"
       sip_io_pointers_t *sip_io_pointers;
       sip_ulp_pointers_t *sip_ulp_pointers;
       sip_header_function_t *sip_function_table;
+      /* The following are only looked at for SIP_STACK_VERSION_2 and up */
+      int sip_hash_size;        /* initial capacity of trans/dialog tables */
+      int sip_timer_threads;    /* timer callback threads, 0 for default */
+      uint64_t (*sip_timer_clock) (void);       /* msecs, NULL for the system */
+      /*
+       * With sip_rx_threads, received messages are processed, and passed
+       * to sip_ulp_recv(), on that many threads of the stack rather than
+       * on the caller's. The messages of a Call-ID all go to the same
+       * thread, in order.
+       */
+      int sip_rx_threads;
+      /*
+       * Optional, takes over from sip_ulp_recv() for the datagrams of a
+       * sip_process_new_packets() call processed on the caller's thread.
+       * Up to a batch of messages, with their dialogs, is passed up at a
+       * time, after the transaction and dialog layers have seen all of
+       * them. The stack frees the messages and dialogs on return.
+       */
+      void (*sip_ulp_recv_batch) (const sip_conn_object_t, sip_msg_t *, sip_dialog_t *, int);
    } sip_stack_init_t;
 
 /* SIP stack version */
-#define	SIP_STACK_VERSION		1
+#define	SIP_STACK_VERSION_1		1
+#define	SIP_STACK_VERSION_2		2
+#define	SIP_STACK_VERSION		SIP_STACK_VERSION_2
 
 /* Flags for sip_stack_flags */
 #define	SIP_STACK_DIALOGS		0x0001
+/*
+ * No timer thread, the ULP calls sip_timer_process(), which also runs the
+ * timer callbacks unless sip_timer_threads is set.
+ */
+#define	SIP_STACK_EXTERNAL_TIMER	0x0002
+/*
+ * Parse the mandatory headers (top Via, From, To, Call-ID, CSeq,
+ * Max-Forwards and Content-Length) of each received message as it is
+ * split into headers, rather than when the stack first looks at them.
+ */
+#define	SIP_STACK_EAGER_PARSE		0x0004
 
 extern int sip_setup_header_pointers (sip_msg_t);
 extern boolean_t sip_check_common_headers (sip_conn_object_t, sip_msg_t);
@@ -438,6 +561,14 @@ extern boolean_t sip_check_common_headers (sip_conn_object_t, sip_msg_t);
    extern int sip_stack_init (sip_stack_init_t *);
    extern int sip_sendmsg (sip_conn_object_t, sip_msg_t, sip_dialog_t, uint32_t);
    extern void sip_process_new_packet (sip_conn_object_t, void *, size_t);
+   extern void sip_process_packet_buf (sip_conn_object_t, void *, size_t, void (*)(void *, void *), void *);
+   extern void sip_process_new_packets (sip_conn_object_t, sip_packet_t *, int);
+   extern int sip_overload_init (const sip_overload_t *);
+   extern void sip_overload_load (int);
+   extern int sip_timer_fd ();
+   extern int sip_timer_process (const struct timespec *);
+   extern uint64_t sip_virtual_clock ();
+   extern void sip_virtual_clock_advance (uint64_t);
    extern char *sip_guid ();
    extern char *sip_sent_by_to_str (int *);
    extern int sip_register_sent_by (char *);
@@ -582,6 +713,8 @@ extern boolean_t sip_check_common_headers (sip_conn_object_t, sip_msg_t);
 
    extern const struct sip_header *sip_get_header (sip_msg_t, char *, sip_header_t, int *);
    extern const struct sip_value *sip_get_header_value (const struct sip_header *, int *);
+   extern const struct sip_header *sip_get_header_by_id (sip_msg_t, sip_header_id_t, sip_header_t, int *);
+   extern const struct sip_value *sip_get_header_value_by_id (sip_msg_t, sip_header_id_t, int *);
    extern const struct sip_value *sip_get_next_value (sip_header_value_t, int *);
    extern const sip_str_t *sip_get_param_value (sip_header_value_t, char *, int *);
    extern const sip_param_t *sip_get_params (sip_header_value_t, int *);
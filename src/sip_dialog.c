@@ -42,10 +42,10 @@ boolean_t sip_incomplete_dialog (sip_dialog_t);
 _sip_header_t *sip_dlg_xchg_from_to (sip_msg_t, int);
 
 /* Complete dialog hash table */
-sip_hash_t sip_dialog_hash[SIP_HASH_SZ];
+sip_hash_t sip_dialog_hash;
 
 /* Partial dialog hash table */
-sip_hash_t sip_dialog_phash[SIP_HASH_SZ];
+sip_hash_t sip_dialog_phash;
 
 /* Route set structure */
 typedef struct sip_dlg_route_set_s
@@ -62,10 +62,11 @@ sip_dialog_t sip_complete_dialog (_sip_msg_t *, _sip_dialog_t *, void (*func) (s
 sip_dialog_t sip_dialog_create (_sip_msg_t *, _sip_msg_t *, int);
 int sip_dialog_process (_sip_msg_t *, sip_dialog_t *, void (*func) (sip_dialog_t, sip_msg_t, void *));
 void sip_dialog_delete (_sip_dialog_t *);
-void sip_dialog_init ();
+int sip_dialog_init (void (*) (sip_dialog_t, sip_msg_t, int, int), int);
+void sip_dialog_fini ();
 sip_dialog_t sip_dialog_find (_sip_msg_t *);
 boolean_t sip_dialog_match (void *, void *);
-boolean_t sip_dialog_free (void *, void *, int *);
+boolean_t sip_dialog_unused (void *);
 sip_dialog_t sip_update_dialog (sip_dialog_t, _sip_msg_t *, void (*func) (sip_dialog_t, sip_msg_t, void *));
 char *sip_dialog_req_uri (sip_dialog_t);
 
@@ -74,18 +75,11 @@ void sip_dlg_self_destruct (void *);
 static int sip_dialog_get_route_set (_sip_dialog_t *, _sip_msg_t *, int);
 static void sip_dialog_free_rset (sip_dlg_route_set_t *);
 
-/* Timer object for partial dialogs */
-typedef struct sip_dialog_timer_obj_s
-{
-   _sip_dialog_t *dialog;
-   void (*func) (sip_dialog_t, sip_msg_t, void *);
-} sip_dialog_timer_obj_t;
-
 /* To avoid duplication all over the place */
 static void sip_release_dialog_res (_sip_dialog_t * dialog)
 {
 
-   assert (dialog->sip_dlg_ref_cnt == 0);
+   assert (dialog->sip_dlg_ref_cnt == 0 || dialog->sip_dlg_ref_cnt == SIP_REF_DEAD);
    if (SIP_IS_TIMER_RUNNING (dialog->sip_dlg_timer))
       SIP_CANCEL_TIMER (dialog->sip_dlg_timer);
    if (dialog->sip_dlg_call_id != NULL)
@@ -113,7 +107,8 @@ static void sip_release_dialog_res (_sip_dialog_t * dialog)
       dialog->sip_dlg_rset.sip_str_ptr = NULL;
    }
    (void) pthread_mutex_destroy (&dialog->sip_dlg_mutex);
-   free (dialog);
+   /* Lookups that raced with the removal may still be looking at it */
+   sip_epoch_retire (&dialog->sip_dlg_epoch_node, (void *) dialog, free);
 }
 
 /*
@@ -428,7 +423,7 @@ static int sip_dialog_get_route_set (_sip_dialog_t * dialog, _sip_msg_t * sip_ms
    int rset_len = 0;
 
    (void) pthread_mutex_lock (&sip_msg->sip_msg_mutex);
-   rrhdr = sip_search_for_header (sip_msg, SIP_RECORD_ROUTE, NULL);
+   rrhdr = sip_search_for_header_id (sip_msg, SIP_HDR_RECORD_ROUTE, NULL);
    while (rrhdr != NULL)
    {
       (void) pthread_mutex_unlock (&sip_msg->sip_msg_mutex);
@@ -477,7 +472,7 @@ static int sip_dialog_get_route_set (_sip_dialog_t * dialog, _sip_msg_t * sip_ms
          value = (sip_hdr_value_t *) sip_get_next_value ((sip_header_value_t) value, &error);
       }
       (void) pthread_mutex_lock (&sip_msg->sip_msg_mutex);
-      rrhdr = sip_search_for_header (sip_msg, SIP_RECORD_ROUTE, rrhdr);
+      rrhdr = sip_search_for_header_id (sip_msg, SIP_HDR_RECORD_ROUTE, rrhdr);
    }
    (void) pthread_mutex_unlock (&sip_msg->sip_msg_mutex);
    if (rset_cnt == 0)
@@ -542,7 +537,7 @@ sip_seed_dialog (sip_conn_object_t obj, _sip_msg_t * sip_msg,
    sip_header_t cihdr;
    sip_header_t evhdr = NULL;
    const struct sip_value *value;
-   sip_dialog_timer_obj_t *tim_obj = NULL;
+   sip_dialog_timer_obj_t *tim_obj;
    const sip_str_t *callid;
    sip_method_t method;
    int timer1 = sip_timer_T1;
@@ -563,12 +558,12 @@ sip_seed_dialog (sip_conn_object_t obj, _sip_msg_t * sip_msg,
    else
    {
       (void) pthread_mutex_lock (&sip_msg->sip_msg_mutex);
-      fhdr = sip_search_for_header (sip_msg, SIP_FROM, NULL);
+      fhdr = sip_search_for_header_id (sip_msg, SIP_HDR_FROM, NULL);
    }
-   cihdr = sip_search_for_header (sip_msg, SIP_CALL_ID, NULL);
-   chdr = sip_search_for_header (sip_msg, SIP_CONTACT, NULL);
+   cihdr = sip_search_for_header_id (sip_msg, SIP_HDR_CALL_ID, NULL);
+   chdr = sip_search_for_header_id (sip_msg, SIP_HDR_CONTACT, NULL);
    if (method == SUBSCRIBE)
-      evhdr = sip_search_for_header (sip_msg, SIP_EVENT, NULL);
+      evhdr = sip_search_for_header_id (sip_msg, SIP_HDR_EVENT, NULL);
    (void) pthread_mutex_unlock (&sip_msg->sip_msg_mutex);
    if ((fhdr == NULL && thdr == NULL) || cihdr == NULL || chdr == NULL || (method == SUBSCRIBE && evhdr == NULL))
    {
@@ -587,9 +582,6 @@ sip_seed_dialog (sip_conn_object_t obj, _sip_msg_t * sip_msg,
       return (NULL);
    }
 
-   tim_obj = malloc (sizeof (sip_dialog_timer_obj_t));
-   if (tim_obj == NULL)
-      return (NULL);
    dialog = calloc (1, sizeof (_sip_dialog_t));
    if (dialog == NULL)
       return (NULL);
@@ -642,6 +634,7 @@ sip_seed_dialog (sip_conn_object_t obj, _sip_msg_t * sip_msg,
    if (sip_conn_timer1 != NULL)
       timer1 = sip_conn_timer1 (obj);
    SIP_INIT_TIMER (dialog->sip_dlg_timer, 64 * timer1);
+   tim_obj = &dialog->sip_dlg_timer_obj;
    tim_obj->dialog = dialog;
    tim_obj->func = func;
    SIP_SCHED_TIMER (dialog->sip_dlg_timer, (void *) tim_obj, sip_dlg_self_destruct);
@@ -662,7 +655,7 @@ sip_seed_dialog (sip_conn_object_t obj, _sip_msg_t * sip_msg,
       SIP_DLG_REFCNT_INCR (dialog);
 
       /* Add it to the partial hash table */
-      if (sip_hash_add (sip_dialog_phash, (void *) dialog, SIP_DIGEST_TO_HASH (dialog->sip_dlg_id)) != 0)
+      if (sip_hash_add (&sip_dialog_phash, (void *) dialog, dialog->sip_dlg_id) != 0)
       {
          goto dia_err;
       }
@@ -670,8 +663,6 @@ sip_seed_dialog (sip_conn_object_t obj, _sip_msg_t * sip_msg,
    return ((sip_dialog_t) dialog);
  dia_err:
    sip_release_dialog_res (dialog);
-   if (tim_obj != NULL)
-      free (tim_obj);
    return (NULL);
 }
 
@@ -688,7 +679,7 @@ _sip_header_t *sip_dlg_xchg_from_to (sip_msg_t sip_msg, int what)
    int hdrsize;
    int error;
 
-   hdr = sip_get_header (sip_msg, what == SIP_DLG_XCHG_FROM ? SIP_FROM : SIP_TO, NULL, &error);
+   hdr = sip_get_header_by_id (sip_msg, what == SIP_DLG_XCHG_FROM ? SIP_HDR_FROM : SIP_HDR_TO, NULL, &error);
    if (error != 0 || hdr == NULL)
       return (NULL);
    if (sip_parse_goto_values ((_sip_header_t *) hdr) != 0)
@@ -768,13 +759,13 @@ sip_complete_dialog (_sip_msg_t * sip_msg, _sip_dialog_t * dialog, void (*func)
 
       thdr = sip_dlg_xchg_from_to ((sip_msg_t) sip_msg, SIP_DLG_XCHG_FROM);
       (void) pthread_mutex_lock (&sip_msg->sip_msg_mutex);
-      evhdr = sip_search_for_header (sip_msg, SIP_EVENT, NULL);
+      evhdr = sip_search_for_header_id (sip_msg, SIP_HDR_EVENT, NULL);
       if (evhdr == NULL)
       {
          (void) pthread_mutex_unlock (&sip_msg->sip_msg_mutex);
          return (NULL);
       }
-      substate = sip_search_for_header (sip_msg, SIP_SUBSCRIPTION_STATE, NULL);
+      substate = sip_search_for_header_id (sip_msg, SIP_HDR_SUBSCRIPTION_STATE, NULL);
       if (substate == NULL)
       {
          (void) pthread_mutex_unlock (&sip_msg->sip_msg_mutex);
@@ -807,7 +798,7 @@ sip_complete_dialog (_sip_msg_t * sip_msg, _sip_dialog_t * dialog, void (*func)
       else
       {
          (void) pthread_mutex_lock (&sip_msg->sip_msg_mutex);
-         thdr = sip_search_for_header (sip_msg, SIP_TO, NULL);
+         thdr = sip_search_for_header_id (sip_msg, SIP_HDR_TO, NULL);
          (void) pthread_mutex_unlock (&sip_msg->sip_msg_mutex);
       }
       if (thdr == NULL)
@@ -941,7 +932,7 @@ sip_complete_dialog (_sip_msg_t * sip_msg, _sip_dialog_t * dialog, void (*func)
    (void) pthread_mutex_unlock (&dialog->sip_dlg_mutex);
 
    /* Add it to the hash table */
-   if (sip_hash_add (sip_dialog_hash, (void *) dialog, SIP_DIGEST_TO_HASH (dialog->sip_dlg_id)) != 0)
+   if (sip_hash_add (&sip_dialog_hash, (void *) dialog, dialog->sip_dlg_id) != 0)
    {
       sip_release_dialog_res (dialog);
       return (NULL);
@@ -1012,33 +1003,33 @@ sip_dialog_t sip_dialog_create (_sip_msg_t * resp, _sip_msg_t * req, int what)
    {
       if (method == NOTIFY)
       {
-         fhdr = sip_search_for_header (resp, SIP_FROM, NULL);
-         thdr = sip_search_for_header (resp, SIP_TO, NULL);
+         fhdr = sip_search_for_header_id (resp, SIP_HDR_FROM, NULL);
+         thdr = sip_search_for_header_id (resp, SIP_HDR_TO, NULL);
       }
       else
       {
-         fhdr = sip_search_for_header (resp, SIP_TO, NULL);
-         thdr = sip_search_for_header (resp, SIP_FROM, NULL);
+         fhdr = sip_search_for_header_id (resp, SIP_HDR_TO, NULL);
+         thdr = sip_search_for_header_id (resp, SIP_HDR_FROM, NULL);
       }
       (void) pthread_mutex_lock (&req->sip_msg_mutex);
-      chdr = sip_search_for_header (req, SIP_CONTACT, NULL);
+      chdr = sip_search_for_header_id (req, SIP_HDR_CONTACT, NULL);
       (void) pthread_mutex_unlock (&req->sip_msg_mutex);
    }
    else
    {
       if (method == NOTIFY)
       {
-         thdr = sip_search_for_header (resp, SIP_FROM, NULL);
-         fhdr = sip_search_for_header (resp, SIP_TO, NULL);
+         thdr = sip_search_for_header_id (resp, SIP_HDR_FROM, NULL);
+         fhdr = sip_search_for_header_id (resp, SIP_HDR_TO, NULL);
       }
       else
       {
-         fhdr = sip_search_for_header (resp, SIP_FROM, NULL);
-         thdr = sip_search_for_header (resp, SIP_TO, NULL);
+         fhdr = sip_search_for_header_id (resp, SIP_HDR_FROM, NULL);
+         thdr = sip_search_for_header_id (resp, SIP_HDR_TO, NULL);
       }
-      chdr = sip_search_for_header (resp, SIP_CONTACT, NULL);
+      chdr = sip_search_for_header_id (resp, SIP_HDR_CONTACT, NULL);
    }
-   cihdr = sip_search_for_header (resp, SIP_CALL_ID, NULL);
+   cihdr = sip_search_for_header_id (resp, SIP_HDR_CALL_ID, NULL);
    (void) pthread_mutex_unlock (&resp->sip_msg_mutex);
    if (fhdr == NULL || thdr == NULL || cihdr == NULL)
       return (NULL);
@@ -1087,7 +1078,7 @@ sip_dialog_t sip_dialog_create (_sip_msg_t * resp, _sip_msg_t * req, int what)
    (void) pthread_mutex_init (&dialog->sip_dlg_mutex, NULL);
 
    /* Add it to the hash table */
-   if (sip_hash_add (sip_dialog_hash, (void *) dialog, SIP_DIGEST_TO_HASH (dialog->sip_dlg_id)) != 0)
+   if (sip_hash_add (&sip_dialog_hash, (void *) dialog, dialog->sip_dlg_id) != 0)
    {
       sip_release_dialog_res (dialog);
       return (NULL);
@@ -1103,92 +1094,60 @@ sip_dialog_t sip_dialog_create (_sip_msg_t * resp, _sip_msg_t * req, int what)
 }
 
 /*
- * Check if this dialog is a match.
+ * Check if this dialog is a match. Called by sip_hash_find() without
+ * any lock held, the dialog may be on its way out, in which case the
+ * reference can't be taken.
  */
 boolean_t sip_dialog_match (void *obj, void *hindex)
 {
    _sip_dialog_t *dialog = (_sip_dialog_t *) obj;
 
-   (void) pthread_mutex_lock (&dialog->sip_dlg_mutex);
-   if (dialog->sip_dlg_state == SIP_DLG_DESTROYED)
-   {
-      (void) pthread_mutex_unlock (&dialog->sip_dlg_mutex);
+   if (__atomic_load_n (&dialog->sip_dlg_state, __ATOMIC_RELAXED) == SIP_DLG_DESTROYED)
       return (B_FALSE);
-   }
-   if (bcmp (dialog->sip_dlg_id, hindex, sizeof (dialog->sip_dlg_id)) == 0)
-   {
-      SIP_DLG_REFCNT_INCR (dialog);
-      (void) pthread_mutex_unlock (&dialog->sip_dlg_mutex);
-      return (B_TRUE);
-   }
-   (void) pthread_mutex_unlock (&dialog->sip_dlg_mutex);
-   return (B_FALSE);
-}
-
-/* Don't delete, just take it out of the hash */
-boolean_t sip_dialog_dontfree (void *obj, void *hindex, int *found)
-{
-   _sip_dialog_t *dialog = (_sip_dialog_t *) obj;
-
-   *found = 0;
-   (void) pthread_mutex_lock (&dialog->sip_dlg_mutex);
    if (bcmp (dialog->sip_dlg_id, hindex, sizeof (dialog->sip_dlg_id)) == 0)
-   {
-      *found = 1;
-      (void) pthread_mutex_unlock (&dialog->sip_dlg_mutex);
-      return (B_TRUE);
-   }
-   (void) pthread_mutex_unlock (&dialog->sip_dlg_mutex);
+      return (sip_ref_get (&dialog->sip_dlg_ref_cnt));
    return (B_FALSE);
 }
 
 /*
- * Free resources associated with the dialog, the object will be removed
- * from the hash list by sip_hash_delete.
+ * The dialog can be removed from the hash list if the reference count is
+ * 0, mark it so that lookups can't take a new one. Passed to
+ * sip_hash_remove().
  */
-boolean_t sip_dialog_free (void *obj, void *hindex, int *found)
+boolean_t sip_dialog_unused (void *obj)
 {
    _sip_dialog_t *dialog = (_sip_dialog_t *) obj;
 
-   *found = 0;
-   (void) pthread_mutex_lock (&dialog->sip_dlg_mutex);
-   if (bcmp (dialog->sip_dlg_id, hindex, sizeof (dialog->sip_dlg_id)) == 0)
-   {
-      *found = 1;
-      assert (dialog->sip_dlg_state == SIP_DLG_DESTROYED);
-      if (dialog->sip_dlg_ref_cnt != 0)
-      {
-         (void) pthread_mutex_unlock (&dialog->sip_dlg_mutex);
-         return (B_FALSE);
-      }
-      (void) pthread_mutex_unlock (&dialog->sip_dlg_mutex);
-      sip_release_dialog_res (dialog);
-      return (B_TRUE);
-   }
-   (void) pthread_mutex_unlock (&dialog->sip_dlg_mutex);
-   return (B_FALSE);
+   assert (dialog->sip_dlg_state == SIP_DLG_DESTROYED);
+   return (sip_ref_kill (&dialog->sip_dlg_ref_cnt));
 }
 
 /*
- * The UAS will receive the request from the transaction layer.  If the
- * request has a tag in the To header field, the UAS core computes the
- * dialog identifier corresponding to the request and compares it with
- * existing dialogs.  If there is a match, this is a mid-dialog request.
+ * Get the local tag and Call-ID of a received message and, if digest is
+ * not NULL, the id of the dialog it is in.
  */
-sip_dialog_t sip_dialog_find (_sip_msg_t * sip_msg)
+static int sip_dialog_find_digest (_sip_msg_t * sip_msg, const sip_str_t ** localtagp, const sip_str_t ** callidp,
+                                   uint16_t * digest)
 {
    const sip_str_t *localtag;
    const sip_str_t *remtag;
    const sip_str_t *callid;
-   uint16_t digest[8];
-   _sip_dialog_t *dialog;
+   const sip_msg_core_t *core = &sip_msg->sip_msg_core;
    boolean_t is_request;
    int error;
 
    is_request = sip_msg_is_request ((sip_msg_t) sip_msg, &error);
    if (error != 0)
-      return (NULL);
-   if (is_request)
+      return (error);
+   if (sip_msg->sip_msg_core_parsed)
+   {
+      localtag = is_request ? core->sip_core_to_tag : core->sip_core_from_tag;
+      remtag = is_request ? core->sip_core_from_tag : core->sip_core_to_tag;
+      if (core->sip_core_callid == NULL || core->sip_core_callid->sip_value_state == SIP_VALUE_BAD)
+         return (EINVAL);
+      callid = &core->sip_core_callid->str_val;
+   }
+   else if (is_request)
    {
       localtag = sip_get_to_tag ((sip_msg_t) sip_msg, &error);
       if (error == 0)
@@ -1201,24 +1160,66 @@ sip_dialog_t sip_dialog_find (_sip_msg_t * sip_msg)
          localtag = sip_get_from_tag ((sip_msg_t) sip_msg, &error);
    }
    if (error != 0)
-      return (NULL);
-   callid = sip_get_callid ((sip_msg_t) sip_msg, &error);
+      return (error);
+   if (!sip_msg->sip_msg_core_parsed)
+      callid = sip_get_callid ((sip_msg_t) sip_msg, &error);
    if (error != 0 || remtag == NULL || localtag == NULL || callid == NULL)
    {
-      return (NULL);
+      return (EINVAL);
    }
-   sip_md5_hash (localtag->sip_str_ptr, localtag->sip_str_len,
-                 remtag->sip_str_ptr, remtag->sip_str_len,
-                 callid->sip_str_ptr, callid->sip_str_len, NULL, 0, NULL, 0, NULL, 0, (uchar_t *) digest);
+   if (digest != NULL)
+      sip_md5_hash (localtag->sip_str_ptr, localtag->sip_str_len,
+                    remtag->sip_str_ptr, remtag->sip_str_len,
+                    callid->sip_str_ptr, callid->sip_str_len, NULL, 0, NULL, 0, NULL, 0, (uchar_t *) digest);
+   *localtagp = localtag;
+   *callidp = callid;
+   return (0);
+}
+
+/*
+ * Work out the digest of the dialog of the received sip_msg and start
+ * bringing in its slot, for sip_dialog_find() to use shortly.
+ */
+void sip_dialog_prefetch (_sip_msg_t * sip_msg)
+{
+   const sip_str_t *localtag;
+   const sip_str_t *callid;
 
-   dialog = (_sip_dialog_t *) sip_hash_find (sip_dialog_hash,
-                                             (void *) digest, SIP_DIGEST_TO_HASH (digest), sip_dialog_match);
+   if (sip_dialog_find_digest (sip_msg, &localtag, &callid, sip_msg->sip_msg_dialog_digest) != 0)
+      return;
+   sip_msg->sip_msg_digests |= SIP_MSG_DIALOG_DIGEST;
+   sip_hash_prefetch (&sip_dialog_hash, sip_msg->sip_msg_dialog_digest);
+}
+
+/*
+ * The UAS will receive the request from the transaction layer.  If the
+ * request has a tag in the To header field, the UAS core computes the
+ * dialog identifier corresponding to the request and compares it with
+ * existing dialogs.  If there is a match, this is a mid-dialog request.
+ */
+sip_dialog_t sip_dialog_find (_sip_msg_t * sip_msg)
+{
+   const sip_str_t *localtag;
+   const sip_str_t *callid;
+   uint16_t digest[8];
+   _sip_dialog_t *dialog;
+
+   if (sip_msg->sip_msg_digests & SIP_MSG_DIALOG_DIGEST)
+   {
+      if (sip_dialog_find_digest (sip_msg, &localtag, &callid, NULL) != 0)
+         return (NULL);
+      bcopy (sip_msg->sip_msg_dialog_digest, digest, sizeof (digest));
+   }
+   else if (sip_dialog_find_digest (sip_msg, &localtag, &callid, digest) != 0)
+   {
+      return (NULL);
+   }
+   dialog = (_sip_dialog_t *) sip_hash_find (&sip_dialog_hash, (void *) digest, sip_dialog_match);
    if (dialog == NULL)
    {
       sip_md5_hash (localtag->sip_str_ptr, localtag->sip_str_len,
                     NULL, 0, callid->sip_str_ptr, callid->sip_str_len, NULL, 0, NULL, 0, NULL, 0, (uchar_t *) digest);
-      dialog = (_sip_dialog_t *) sip_hash_find (sip_dialog_phash,
-                                                (void *) digest, SIP_DIGEST_TO_HASH (digest), sip_dialog_match);
+      dialog = (_sip_dialog_t *) sip_hash_find (&sip_dialog_phash, (void *) digest, sip_dialog_match);
    }
    return ((sip_dialog_t) dialog);
 }
@@ -1231,7 +1232,6 @@ void sip_dlg_self_destruct (void *args)
 {
    sip_dialog_timer_obj_t *tim_obj = (sip_dialog_timer_obj_t *) args;
    _sip_dialog_t *dialog = (_sip_dialog_t *) tim_obj->dialog;
-   int index;
 
    if (dialog->sip_dlg_type == SIP_UAC_DIALOG)
       SIP_DLG_REFCNT_DECR (dialog);
@@ -1241,13 +1241,11 @@ void sip_dlg_self_destruct (void *args)
    (void) pthread_mutex_unlock (&dialog->sip_dlg_mutex);
    if (dialog->sip_dlg_type == SIP_UAC_DIALOG)
    {
-      index = SIP_DIGEST_TO_HASH (dialog->sip_dlg_id);
-      sip_hash_delete (sip_dialog_phash, (void *) dialog->sip_dlg_id, index, sip_dialog_dontfree);
+      (void) sip_hash_remove (&sip_dialog_phash, (void *) dialog, NULL);
    }
    if (tim_obj->func != NULL)
       tim_obj->func (dialog, NULL, NULL);
    sip_release_dialog_res (dialog);
-   free (tim_obj);
 }
 
 /* Terminate a dialog */
@@ -1269,10 +1267,8 @@ void sip_dialog_terminate (_sip_dialog_t * dialog, sip_msg_t sip_msg)
 /* Delete a dialog */
 void sip_dialog_delete (_sip_dialog_t * dialog)
 {
-   int index;
-
-   index = SIP_DIGEST_TO_HASH (dialog->sip_dlg_id);
-   sip_hash_delete (sip_dialog_hash, (void *) dialog->sip_dlg_id, index, sip_dialog_free);
+   if (sip_hash_remove (&sip_dialog_hash, (void *) dialog, sip_dialog_unused))
+      sip_release_dialog_res (dialog);
 }
 
 /* Process an incoming request/response */
@@ -1515,8 +1511,6 @@ sip_update_dialog (sip_dialog_t dialog, _sip_msg_t * sip_msg, void (*func) (sip_
          }
          else
          {
-            int index;
-
             /*
              * take it out of the list so that further
              * responses will not result in a dialog.
@@ -1535,9 +1529,8 @@ sip_update_dialog (sip_dialog_t dialog, _sip_msg_t * sip_msg, void (*func) (sip_
             {
                SIP_CANCEL_TIMER (dialog->sip_dlg_timer);
             }
-            index = SIP_DIGEST_TO_HASH (dialog->sip_dlg_id);
             (void) pthread_mutex_unlock (&_dialog->sip_dlg_mutex);
-            sip_hash_delete (sip_dialog_phash, (void *) _dialog->sip_dlg_id, index, sip_dialog_dontfree);
+            (void) sip_hash_remove (&sip_dialog_phash, (void *) _dialog, NULL);
             (void) pthread_mutex_lock (&_dialog->sip_dlg_mutex);
             decr_ref = B_TRUE;
          }
@@ -1557,22 +1550,30 @@ sip_update_dialog (sip_dialog_t dialog, _sip_msg_t * sip_msg, void (*func) (sip_
    return (dialog);
 }
 
-/* Initialize the hash table */
-void sip_dialog_init (void (*ulp_state_cb) (sip_dialog_t, sip_msg_t, int, int))
+/*
+ * Initialize the hash tables, 'hash_size' is the initial capacity of each,
+ * 0 for the default.
+ */
+int sip_dialog_init (void (*ulp_state_cb) (sip_dialog_t, sip_msg_t, int, int), int hash_size)
 {
-   int cnt;
+   int ret;
 
-   for (cnt = 0; cnt < SIP_HASH_SZ; cnt++)
+   if ((ret = sip_hash_init (&sip_dialog_hash, hash_size, offsetof (_sip_dialog_t, sip_dlg_hash_link))) != 0)
+      return (ret);
+   if ((ret = sip_hash_init (&sip_dialog_phash, hash_size, offsetof (_sip_dialog_t, sip_dlg_phash_link))) != 0)
    {
-      sip_dialog_hash[cnt].hash_count = 0;
-      sip_dialog_hash[cnt].hash_head = NULL;
-      sip_dialog_hash[cnt].hash_tail = NULL;
-      (void) pthread_mutex_init (&sip_dialog_hash[cnt].sip_hash_mutex, NULL);
-      sip_dialog_phash[cnt].hash_count = 0;
-      sip_dialog_phash[cnt].hash_head = NULL;
-      sip_dialog_phash[cnt].hash_tail = NULL;
-      (void) pthread_mutex_init (&sip_dialog_phash[cnt].sip_hash_mutex, NULL);
+      sip_hash_fini (&sip_dialog_hash);
+      return (ret);
    }
    if (ulp_state_cb != NULL)
       sip_dlg_ulp_state_cb = ulp_state_cb;
+   return (0);
+}
+
+/* Undo sip_dialog_init(), no dialog may have been created */
+void sip_dialog_fini ()
+{
+   sip_hash_fini (&sip_dialog_hash);
+   sip_hash_fini (&sip_dialog_phash);
+   sip_dlg_ulp_state_cb = NULL;
 }
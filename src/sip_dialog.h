@@ -33,21 +33,26 @@ extern "C"
 #endif
 
 #include "sip_miscdefs.h"
+#include "sip_hash.h"
+#include "sip_epoch.h"
 
 /*
  * Dialogs are linked in their own list.
  */
 
 
-/* This is always done within sip_dlg_mutex */
+/*
+ * The count is atomic since lookups take their reference without
+ * sip_dlg_mutex (sip_dialog_match()).
+ */
 #define	SIP_DLG_REFCNT_INCR(dialog)					\
-	(dialog)->sip_dlg_ref_cnt++;
+	(void) __atomic_add_fetch(&(dialog)->sip_dlg_ref_cnt, 1, __ATOMIC_RELAXED);
 
 #define	SIP_DLG_REFCNT_DECR(dialog)	 {				\
 	(void) pthread_mutex_lock(&((dialog)->sip_dlg_mutex));		\
 	assert((dialog)->sip_dlg_ref_cnt > 0);				\
-	(dialog)->sip_dlg_ref_cnt--;					\
-	if ((dialog)->sip_dlg_ref_cnt == 0 &&				\
+	if (__atomic_sub_fetch(&(dialog)->sip_dlg_ref_cnt, 1,		\
+	    __ATOMIC_ACQ_REL) == 0 &&					\
 	    (dialog)->sip_dlg_state == SIP_DLG_DESTROYED) {		\
 		(void) pthread_mutex_unlock(&((dialog)->sip_dlg_mutex)); \
 		sip_dialog_delete(dialog);				\
@@ -56,6 +61,13 @@ extern "C"
 	}								\
 }
 
+/* Timer object for partial dialogs */
+   typedef struct sip_dialog_timer_obj_s
+   {
+      struct sip_dialog *dialog;
+      void (*func) (sip_dialog_t, sip_msg_t, void *);
+   } sip_dialog_timer_obj_t;
+
 /* The dialog structure */
    typedef struct sip_dialog
    {
@@ -76,14 +88,20 @@ extern "C"
       pthread_mutex_t sip_dlg_mutex;
       uint32_t sip_dlg_ref_cnt;
       sip_timer_t sip_dlg_timer;        /* to delete partial dialogs */
+      sip_dialog_timer_obj_t sip_dlg_timer_obj; /* arg of sip_dlg_timer */
       boolean_t sip_dlg_on_fork;
       sip_method_t sip_dlg_method;
       void *sip_dlg_ctxt;       /* currently unused */
+      sip_hash_link_t sip_dlg_hash_link;        /* in sip_dialog_hash */
+      sip_hash_link_t sip_dlg_phash_link;       /* in sip_dialog_phash */
+      sip_epoch_node_t sip_dlg_epoch_node;      /* to free once unused */
    } _sip_dialog_t;
 
-   void sip_dialog_init (void (*ulp_dlg_state) (sip_dialog_t, sip_msg_t, int, int));
+   int sip_dialog_init (void (*ulp_dlg_state) (sip_dialog_t, sip_msg_t, int, int), int);
+   void sip_dialog_fini ();
    sip_dialog_t sip_dialog_create (_sip_msg_t *, _sip_msg_t *, int);
    sip_dialog_t sip_dialog_find (_sip_msg_t *);
+   void sip_dialog_prefetch (_sip_msg_t *);
    int sip_dialog_process (_sip_msg_t *, sip_dialog_t *, void (*func) (sip_dialog_t, sip_msg_t, void *));
    sip_dialog_t sip_update_dialog (sip_dialog_t, _sip_msg_t *, void (*func) (sip_dialog_t, sip_msg_t, void *));
    void sip_dialog_terminate (sip_dialog_t, sip_msg_t);
@@ -0,0 +1,243 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2006 Sun Microsystems, Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "sip_miscdefs.h"
+#include "sip_epoch.h"
+
+/*
+ * Every thread that reads has a record with the global epoch it entered
+ * its read section in. An object retired at epoch e can be freed once no
+ * record holds an epoch <= e. Records are never freed, a record left by
+ * a thread that exited is reused by the next new thread.
+ */
+typedef struct sip_epoch_rec_s
+{
+   struct sip_epoch_rec_s *er_next;
+   uint64_t er_epoch;           /* 0 when not in a read section */
+   int er_nest;
+   int er_inuse;
+} sip_epoch_rec_t;
+
+/* Epochs start at 1, 0 means 'not reading' */
+static uint64_t sip_epoch_global = 1;
+static sip_epoch_rec_t *sip_epoch_recs;
+static pthread_key_t sip_epoch_key;
+static pthread_once_t sip_epoch_once = PTHREAD_ONCE_INIT;
+
+/* Retired objects, oldest first */
+static pthread_mutex_t sip_epoch_limbo_lock = PTHREAD_MUTEX_INITIALIZER;
+static sip_epoch_node_t *sip_epoch_limbo_head;
+static sip_epoch_node_t *sip_epoch_limbo_tail;
+static int sip_epoch_limbo_cnt;
+
+/* Thread exit, give up the record */
+static void sip_epoch_thr_exit (void *arg)
+{
+   sip_epoch_rec_t *rec = (sip_epoch_rec_t *) arg;
+
+   __atomic_store_n (&rec->er_epoch, 0, __ATOMIC_RELEASE);
+   rec->er_nest = 0;
+   __atomic_store_n (&rec->er_inuse, 0, __ATOMIC_RELEASE);
+}
+
+static void sip_epoch_key_init (void)
+{
+   (void) pthread_key_create (&sip_epoch_key, sip_epoch_thr_exit);
+}
+
+/* Get the calling thread's record */
+static sip_epoch_rec_t *sip_epoch_rec (void)
+{
+   sip_epoch_rec_t *rec;
+   int unused;
+
+   (void) pthread_once (&sip_epoch_once, sip_epoch_key_init);
+   rec = (sip_epoch_rec_t *) pthread_getspecific (sip_epoch_key);
+   if (rec != NULL)
+      return (rec);
+   for (rec = __atomic_load_n (&sip_epoch_recs, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->er_next)
+   {
+      unused = 0;
+      if (__atomic_load_n (&rec->er_inuse, __ATOMIC_RELAXED) == 0 &&
+          __atomic_compare_exchange_n (&rec->er_inuse, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      {
+         break;
+      }
+   }
+   if (rec == NULL)
+   {
+      rec = calloc (1, sizeof (sip_epoch_rec_t));
+      if (rec == NULL)
+         return (NULL);
+      rec->er_inuse = 1;
+      rec->er_next = __atomic_load_n (&sip_epoch_recs, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n (&sip_epoch_recs, &rec->er_next, rec, 1,
+                                           __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+         ;
+   }
+   if (pthread_setspecific (sip_epoch_key, rec) != 0)
+   {
+      __atomic_store_n (&rec->er_inuse, 0, __ATOMIC_RELEASE);
+      return (NULL);
+   }
+   return (rec);
+}
+
+/*
+ * Enter a read section, sections nest. Returns B_FALSE if the thread's
+ * record could not be allocated, the caller must then use the locks.
+ */
+boolean_t sip_epoch_enter (void)
+{
+   sip_epoch_rec_t *rec;
+
+   rec = sip_epoch_rec ();
+   if (rec == NULL)
+      return (B_FALSE);
+   if (rec->er_nest++ == 0)
+   {
+      __atomic_store_n (&rec->er_epoch, __atomic_load_n (&sip_epoch_global, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+      /* Publish the epoch before reading anything it protects */
+      __atomic_thread_fence (__ATOMIC_SEQ_CST);
+   }
+   return (B_TRUE);
+}
+
+/* Leave a read section */
+void sip_epoch_exit (void)
+{
+   sip_epoch_rec_t *rec;
+
+   rec = (sip_epoch_rec_t *) pthread_getspecific (sip_epoch_key);
+   assert (rec != NULL && rec->er_nest > 0);
+   if (--rec->er_nest == 0)
+      __atomic_store_n (&rec->er_epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Oldest epoch a reader may still be in */
+static uint64_t sip_epoch_min (void)
+{
+   sip_epoch_rec_t *rec;
+   uint64_t min;
+   uint64_t epoch;
+
+   __atomic_thread_fence (__ATOMIC_SEQ_CST);
+   min = __atomic_load_n (&sip_epoch_global, __ATOMIC_RELAXED);
+   for (rec = __atomic_load_n (&sip_epoch_recs, __ATOMIC_ACQUIRE); rec != NULL; rec = rec->er_next)
+   {
+      epoch = __atomic_load_n (&rec->er_epoch, __ATOMIC_ACQUIRE);
+      if (epoch != 0 && epoch < min)
+         min = epoch;
+   }
+   return (min);
+}
+
+/*
+ * Free 'obj' with 'func' once no reader can reference it. The caller
+ * must already have made it unreachable for new readers. 'node' is
+ * storage for the limbo list, usually embedded in 'obj'.
+ */
+void sip_epoch_retire (sip_epoch_node_t * node, void *obj, void (*func) (void *))
+{
+   sip_epoch_node_t *done = NULL;
+   sip_epoch_node_t *next;
+   uint64_t min;
+
+   node->en_obj = obj;
+   node->en_free = func;
+   node->en_next = NULL;
+   /* Order the caller's unlink before the epoch stamp */
+   __atomic_thread_fence (__ATOMIC_SEQ_CST);
+   (void) pthread_mutex_lock (&sip_epoch_limbo_lock);
+   node->en_epoch = __atomic_fetch_add (&sip_epoch_global, 1, __ATOMIC_SEQ_CST);
+   if (sip_epoch_limbo_tail == NULL)
+      sip_epoch_limbo_head = node;
+   else
+      sip_epoch_limbo_tail->en_next = node;
+   sip_epoch_limbo_tail = node;
+   if (++sip_epoch_limbo_cnt >= SIP_EPOCH_BATCH)
+   {
+      min = sip_epoch_min ();
+      while (sip_epoch_limbo_head != NULL && sip_epoch_limbo_head->en_epoch < min)
+      {
+         next = sip_epoch_limbo_head->en_next;
+         sip_epoch_limbo_head->en_next = done;
+         done = sip_epoch_limbo_head;
+         sip_epoch_limbo_head = next;
+         sip_epoch_limbo_cnt--;
+      }
+      if (sip_epoch_limbo_head == NULL)
+         sip_epoch_limbo_tail = NULL;
+   }
+   (void) pthread_mutex_unlock (&sip_epoch_limbo_lock);
+   while (done != NULL)
+   {
+      next = done->en_next;
+      done->en_free (done->en_obj);
+      done = next;
+   }
+}
+
+/*
+ * Wait until every reader that was in a read section has left it. Must
+ * not be called from within a read section.
+ */
+void sip_epoch_synchronize (void)
+{
+   uint64_t epoch;
+
+   __atomic_thread_fence (__ATOMIC_SEQ_CST);
+   epoch = __atomic_fetch_add (&sip_epoch_global, 1, __ATOMIC_SEQ_CST);
+   while (sip_epoch_min () <= epoch)
+      (void) sched_yield ();
+}
+
+/* Take a reference on an object found without locks, fails if it is dying */
+boolean_t sip_ref_get (uint32_t * ref)
+{
+   uint32_t cnt;
+
+   cnt = __atomic_load_n (ref, __ATOMIC_RELAXED);
+   do
+   {
+      if (cnt == SIP_REF_DEAD)
+         return (B_FALSE);
+   }
+   while (!__atomic_compare_exchange_n (ref, &cnt, cnt + 1, 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+   return (B_TRUE);
+}
+
+/* Mark an unreferenced object as dying, fails if there are references */
+boolean_t sip_ref_kill (uint32_t * ref)
+{
+   uint32_t zero = 0;
+
+   return (__atomic_compare_exchange_n (ref, &zero, SIP_REF_DEAD, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) ? B_TRUE : B_FALSE);
+}
@@ -0,0 +1,76 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2006 Sun Microsystems, Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+#ifndef	_SIP_EPOCH_H
+#define	_SIP_EPOCH_H
+
+#ifdef	__cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <sip.h>
+
+/*
+ * Epoch based reclamation for objects that are looked up without locks
+ * (see sip_hash_find()). A reader brackets its accesses with
+ * sip_epoch_enter()/sip_epoch_exit(). A writer first unlinks an object so
+ * that new readers can not find it, then hands it to sip_epoch_retire();
+ * it is freed once every reader that could have seen it has left.
+ */
+
+/* Retired objects are reclaimed in batches of this many */
+#define	SIP_EPOCH_BATCH		64
+
+/*
+ * Reference counts of objects found without locks. Once the count is
+ * SIP_REF_DEAD the object is being destroyed and no new reference can be
+ * taken.
+ */
+#define	SIP_REF_DEAD		0xffffffffU
+
+/* Embedded in objects that are retired, so retiring does not allocate */
+   typedef struct sip_epoch_node_s
+   {
+      struct sip_epoch_node_s *en_next;
+      void *en_obj;
+      void (*en_free) (void *);
+      uint64_t en_epoch;
+   } sip_epoch_node_t;
+
+   extern boolean_t sip_epoch_enter (void);
+   extern void sip_epoch_exit (void);
+   extern void sip_epoch_retire (sip_epoch_node_t *, void *, void (*)(void *));
+   extern void sip_epoch_synchronize (void);
+   extern boolean_t sip_ref_get (uint32_t *);
+   extern boolean_t sip_ref_kill (uint32_t *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif                          /* _SIP_EPOCH_H */
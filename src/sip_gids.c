@@ -188,6 +188,7 @@ char *sip_branchid (sip_msg_t sip_msg)
    _sip_header_t *from;
    _sip_header_t *callid;
    _sip_msg_t *_sip_msg;
+   const sip_msg_core_t *core;
    int cseq;
    MD5_CTX ctx;
    size_t len;
@@ -211,17 +212,28 @@ char *sip_branchid (sip_msg_t sip_msg)
    }
    _sip_msg = (_sip_msg_t *) sip_msg;
    (void) pthread_mutex_lock (&_sip_msg->sip_msg_mutex);
-   via = sip_search_for_header (_sip_msg, SIP_VIA, NULL);
-   if (via == NULL)
+   if (_sip_msg->sip_msg_core_parsed)
    {
-      (void) pthread_mutex_unlock (&_sip_msg->sip_msg_mutex);
-      goto generate_bid;
+      core = &_sip_msg->sip_msg_core;
+      via = core->sip_core_via_hdr;
+      to = core->sip_core_to_hdr;
+      from = core->sip_core_from_hdr;
+      callid = core->sip_core_callid_hdr;
+      cseq = core->sip_core_cseq != NULL ? core->sip_core_cseq->cseq_num : -1;
+   }
+   else
+   {
+      via = sip_search_for_header_id (_sip_msg, SIP_HDR_VIA, NULL);
+      to = sip_search_for_header_id (_sip_msg, SIP_HDR_TO, NULL);
+      from = sip_search_for_header_id (_sip_msg, SIP_HDR_FROM, NULL);
+      callid = sip_search_for_header_id (_sip_msg, SIP_HDR_CALL_ID, NULL);
+      core = NULL;
    }
-   to = sip_search_for_header (_sip_msg, SIP_TO, NULL);
-   from = sip_search_for_header (_sip_msg, SIP_FROM, NULL);
-   callid = sip_search_for_header (_sip_msg, SIP_CALL_ID, NULL);
    (void) pthread_mutex_unlock (&_sip_msg->sip_msg_mutex);
-   cseq = sip_get_callseq_num (_sip_msg, NULL);
+   if (via == NULL)
+      goto generate_bid;
+   if (core == NULL)
+      cseq = sip_get_callseq_num (_sip_msg, NULL);
    if (to == NULL || from == NULL || callid == NULL || cseq == -1)
       return (NULL);
    if (_sip_msg->sip_msg_req_res == NULL ||
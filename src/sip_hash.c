@@ -29,79 +29,346 @@
 #include <sip.h>
 
 #include "sip_hash.h"
+#include "sip_epoch.h"
 #include "sip_miscdefs.h"
 
 /*
  * This file implements functions that add, search or remove an object
- * from the hash table. The object is opaque to the hash functions. To add
- * an object to the hash table, the caller provides the hash table,
- * the object and the index into the hash table. To search an object,
- * the caller provides the hash table, the digest (opaque), the index into
- * the hash table and the function that does the actual match. Similarly,
- * for removing an object, the caller provides the hash table, the digest
- * (opaque), the index into the hash table and the function that does
- * the acutal deletion of the object - if the deletion is successful,
- * the object is taken off of the hash table.
+ * from the hash table. The object is opaque to the hash functions except
+ * for the sip_hash_link_t embedded in it. To add an object to the hash
+ * table, the caller provides the hash table, the object and its digest.
+ * To search an object, the caller provides the hash table, the digest and
+ * the function that does the actual match. For removing an object, the
+ * caller provides the hash table, the object and optionally the function
+ * that decides whether the object can go - if so, the object is taken off
+ * of the hash table and the caller retires it (see sip_epoch.c). Since the
+ * link records the slot the object is in, removal does not search the
+ * table.
+ *
+ * Searches do not lock, so slots and the shard's array pointers are only
+ * changed with atomic stores, in an order that never hides a live object
+ * from a concurrent search.
+ *
+ * Each shard is an open addressed array with linear probing. A shard
+ * grows by allocating an array twice the size and moving the old
+ * entries over SIP_HASH_MIGRATE_STEP slots at a time on subsequent
+ * adds and deletes, so that no single caller pays for rehashing the
+ * whole shard.
  */
 
-/* Given an object and the hash index, add it to the given hash table */
-int sip_hash_add (sip_hash_t * sip_hash, void *obj, int hindex)
+/*
+ * Fold the 128 bit digest into 64 bits. The digest is already a salted
+ * MD5 so it only needs mixing enough that both the top (shard) and the
+ * bottom (slot) bits depend on all of it.
+ */
+uint64_t sip_hash_digest (const uint16_t * digest)
 {
-   sip_hash_obj_t *new_obj;
-   sip_hash_t *hash_entry;
+   uint64_t lo;
+   uint64_t hi;
+   uint64_t h;
 
-   assert (obj != NULL);
+   bcopy (digest, &lo, sizeof (lo));
+   bcopy (digest + 4, &hi, sizeof (hi));
+   h = lo ^ (hi * 0x9e3779b97f4a7c15ULL);
+   h ^= h >> 33;
+   h *= 0xff51afd7ed558ccdULL;
+   h ^= h >> 33;
+   return (h);
+}
 
-   new_obj = (sip_hash_obj_t *) malloc (sizeof (*new_obj));
-   if (new_obj == NULL)
-      return (-1);
-   new_obj->sip_obj = obj;
-   new_obj->next_obj = NULL;
-   new_obj->prev_obj = NULL;
-   hash_entry = &sip_hash[hindex];
-   (void) pthread_mutex_lock (&hash_entry->sip_hash_mutex);
-   if (hash_entry->hash_count == 0)
+#define	SIP_HASH_SHARD(sip_hash, h)					\
+	(&(sip_hash)->hash_shards[(h) >> (64 - SIP_HASH_SHARD_BITS)])
+
+/* Bracket a change of the shard's arrays, with the shard locked */
+#define	SIP_HASH_WRITE_BEGIN(shard)	{				\
+	__atomic_store_n(&(shard)->hash_seq, (shard)->hash_seq + 1,	\
+	    __ATOMIC_RELAXED);						\
+	__atomic_thread_fence(__ATOMIC_RELEASE);			\
+}
+#define	SIP_HASH_WRITE_END(shard)					\
+	__atomic_store_n(&(shard)->hash_seq, (shard)->hash_seq + 1,	\
+	    __ATOMIC_RELEASE);
+
+/* Put link in the first free slot, caller makes sure there is one */
+static void sip_hash_slot_insert (sip_hash_slot_t * slots, uint32_t mask, uint64_t h, sip_hash_link_t * link)
+{
+   uint32_t index;
+
+   for (index = h & mask;; index = (index + 1) & mask)
    {
-      assert (hash_entry->hash_head == NULL);
-      assert (hash_entry->hash_tail == NULL);
-      hash_entry->hash_head = new_obj;
+      if (slots[index].sip_hash_link == NULL || slots[index].sip_hash_link == SIP_HASH_TOMBSTONE)
+         break;
    }
-   else
+   __atomic_store_n (&slots[index].sip_hash_val, h, __ATOMIC_RELAXED);
+   __atomic_store_n (&slots[index].sip_hash_link, link, __ATOMIC_RELEASE);
+   link->hash_slot = &slots[index];
+}
+
+/*
+ * Empty the given slot. If the next slot is free no probe sequence goes
+ * through this one, nor through the deleted slots right before it, so
+ * they are all released; otherwise the slot is marked deleted. Returns
+ * the number of slots released.
+ */
+static int sip_hash_slot_remove (sip_hash_slot_t * slots, uint32_t mask, uint32_t index)
+{
+   int freed = 1;
+
+   if (slots[(index + 1) & mask].sip_hash_link != NULL)
    {
-      hash_entry->hash_tail->next_obj = new_obj;
-      new_obj->prev_obj = hash_entry->hash_tail;
+      __atomic_store_n (&slots[index].sip_hash_link, SIP_HASH_TOMBSTONE, __ATOMIC_RELEASE);
+      return (0);
    }
-   hash_entry->hash_tail = new_obj;
-   hash_entry->hash_count++;
-   (void) pthread_mutex_unlock (&hash_entry->sip_hash_mutex);
+   __atomic_store_n (&slots[index].sip_hash_link, NULL, __ATOMIC_RELEASE);
+   for (index = (index - 1) & mask; slots[index].sip_hash_link == SIP_HASH_TOMBSTONE; index = (index - 1) & mask)
+   {
+      __atomic_store_n (&slots[index].sip_hash_link, NULL, __ATOMIC_RELEASE);
+      freed++;
+   }
+   return (freed);
+}
+
+/* A replaced array waiting for searches to be done with it */
+typedef struct sip_hash_retired_s
+{
+   sip_epoch_node_t hr_node;
+   sip_hash_slot_t *hr_slots;
+} sip_hash_retired_t;
+
+static void sip_hash_free_retired (void *arg)
+{
+   sip_hash_retired_t *retired = (sip_hash_retired_t *) arg;
+
+   free (retired->hr_slots);
+   free (retired);
+}
+
+/* Free a replaced array once no search can be looking at it */
+static void sip_hash_retire_slots (sip_hash_slot_t * slots)
+{
+   sip_hash_retired_t *retired;
+
+   retired = malloc (sizeof (sip_hash_retired_t));
+   if (retired == NULL)
+   {
+      sip_epoch_synchronize ();
+      free (slots);
+      return;
+   }
+   retired->hr_slots = slots;
+   sip_epoch_retire (&retired->hr_node, (void *) retired, sip_hash_free_retired);
+}
+
+/* Move some of the old array into the new one, free it when done */
+static void sip_hash_migrate (sip_hash_shard_t * shard, uint32_t nslots)
+{
+   sip_hash_slot_t *slot;
+   sip_hash_slot_t *old_slots;
+   uint32_t oldsz;
+
+   if (shard->hash_old_slots == NULL)
+      return;
+   oldsz = shard->hash_old_mask + 1;
+   while (nslots-- > 0 && shard->hash_migrate < oldsz)
+   {
+      slot = &shard->hash_old_slots[shard->hash_migrate++];
+      if (slot->sip_hash_link != NULL && slot->sip_hash_link != SIP_HASH_TOMBSTONE)
+      {
+         sip_hash_slot_insert (shard->hash_slots, shard->hash_mask, slot->sip_hash_val, slot->sip_hash_link);
+         shard->hash_used++;
+         /* Keep the probe sequences through this slot intact */
+         __atomic_store_n (&slot->sip_hash_link, SIP_HASH_TOMBSTONE, __ATOMIC_RELEASE);
+      }
+   }
+   if (shard->hash_migrate == oldsz)
+   {
+      old_slots = shard->hash_old_slots;
+      SIP_HASH_WRITE_BEGIN (shard);
+      __atomic_store_n (&shard->hash_old_slots, NULL, __ATOMIC_RELAXED);
+      __atomic_store_n (&shard->hash_old_mask, 0, __ATOMIC_RELAXED);
+      SIP_HASH_WRITE_END (shard);
+      shard->hash_migrate = 0;
+      sip_hash_retire_slots (old_slots);
+   }
+}
+
+/*
+ * Make room for one more object. If the array is more than 3/4 used,
+ * start moving the shard to an array that is at most half full once
+ * all live objects are in it. Deleted slots are dropped in the process,
+ * so a shard with lots of churn is just rehashed at the same size.
+ */
+static int sip_hash_grow (sip_hash_shard_t * shard)
+{
+   sip_hash_slot_t *slots;
+   uint32_t size;
+
+   size = shard->hash_mask + 1;
+   if ((shard->hash_used + 1) * 4 <= size * 3)
+      return (0);
+   /* Still draining the previous resize, finish it first */
+   if (shard->hash_old_slots != NULL)
+   {
+      sip_hash_migrate (shard, shard->hash_old_mask + 1);
+      if ((shard->hash_used + 1) * 4 <= size * 3)
+         return (0);
+   }
+   while ((shard->hash_count + 1) * 2 > size)
+      size <<= 1;
+   slots = calloc (size, sizeof (sip_hash_slot_t));
+   if (slots == NULL)
+   {
+      /* Keep going in the current array as long as it is not full */
+      return (shard->hash_used + 1 < shard->hash_mask + 1 ? 0 : -1);
+   }
+   SIP_HASH_WRITE_BEGIN (shard);
+   __atomic_store_n (&shard->hash_old_slots, shard->hash_slots, __ATOMIC_RELAXED);
+   __atomic_store_n (&shard->hash_old_mask, shard->hash_mask, __ATOMIC_RELAXED);
+   __atomic_store_n (&shard->hash_slots, slots, __ATOMIC_RELAXED);
+   __atomic_store_n (&shard->hash_mask, size - 1, __ATOMIC_RELAXED);
+   SIP_HASH_WRITE_END (shard);
+   shard->hash_migrate = 0;
+   shard->hash_used = 0;
+   sip_hash_migrate (shard, SIP_HASH_MIGRATE_STEP);
    return (0);
 }
 
+/* Given an object and its digest, add it to the given hash table */
+int sip_hash_add (sip_hash_t * sip_hash, void *obj, const uint16_t * digest)
+{
+   sip_hash_shard_t *shard;
+   sip_hash_link_t *link;
+   uint64_t h;
+
+   assert (obj != NULL);
+
+   link = SIP_HASH_LINK (sip_hash, obj);
+   assert (link->hash_slot == NULL);
+   h = sip_hash_digest (digest);
+   link->hash_val = h;
+   shard = SIP_HASH_SHARD (sip_hash, h);
+   (void) pthread_mutex_lock (&shard->sip_hash_mutex);
+   sip_hash_migrate (shard, SIP_HASH_MIGRATE_STEP);
+   if (sip_hash_grow (shard) != 0)
+   {
+      (void) pthread_mutex_unlock (&shard->sip_hash_mutex);
+      return (-1);
+   }
+   sip_hash_slot_insert (shard->hash_slots, shard->hash_mask, h, link);
+   shard->hash_used++;
+   shard->hash_count++;
+   (void) pthread_mutex_unlock (&shard->sip_hash_mutex);
+   return (0);
+}
+
+/* Look for a match in one of the shard's arrays */
+static void *sip_hash_probe (sip_hash_t * sip_hash, sip_hash_slot_t * slots, uint32_t mask, uint64_t h,
+                             void *digest, boolean_t (*match_func) (void *, void *))
+{
+   uint32_t index;
+   sip_hash_link_t *link;
+   void *obj;
+
+   for (index = h & mask;; index = (index + 1) & mask)
+   {
+      link = __atomic_load_n (&slots[index].sip_hash_link, __ATOMIC_ACQUIRE);
+      if (link == NULL)
+         return (NULL);
+      if (link == SIP_HASH_TOMBSTONE || __atomic_load_n (&slots[index].sip_hash_val, __ATOMIC_RELAXED) != h)
+         continue;
+      obj = SIP_HASH_OBJ (sip_hash, link);
+      if (match_func (obj, digest))
+         return (obj);
+   }
+}
+
 /*
- * Given the hash table, the digest to be searched for,  index into the hash
- * table and the function to do the actual matching, return the object,
- * if found.
+ * Get a consistent view of the shard's arrays, returns the hash_seq it
+ * is valid for.
  */
-void *sip_hash_find (sip_hash_t * sip_hash, void *digest, int hindex, boolean_t (*match_func) (void *, void *))
+static uint32_t sip_hash_snapshot (sip_hash_shard_t * shard, sip_hash_slot_t ** slots, uint32_t * mask,
+                                   sip_hash_slot_t ** old_slots, uint32_t * old_mask)
 {
-   int count;
-   sip_hash_obj_t *tmp;
-   sip_hash_t *hash_entry;
+   uint32_t seq;
 
-   hash_entry = &sip_hash[hindex];
-   (void) pthread_mutex_lock (&hash_entry->sip_hash_mutex);
-   tmp = hash_entry->hash_head;
-   for (count = 0; count < hash_entry->hash_count; count++)
+   for (;;)
    {
-      if (match_func (tmp->sip_obj, digest))
+      seq = __atomic_load_n (&shard->hash_seq, __ATOMIC_ACQUIRE);
+      if ((seq & 1) == 0)
       {
-         (void) pthread_mutex_unlock (&hash_entry->sip_hash_mutex);
-         return (tmp->sip_obj);
+         *slots = __atomic_load_n (&shard->hash_slots, __ATOMIC_RELAXED);
+         *mask = __atomic_load_n (&shard->hash_mask, __ATOMIC_RELAXED);
+         *old_slots = __atomic_load_n (&shard->hash_old_slots, __ATOMIC_RELAXED);
+         *old_mask = __atomic_load_n (&shard->hash_old_mask, __ATOMIC_RELAXED);
+         __atomic_thread_fence (__ATOMIC_ACQUIRE);
+         if (__atomic_load_n (&shard->hash_seq, __ATOMIC_RELAXED) == seq)
+            return (seq);
       }
-      tmp = tmp->next_obj;
    }
-   (void) pthread_mutex_unlock (&hash_entry->sip_hash_mutex);
-   return (NULL);
+}
+
+/*
+ * Given the hash table, the digest to be searched for and the function
+ * to do the actual matching, return the object, if found. No lock is
+ * held, match_func may be called for an object that is being removed and
+ * must take its reference with sip_ref_get(). If the shard started a
+ * resize while we were searching, an object may have moved to an array
+ * we did not look at, so a miss is retried.
+ */
+void *sip_hash_find (sip_hash_t * sip_hash, void *digest, boolean_t (*match_func) (void *, void *))
+{
+   sip_hash_shard_t *shard;
+   sip_hash_slot_t *slots;
+   sip_hash_slot_t *old_slots;
+   uint32_t mask;
+   uint32_t old_mask;
+   uint32_t seq;
+   void *obj = NULL;
+   uint64_t h;
+
+   h = sip_hash_digest ((uint16_t *) digest);
+   shard = SIP_HASH_SHARD (sip_hash, h);
+   if (!sip_epoch_enter ())
+   {
+      (void) pthread_mutex_lock (&shard->sip_hash_mutex);
+      if (shard->hash_old_slots != NULL)
+         obj = sip_hash_probe (sip_hash, shard->hash_old_slots, shard->hash_old_mask, h, digest, match_func);
+      if (obj == NULL)
+         obj = sip_hash_probe (sip_hash, shard->hash_slots, shard->hash_mask, h, digest, match_func);
+      (void) pthread_mutex_unlock (&shard->sip_hash_mutex);
+      return (obj);
+   }
+   do
+   {
+      seq = sip_hash_snapshot (shard, &slots, &mask, &old_slots, &old_mask);
+      if (old_slots != NULL)
+         obj = sip_hash_probe (sip_hash, old_slots, old_mask, h, digest, match_func);
+      if (obj == NULL)
+         obj = sip_hash_probe (sip_hash, slots, mask, h, digest, match_func);
+      __atomic_thread_fence (__ATOMIC_ACQUIRE);
+   }
+   while (obj == NULL && __atomic_load_n (&shard->hash_seq, __ATOMIC_RELAXED) != seq);
+   sip_epoch_exit ();
+   return (obj);
+}
+
+/*
+ * Bring in the slot a lookup of digest starts at, ahead of sip_hash_find()
+ * for it. Only a hint: the shard's arrays are read without a snapshot.
+ */
+void sip_hash_prefetch (sip_hash_t * sip_hash, const void *digest)
+{
+   sip_hash_shard_t *shard;
+   sip_hash_slot_t *slots;
+   uint32_t mask;
+   uint64_t h;
+
+   h = sip_hash_digest ((const uint16_t *) digest);
+   shard = SIP_HASH_SHARD (sip_hash, h);
+   slots = __atomic_load_n (&shard->hash_slots, __ATOMIC_RELAXED);
+   mask = __atomic_load_n (&shard->hash_mask, __ATOMIC_RELAXED);
+   if (slots != NULL)
+      __builtin_prefetch (&slots[h & mask]);
 }
 
 /*
@@ -110,89 +377,138 @@ void *sip_hash_find (sip_hash_t * sip_hash, void *digest, int hindex, boolean_t
  */
 void sip_walk_hash (sip_hash_t * sip_hash, void (*func) (void *, void *), void *arg)
 {
-   sip_hash_t *hash_entry;
+   sip_hash_shard_t *shard;
+   sip_hash_link_t *link;
    int count;
-   int hcount;
-   sip_hash_obj_t *tmp;
+   uint32_t index;
 
-   for (count = 0; count < SIP_HASH_SZ; count++)
+   for (count = 0; count < SIP_HASH_NSHARDS; count++)
    {
-      hash_entry = &sip_hash[count];
-      (void) pthread_mutex_lock (&hash_entry->sip_hash_mutex);
-      tmp = hash_entry->hash_head;
-      for (hcount = 0; hcount < hash_entry->hash_count; hcount++)
+      shard = &sip_hash->hash_shards[count];
+      (void) pthread_mutex_lock (&shard->sip_hash_mutex);
+      if (shard->hash_old_slots != NULL)
+      {
+         for (index = shard->hash_migrate; index <= shard->hash_old_mask; index++)
+         {
+            link = shard->hash_old_slots[index].sip_hash_link;
+            if (link != NULL && link != SIP_HASH_TOMBSTONE)
+               func (SIP_HASH_OBJ (sip_hash, link), arg);
+         }
+      }
+      for (index = 0; index <= shard->hash_mask; index++)
       {
-         assert (tmp->sip_obj != NULL);
-         func (tmp->sip_obj, arg);
-         tmp = tmp->next_obj;
+         link = shard->hash_slots[index].sip_hash_link;
+         if (link != NULL && link != SIP_HASH_TOMBSTONE)
+            func (SIP_HASH_OBJ (sip_hash, link), arg);
       }
-      (void) pthread_mutex_unlock (&hash_entry->sip_hash_mutex);
+      (void) pthread_mutex_unlock (&shard->sip_hash_mutex);
    }
 }
 
 /*
- * Given the hash table, the digest to be searched for,  the index into the
- * hash table and the  delete function provided to do the actual deletion,
- * remove the object from the hash table (i.e. only if the object is deleted).
+ * Take the object off of the hash table. If del_func is provided, it is
+ * called with the shard locked and the object is removed only if it
+ * returns B_TRUE. del_func must not free the object: searches may still
+ * be looking at it, the caller retires it once this returns B_TRUE.
+ * Returns B_FALSE if the object was not in the table or del_func
+ * declined.
  */
-void sip_hash_delete (sip_hash_t * sip_hash, void *digest, int hindex, boolean_t (*del_func) (void *, void *, int *))
+boolean_t sip_hash_remove (sip_hash_t * sip_hash, void *obj, boolean_t (*del_func) (void *))
 {
-   sip_hash_t *hash_entry;
+   sip_hash_shard_t *shard;
+   sip_hash_link_t *link;
+   sip_hash_slot_t *slot;
+   int freed;
+
+   link = SIP_HASH_LINK (sip_hash, obj);
+   shard = SIP_HASH_SHARD (sip_hash, link->hash_val);
+   (void) pthread_mutex_lock (&shard->sip_hash_mutex);
+   slot = link->hash_slot;
+   if (slot == NULL)
+   {
+      (void) pthread_mutex_unlock (&shard->sip_hash_mutex);
+      return (B_FALSE);
+   }
+   if (del_func != NULL && !del_func (obj))
+   {
+      (void) pthread_mutex_unlock (&shard->sip_hash_mutex);
+      return (B_FALSE);
+   }
+   link->hash_slot = NULL;
+   if (shard->hash_old_slots != NULL && slot >= shard->hash_old_slots &&
+       slot <= &shard->hash_old_slots[shard->hash_old_mask])
+   {
+      (void) sip_hash_slot_remove (shard->hash_old_slots, shard->hash_old_mask, slot - shard->hash_old_slots);
+   }
+   else
+   {
+      freed = sip_hash_slot_remove (shard->hash_slots, shard->hash_mask, slot - shard->hash_slots);
+      shard->hash_used -= freed;
+   }
+   shard->hash_count--;
+   sip_hash_migrate (shard, SIP_HASH_MIGRATE_STEP);
+   (void) pthread_mutex_unlock (&shard->sip_hash_mutex);
+   return (B_TRUE);
+}
+
+/*
+ * Initialize the hash table. 'size' is the number of objects the table
+ * should hold before it needs to grow, 0 means SIP_HASH_DEFAULT_SZ.
+ * 'link_off' is the offset of the sip_hash_link_t for this table in the
+ * objects it holds.
+ */
+int sip_hash_init (sip_hash_t * sip_hash, int size, size_t link_off)
+{
+   sip_hash_shard_t *shard;
+   uint32_t shardsz = SIP_HASH_MIN_SHARD_SZ;
    int count;
-   sip_hash_obj_t *tmp;
-   int found;
 
-   hash_entry = &sip_hash[hindex];
-   (void) pthread_mutex_lock (&hash_entry->sip_hash_mutex);
-   tmp = hash_entry->hash_head;
-   for (count = 0; count < hash_entry->hash_count; count++)
+   if (size <= 0)
+      size = SIP_HASH_DEFAULT_SZ;
+   /* Keep each shard at most half full */
+   while (shardsz < 2 * ((uint32_t) size / SIP_HASH_NSHARDS + 1))
+      shardsz <<= 1;
+   sip_hash->hash_link_off = link_off;
+   for (count = 0; count < SIP_HASH_NSHARDS; count++)
    {
-      if (del_func (tmp->sip_obj, digest, &found))
+      shard = &sip_hash->hash_shards[count];
+      shard->hash_slots = calloc (shardsz, sizeof (sip_hash_slot_t));
+      if (shard->hash_slots == NULL)
       {
-         if (tmp == hash_entry->hash_head)
-         {
-            if (tmp->next_obj != NULL)
-            {
-               hash_entry->hash_head = tmp->next_obj;
-               tmp->next_obj->prev_obj = NULL;
-            }
-            else
-            {
-               assert (hash_entry->hash_tail == hash_entry->hash_head);
-               hash_entry->hash_head = NULL;
-               hash_entry->hash_tail = NULL;
-            }
-         }
-         else
+         while (--count >= 0)
          {
-            sip_hash_obj_t *next = tmp->next_obj;
-
-            if (next != NULL)
-            {
-               tmp->prev_obj->next_obj = next;
-               next->prev_obj = tmp->prev_obj;
-            }
-            else
-            {
-               assert (hash_entry->hash_tail == tmp);
-               tmp->prev_obj->next_obj = NULL;
-               hash_entry->hash_tail = tmp->prev_obj;
-            }
+            shard = &sip_hash->hash_shards[count];
+            free (shard->hash_slots);
+            shard->hash_slots = NULL;
+            (void) pthread_mutex_destroy (&shard->sip_hash_mutex);
          }
-         tmp->prev_obj = NULL;
-         tmp->next_obj = NULL;
-         free (tmp);
-         hash_entry->hash_count--;
-         (void) pthread_mutex_unlock (&hash_entry->sip_hash_mutex);
-         return;
-         /* If we found the object, we are done */
+         return (ENOMEM);
       }
-      else if (found == 1)
-      {
-         (void) pthread_mutex_unlock (&hash_entry->sip_hash_mutex);
-         return;
-      }
-      tmp = tmp->next_obj;
+      shard->hash_mask = shardsz - 1;
+      shard->hash_used = 0;
+      shard->hash_count = 0;
+      shard->hash_old_slots = NULL;
+      shard->hash_old_mask = 0;
+      shard->hash_migrate = 0;
+      shard->hash_seq = 0;
+      (void) pthread_mutex_init (&shard->sip_hash_mutex, NULL);
+   }
+   return (0);
+}
+
+/* Free the arrays of an empty table, undoing sip_hash_init() */
+void sip_hash_fini (sip_hash_t * sip_hash)
+{
+   sip_hash_shard_t *shard;
+   int count;
+
+   for (count = 0; count < SIP_HASH_NSHARDS; count++)
+   {
+      shard = &sip_hash->hash_shards[count];
+      free (shard->hash_slots);
+      free (shard->hash_old_slots);
+      shard->hash_slots = NULL;
+      shard->hash_old_slots = NULL;
+      (void) pthread_mutex_destroy (&shard->sip_hash_mutex);
    }
-   (void) pthread_mutex_unlock (&hash_entry->sip_hash_mutex);
 }
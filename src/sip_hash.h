@@ -33,38 +33,97 @@ extern "C"
 #endif
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <pthread.h>
 
-/* A prime number */
-#define	SIP_HASH_SZ	6037
+/*
+ * The transaction and dialog tables are keyed on a 128 bit MD5 digest
+ * (uint16_t[8]). Each table is split into SIP_HASH_NSHARDS independently
+ * locked shards, every shard being a linear probing open addressed array
+ * whose size is a power of two. The top bits of the folded digest pick
+ * the shard, the low bits the slot.
+ */
+#define	SIP_HASH_SHARD_BITS	8
+#define	SIP_HASH_NSHARDS	(1 << SIP_HASH_SHARD_BITS)
+
+/* Default initial capacity of a table (all shards), in objects */
+#define	SIP_HASH_DEFAULT_SZ	16384
+
+/* Smallest shard, in slots */
+#define	SIP_HASH_MIN_SHARD_SZ	16
+
+/* Number of old slots moved to the new array per add/delete when resizing */
+#define	SIP_HASH_MIGRATE_STEP	16
 
-#define	SIP_DIGEST_TO_HASH(digest)					\
-	((digest[0] + digest[1] + digest[2] + digest[3] + digest[4] +	\
-	digest[5] + digest[6] + digest[7]) % SIP_HASH_SZ)
+/* Marks a slot whose object has been deleted */
+#define	SIP_HASH_TOMBSTONE	((sip_hash_link_t *)-1)
 
-/* An entry in the hash table, sip_obj is opaque */
-   typedef struct sip_hash_obj_s
+/* Fold the full 128 bit digest into the 64 bit table hash */
+#define	SIP_DIGEST_TO_HASH(digest)	sip_hash_digest((digest))
+
+/*
+ * Objects are linked into a table through a sip_hash_link_t embedded in
+ * the object itself, so table membership needs no allocation. The table
+ * knows where the link is in the object (see sip_hash_init()), callers
+ * deal with object pointers only. An object has a separate link for each
+ * table it can be in. The link must be zeroed before the object is added.
+ */
+   typedef struct sip_hash_link_s
    {
-      void *sip_obj;
-      struct sip_hash_obj_s *next_obj;
-      struct sip_hash_obj_s *prev_obj;
-   } sip_hash_obj_t;
+      uint64_t hash_val;        /* folded digest, set by sip_hash_add() */
+      struct sip_hash_slot_s *hash_slot;        /* NULL when not in the table */
+   } sip_hash_link_t;
 
+/* A slot in the table, points to the link in the object */
+   typedef struct sip_hash_slot_s
+   {
+      uint64_t sip_hash_val;
+      sip_hash_link_t *sip_hash_link;
+   } sip_hash_slot_t;
 
-/* A hash list in the table */
-   typedef struct sip_hash_s
+/*
+ * A shard of the table. While the shard is being resized, hash_old_slots
+ * holds the previous array which is drained into hash_slots a few slots
+ * at a time; lookups check both arrays until it is empty.
+ *
+ * Adds and removes take sip_hash_mutex, lookups take no lock. They read
+ * the array pointers under hash_seq, which is odd while a writer is
+ * switching arrays, and rely on sip_epoch.c to keep removed objects and
+ * replaced arrays around until they are done.
+ */
+   typedef struct sip_hash_shard_s
    {
-      sip_hash_obj_t *hash_head;
-      sip_hash_obj_t *hash_tail;
-      int hash_count;
+      sip_hash_slot_t *hash_slots;
+      uint32_t hash_mask;
+      uint32_t hash_used;       /* live + deleted slots in hash_slots */
+      uint32_t hash_count;      /* live objects in the shard */
+      sip_hash_slot_t *hash_old_slots;
+      uint32_t hash_old_mask;
+      uint32_t hash_migrate;    /* next slot in hash_old_slots to move */
+      uint32_t hash_seq;        /* bumped around array switches */
       pthread_mutex_t sip_hash_mutex;
+   } sip_hash_shard_t;
+
+/* The hash table */
+   typedef struct sip_hash_s
+   {
+      sip_hash_shard_t hash_shards[SIP_HASH_NSHARDS];
+      size_t hash_link_off;     /* offset of the link in the object */
    } sip_hash_t;
 
-   int sip_hash_add (sip_hash_t *, void *, int);
-   void *sip_hash_find (sip_hash_t *, void *, int, boolean_t (*)(void *, void *));
+#define	SIP_HASH_LINK(sip_hash, obj)					\
+	((sip_hash_link_t *)((char *)(obj) + (sip_hash)->hash_link_off))
+#define	SIP_HASH_OBJ(sip_hash, link)					\
+	((void *)((char *)(link) - (sip_hash)->hash_link_off))
+
+   uint64_t sip_hash_digest (const uint16_t *);
+   int sip_hash_add (sip_hash_t *, void *, const uint16_t *);
+   void *sip_hash_find (sip_hash_t *, void *, boolean_t (*)(void *, void *));
+   void sip_hash_prefetch (sip_hash_t *, const void *);
    void sip_walk_hash (sip_hash_t *, void (*)(void *, void *), void *);
-   void sip_hash_delete (sip_hash_t *, void *, int, boolean_t (*)(void *, void *, int *));
-   void sip_hash_init ();
+   boolean_t sip_hash_remove (sip_hash_t *, void *, boolean_t (*)(void *));
+   int sip_hash_init (sip_hash_t *, int, size_t);
+   void sip_hash_fini (sip_hash_t *);
 
 #ifdef	__cplusplus
 }
@@ -43,75 +43,73 @@ sip_methods_t sip_methods[MAX_SIP_METHODS] = {
    {"PRACK", 5}
 };
 
-#define	MAX_SIP_HEADERS 54
-
 /* Built-In Header function table */
 
 sip_header_function_t sip_header_function_table[MAX_SIP_HEADERS] = {
-   {"Unknown", NULL, sip_parse_unknown_header, NULL, NULL, NULL},
-   {"CONTACT", "m", sip_parse_cftr_header, NULL, NULL, sip_free_cftr_header},
-   {"FROM", "F", sip_parse_cftr_header, NULL, NULL, sip_free_cftr_header},
-   {"TO", "T", sip_parse_cftr_header, NULL, NULL, sip_free_cftr_header},
-   {"CONTENT-LENGTH", "l", sip_parse_clen_header, NULL, NULL, sip_free_phdr},
-   {"CONTENT-TYPE", "c", sip_parse_ctype_header, NULL, NULL, sip_free_phdr},
-   {"CALL-ID", "i", sip_parse_cid_header, NULL, NULL, sip_free_phdr},
-   {"CSEQ", NULL, sip_parse_cseq_header, NULL, NULL, sip_free_phdr},
-   {"VIA", "v", sip_parse_via_header, NULL, NULL, sip_free_phdr},
-   {"Max-Forwards", NULL, sip_parse_maxf_header, NULL, NULL, sip_free_phdr},
-   {"RECORD-ROUTE", NULL, sip_parse_cftr_header, NULL, NULL, sip_free_phdr},
-   {"ROUTE", NULL, sip_parse_cftr_header, NULL, NULL, sip_free_phdr},
-   {"ACCEPT", NULL, sip_parse_acpt_header, NULL, NULL, sip_free_phdr},
-   {"ACCEPT-ENCODING", NULL, sip_parse_acpt_encode_header, NULL, NULL,
+   [SIP_HDR_UNKNOWN] = {"Unknown", NULL, sip_parse_unknown_header, NULL, NULL, NULL},
+   [SIP_HDR_CONTACT] = {"CONTACT", "m", sip_parse_cftr_header, NULL, NULL, sip_free_cftr_header},
+   [SIP_HDR_FROM] = {"FROM", "F", sip_parse_cftr_header, NULL, NULL, sip_free_cftr_header},
+   [SIP_HDR_TO] = {"TO", "T", sip_parse_cftr_header, NULL, NULL, sip_free_cftr_header},
+   [SIP_HDR_CONTENT_LENGTH] = {"CONTENT-LENGTH", "l", sip_parse_clen_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_CONTENT_TYPE] = {"CONTENT-TYPE", "c", sip_parse_ctype_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_CALL_ID] = {"CALL-ID", "i", sip_parse_cid_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_CSEQ] = {"CSEQ", NULL, sip_parse_cseq_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_VIA] = {"VIA", "v", sip_parse_via_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_MAX_FORWARDS] = {"Max-Forwards", NULL, sip_parse_maxf_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_RECORD_ROUTE] = {"RECORD-ROUTE", NULL, sip_parse_route_header, NULL, NULL, sip_free_cftr_header},
+   [SIP_HDR_ROUTE] = {"ROUTE", NULL, sip_parse_route_header, NULL, NULL, sip_free_cftr_header},
+   [SIP_HDR_ACCEPT] = {"ACCEPT", NULL, sip_parse_acpt_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_ACCEPT_ENCODE] = {"ACCEPT-ENCODING", NULL, sip_parse_acpt_encode_header, NULL, NULL,
     sip_free_phdr},
-   {"ACCEPT-LANGUAGE", NULL, sip_parse_acpt_lang_header, NULL, NULL,
+   [SIP_HDR_ACCEPT_LANG] = {"ACCEPT-LANGUAGE", NULL, sip_parse_acpt_lang_header, NULL, NULL,
     sip_free_phdr},
-   {"ALERT-INFO", NULL, sip_parse_alert_header, NULL, NULL, sip_free_phdr},
-   {"ALLOW", NULL, sip_parse_allow_header, NULL, NULL, sip_free_phdr},
-   {"CALL-INFO", NULL, sip_parse_callinfo_header, NULL, NULL, sip_free_phdr},
-   {"CONTENT-DISPOSITION", NULL, sip_parse_contentdis_header, NULL, NULL,
+   [SIP_HDR_ALERT_INFO] = {"ALERT-INFO", NULL, sip_parse_alert_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_ALLOW] = {"ALLOW", NULL, sip_parse_allow_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_CALL_INFO] = {"CALL-INFO", NULL, sip_parse_callinfo_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_CONTENT_DIS] = {"CONTENT-DISPOSITION", NULL, sip_parse_contentdis_header, NULL, NULL,
     sip_free_phdr},
-   {"CONTENT-ENCODING", "e", sip_parse_contentencode_header, NULL, NULL,
+   [SIP_HDR_CONTENT_ENCODE] = {"CONTENT-ENCODING", "e", sip_parse_contentencode_header, NULL, NULL,
     sip_free_phdr},
-   {"CONTENT-LANGUAGE", NULL, sip_parse_contentlang_header, NULL, NULL,
+   [SIP_HDR_CONTENT_LANG] = {"CONTENT-LANGUAGE", NULL, sip_parse_contentlang_header, NULL, NULL,
     sip_free_phdr},
-   {"DATE", NULL, sip_parse_date_header, NULL, NULL, sip_free_phdr},
-   {"ERROR-INFO", NULL, sip_parse_errorinfo_header, NULL, NULL, sip_free_phdr},
-   {"EXPIRES", NULL, sip_parse_expire_header, NULL, NULL, sip_free_phdr},
-   {"IN-REPLY-TO", NULL, sip_parse_inreplyto_header, NULL, NULL, sip_free_phdr},
-   {"MIN-EXPIRES", NULL, sip_parse_minexpire_header, NULL, NULL, sip_free_phdr},
-   {"MIME-VERSION", NULL, sip_parse_mimeversion_header, NULL, NULL, sip_free_phdr},
-   {"ORGANIZATION", NULL, sip_parse_org_header, NULL, NULL, sip_free_phdr},
-   {"PRIORITY", NULL, sip_parse_priority_header, NULL, NULL, sip_free_phdr},
-   {"REQUIRE", NULL, sip_parse_require_header, NULL, NULL, sip_free_phdr},
-   {"REPLY-TO", NULL, sip_parse_replyto_header, NULL, NULL, sip_free_phdr},
-   {"RETRY-AFTER", NULL, sip_parse_retryaft_header, NULL, NULL, sip_free_phdr},
-   {"SERVER", NULL, sip_parse_server_header, NULL, NULL, sip_free_phdr},
-   {"SUBJECT", "s", sip_parse_subject_header, NULL, NULL, sip_free_phdr},
-   {"TIMESTAMP", NULL, sip_parse_timestamp_header, NULL, NULL, sip_free_phdr},
-   {"UNSUPPORTED", NULL, sip_parse_usupport_header, NULL, NULL, sip_free_phdr},
-   {"SUPPORTED", "k", sip_parse_support_header, NULL, NULL, sip_free_phdr},
-   {"USER-AGENT", NULL, sip_parse_useragt_header, NULL, NULL, sip_free_phdr},
-   {"WARNING", NULL, sip_parse_warn_header, NULL, NULL, sip_free_phdr},
-   {"ALLOW-EVENTS", "u", sip_parse_allow_events_header, NULL, NULL, sip_free_phdr},
-   {"EVENT", "o", sip_parse_event_header, NULL, NULL, sip_free_phdr},
-   {"SUBSCRIPTION-STATE", NULL, sip_parse_substate_header, NULL, NULL,
+   [SIP_HDR_DATE] = {"DATE", NULL, sip_parse_date_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_ERROR_INFO] = {"ERROR-INFO", NULL, sip_parse_errorinfo_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_EXPIRE] = {"EXPIRES", NULL, sip_parse_expire_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_IN_REPLY_TO] = {"IN-REPLY-TO", NULL, sip_parse_inreplyto_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_MIN_EXPIRE] = {"MIN-EXPIRES", NULL, sip_parse_minexpire_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_MIME_VERSION] = {"MIME-VERSION", NULL, sip_parse_mimeversion_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_ORGANIZATION] = {"ORGANIZATION", NULL, sip_parse_org_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_PRIORITY] = {"PRIORITY", NULL, sip_parse_priority_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_REQUIRE] = {"REQUIRE", NULL, sip_parse_require_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_REPLYTO] = {"REPLY-TO", NULL, sip_parse_replyto_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_RETRY_AFTER] = {"RETRY-AFTER", NULL, sip_parse_retryaft_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_SERVER] = {"SERVER", NULL, sip_parse_server_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_SUBJECT] = {"SUBJECT", "s", sip_parse_subject_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_TIMESTAMP] = {"TIMESTAMP", NULL, sip_parse_timestamp_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_UNSUPPORT] = {"UNSUPPORTED", NULL, sip_parse_usupport_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_SUPPORT] = {"SUPPORTED", "k", sip_parse_support_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_USER_AGENT] = {"USER-AGENT", NULL, sip_parse_useragt_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_WARNING] = {"WARNING", NULL, sip_parse_warn_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_ALLOW_EVENTS] = {"ALLOW-EVENTS", "u", sip_parse_allow_events_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_EVENT] = {"EVENT", "o", sip_parse_event_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_SUBSCRIPTION_STATE] = {"SUBSCRIPTION-STATE", NULL, sip_parse_substate_header, NULL, NULL,
     sip_free_phdr},
-   {"AUTHORIZATION", NULL, sip_parse_author_header, NULL, NULL, sip_free_phdr},
-   {"AUTHENTICATION-INFO", NULL, sip_parse_ainfo_header, NULL, NULL,
+   [SIP_HDR_AUTHOR] = {"AUTHORIZATION", NULL, sip_parse_author_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_AUTHEN_INFO] = {"AUTHENTICATION-INFO", NULL, sip_parse_ainfo_header, NULL, NULL,
     sip_free_phdr},
-   {"PROXY-AUTHORIZATION", NULL, sip_parse_pauthor_header, NULL, NULL,
+   [SIP_HDR_PROXY_AUTHOR] = {"PROXY-AUTHORIZATION", NULL, sip_parse_pauthor_header, NULL, NULL,
     sip_free_phdr},
-   {"PROXY-AUTHENTICATE", NULL, sip_parse_pauthen_header, NULL, NULL,
+   [SIP_HDR_PROXY_AUTHEN] = {"PROXY-AUTHENTICATE", NULL, sip_parse_pauthen_header, NULL, NULL,
     sip_free_phdr},
-   {"PROXY-REQUIRE", NULL, sip_parse_preq_header, NULL, NULL, sip_free_phdr},
-   {"WWW-AUTHENTICATE", NULL, sip_parse_wauthen_header, NULL, NULL, sip_free_phdr},
-   {"RSEQ", NULL, sip_parse_rseq, NULL, NULL, sip_free_phdr},
-   {"RACK", NULL, sip_parse_rack, NULL, NULL, sip_free_phdr},
-   {"P-ASSERTED-IDENTITY", NULL, sip_parse_passertedid, NULL, NULL, sip_free_phdr},
-   {"P-PREFERRED-IDENTITY", NULL, sip_parse_ppreferredid, NULL, NULL,
+   [SIP_HDR_PROXY_REQ] = {"PROXY-REQUIRE", NULL, sip_parse_preq_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_WWW_AUTHEN] = {"WWW-AUTHENTICATE", NULL, sip_parse_wauthen_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_RSEQ] = {"RSEQ", NULL, sip_parse_rseq, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_RACK] = {"RACK", NULL, sip_parse_rack, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_PASSERTEDID] = {"P-ASSERTED-IDENTITY", NULL, sip_parse_passertedid, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_PPREFERREDID] = {"P-PREFERRED-IDENTITY", NULL, sip_parse_ppreferredid, NULL, NULL,
     sip_free_phdr},
-   {"PRIVACY", NULL, sip_parse_privacy_header, NULL, NULL, sip_free_phdr},
-   {NULL, NULL, NULL, NULL, NULL, NULL},
+   [SIP_HDR_PRIVACY] = {"PRIVACY", NULL, sip_parse_privacy_header, NULL, NULL, sip_free_phdr},
+   [SIP_HDR_MAX] = {NULL, NULL, NULL, NULL, NULL, NULL},
 };
 
 /* External/application provided function table */
@@ -151,7 +149,7 @@ void sip_free_phdr (sip_parsed_header_t * header)
    free (header);
 }
 
-/* Free Contact/From/To header */
+/* Free Contact/From/To/Route/Record-Route header */
 void sip_free_cftr_header (sip_parsed_header_t * header)
 {
    sip_hdr_value_t *value;
@@ -471,6 +469,8 @@ int sip_delete_start_line (sip_msg_t sip_msg)
       sip_message_type_t *sip_msg_type_ptr;
 
       sip_msg_type_ptr = _sip_msg->sip_msg_req_res->sip_next;
+      if (_sip_msg->sip_msg_req_res->is_request && _sip_msg->sip_msg_req_res->sip_req_parse_uri != NULL)
+         sip_free_parsed_uri (_sip_msg->sip_msg_req_res->sip_req_parse_uri);
       free (_sip_msg->sip_msg_req_res);
       _sip_msg->sip_msg_req_res = sip_msg_type_ptr;
    }
@@ -497,6 +497,8 @@ void sip_delete_all_headers (_sip_msg_t * _sip_msg)
    }
    _sip_msg->sip_msg_headers_start = NULL;
    _sip_msg->sip_msg_headers_end = NULL;
+   _sip_msg->sip_msg_hdr_indexed = B_FALSE;
+   _sip_msg->sip_msg_core_parsed = B_FALSE;
 }
 
 /*
@@ -515,6 +517,8 @@ void sip_delete_headers (sip_msg_t sip_msg, char *header_name)
    header = sip_search_for_header (_sip_msg, header_name, NULL);
    if (header == NULL)
       return;
+   _sip_msg->sip_msg_hdr_indexed = B_FALSE;
+   _sip_msg->sip_msg_core_parsed = B_FALSE;
    while (header != NULL)
    {
       if (_sip_msg->sip_msg_headers_start == header)
@@ -641,6 +645,199 @@ _sip_add_header (_sip_msg_t * sip_msg, _sip_header_t * new_header, boolean_t app
       }
    }
    sip_msg->sip_msg_len += new_header->sip_hdr_end - new_header->sip_hdr_start;
+   sip_msg->sip_msg_hdr_indexed = B_FALSE;
+   sip_msg->sip_msg_core_parsed = B_FALSE;
+}
+
+/*
+ * Header names are looked up in a hash table of the full and compact
+ * names of both function tables, built by sip_header_names_init(). The
+ * seed is picked so that no two names share a slot, so a lookup is one
+ * hash and one compare. Names are compared lower cased, a word at a time.
+ */
+#define	SIP_HDR_NAME_WORDS	3	/* longer names use strncasecmp() */
+#define	SIP_HDR_NAME_SEEDS	256	/* seeds tried for each table size */
+#define	SIP_HDR_NAME_MIN_BITS	7
+#define	SIP_HDR_NAME_MAX_BITS	10
+
+typedef struct sip_hdr_name_s
+{
+   uint64_t hn_words[SIP_HDR_NAME_WORDS];       /* lower case, 0 padded */
+   const char *hn_name;
+   int hn_len;
+   int hn_id;                   /* see sip_header_id(), 0 if not built-in */
+   sip_header_function_t *hn_func;      /* NULL for a free slot */
+} sip_hdr_name_t;
+
+static sip_hdr_name_t *sip_hdr_names = NULL;
+static uint32_t sip_hdr_names_mask;
+static int sip_hdr_names_shift;
+static uint64_t sip_hdr_names_seed;
+static boolean_t sip_hdr_names_perfect;
+
+/* The entry sip_search_for_header() resolves the name of each id to */
+static sip_header_function_t *sip_hdr_id_funcs[MAX_SIP_HEADERS];
+
+/* Lower case the ASCII letters of the 8 bytes in x */
+static uint64_t sip_hdr_name_fold (uint64_t x)
+{
+   uint64_t low7 = x & 0x7f7f7f7f7f7f7f7fULL;
+   uint64_t ge_A = low7 + 0x3f3f3f3f3f3f3f3fULL;
+   uint64_t gt_Z = low7 + 0x2525252525252525ULL;
+
+   return (x | (((ge_A ^ gt_Z) & ~x & 0x8080808080808080ULL) >> 2));
+}
+
+/* Hash the len bytes at name, leaving their first words lower cased in words */
+static uint64_t sip_hdr_name_hash (const char *name, int len, uint64_t seed, uint64_t * words)
+{
+   uint64_t h = seed ^ (uint64_t) len;
+   int n;
+   int i;
+
+   for (i = 0; i < SIP_HDR_NAME_WORDS; i++)
+   {
+      n = len - i * 8;
+      words[i] = 0;
+      if (n > 0)
+         (void) memcpy (&words[i], name + i * 8, n < 8 ? n : 8);
+      words[i] = sip_hdr_name_fold (words[i]);
+      h = (h ^ words[i]) * 0x9e3779b97f4a7c15ULL;
+      h ^= h >> 29;
+   }
+   return (h);
+}
+
+/* The slot of the len bytes at name, NULL if it is not a header name */
+static sip_hdr_name_t *sip_hdr_name_find (const char *name, int len)
+{
+   uint64_t words[SIP_HDR_NAME_WORDS];
+   sip_hdr_name_t *hn;
+   uint32_t slot;
+   int i;
+
+   slot = sip_hdr_name_hash (name, len, sip_hdr_names_seed, words) >> sip_hdr_names_shift;
+   for (;; slot = (slot + 1) & sip_hdr_names_mask)
+   {
+      hn = &sip_hdr_names[slot];
+      if (hn->hn_func == NULL)
+         return (NULL);
+      if (hn->hn_len == len)
+      {
+         if (len > SIP_HDR_NAME_WORDS * 8)
+         {
+            if (strncasecmp (name, hn->hn_name, len) == 0)
+               return (hn);
+         }
+         else
+         {
+            for (i = 0; i < SIP_HDR_NAME_WORDS && words[i] == hn->hn_words[i]; i++)
+               ;
+            if (i == SIP_HDR_NAME_WORDS)
+               return (hn);
+         }
+      }
+      if (sip_hdr_names_perfect)
+         return (NULL);
+   }
+}
+
+/*
+ * Add the names in table to the hash table of the given size, unless
+ * already there: the first table to name a header wins, as in
+ * sip_get_header_functions(). Returns the number of names that went to
+ * an occupied slot.
+ */
+static int sip_hdr_names_add (sip_hdr_name_t * names, int bits, uint64_t seed, sip_header_function_t * table,
+                              boolean_t builtin)
+{
+   sip_hdr_name_t *hn;
+   uint64_t words[SIP_HDR_NAME_WORDS];
+   uint32_t mask = (1U << bits) - 1;
+   uint32_t slot;
+   const char *name;
+   int collisions = 0;
+   int i;
+   int j;
+
+   for (i = 0; table[i].header_name != NULL || table[i].header_short_name != NULL; i++)
+   {
+      /* An entry without a full name is never returned */
+      if (table[i].header_name == NULL)
+         continue;
+      for (j = 0; j < 2; j++)
+      {
+         name = j == 0 ? table[i].header_name : table[i].header_short_name;
+         if (name == NULL)
+            continue;
+         slot = sip_hdr_name_hash (name, strlen (name), seed, words) >> (64 - bits);
+         for (;; slot = (slot + 1) & mask)
+         {
+            hn = &names[slot];
+            if (hn->hn_func == NULL)
+               break;
+            if (hn->hn_len == strlen (name) && strncasecmp (hn->hn_name, name, hn->hn_len) == 0)
+               break;
+            collisions++;
+         }
+         if (hn->hn_func != NULL)
+            continue;
+         bcopy (words, hn->hn_words, sizeof (words));
+         hn->hn_name = name;
+         hn->hn_len = strlen (name);
+         hn->hn_id = builtin ? i : 0;
+         hn->hn_func = &table[i];
+      }
+   }
+   return (collisions);
+}
+
+/*
+ * Build the header name hash table from the external and the built-in
+ * function tables, looking for a seed that gives each name its own slot.
+ * If there is none, names that collide are probed for.
+ */
+int sip_header_names_init ()
+{
+   sip_hdr_name_t *names;
+   uint64_t seed = 1;
+   int bits = SIP_HDR_NAME_MIN_BITS;
+   int collisions;
+   sip_hdr_name_t *hn;
+   char *name;
+   int id;
+
+   for (;;)
+   {
+      names = calloc (1U << bits, sizeof (sip_hdr_name_t));
+      if (names == NULL)
+         return (ENOMEM);
+      collisions = 0;
+      if (sip_header_function_table_external != NULL)
+         collisions += sip_hdr_names_add (names, bits, seed, sip_header_function_table_external, B_FALSE);
+      collisions += sip_hdr_names_add (names, bits, seed, sip_header_function_table, B_TRUE);
+      if (collisions == 0 || (bits == SIP_HDR_NAME_MAX_BITS && seed == SIP_HDR_NAME_SEEDS))
+         break;
+      free (names);
+      if (++seed > SIP_HDR_NAME_SEEDS)
+      {
+         seed = 1;
+         bits++;
+      }
+   }
+   free (sip_hdr_names);
+   sip_hdr_names_mask = (1U << bits) - 1;
+   sip_hdr_names_shift = 64 - bits;
+   sip_hdr_names_seed = seed;
+   sip_hdr_names_perfect = collisions == 0;
+   sip_hdr_names = names;
+   for (id = SIP_HDR_UNKNOWN + 1; id < SIP_HDR_MAX; id++)
+   {
+      name = sip_header_function_table[id].header_name;
+      hn = sip_hdr_name_find (name, strlen (name));
+      sip_hdr_id_funcs[id] = hn != NULL ? hn->hn_func : NULL;
+   }
+   return (0);
 }
 
 /*
@@ -706,11 +903,40 @@ sip_header_function_t *_sip_get_header_functions (sip_header_function_t * sip_he
    return (&sip_header_function_table[i]);
 }
 
-/* Return the entry from the function table for the given header */
+/*
+ * Return the entry from the function table for the given header. Once
+ * sip_header_names_init() has run, the name is looked up in the hash
+ * table instead of the function tables.
+ */
 sip_header_function_t *sip_get_header_functions (_sip_header_t * sip_header, char *header_name)
 {
    sip_header_function_t *func;
    sip_header_function_t *header_f_table = NULL;
+   sip_hdr_name_t *hn;
+   char *name = header_name;
+   int len;
+
+   if (sip_hdr_names != NULL && (sip_header != NULL || header_name != NULL))
+   {
+      if (header_name == NULL)
+      {
+         if (sip_skip_white_space (sip_header) != 0)
+            return (NULL);
+         name = sip_header->sip_hdr_current;
+         if (sip_find_separator (sip_header, SIP_HCOLON, '\0', '\0') != 0)
+            return (NULL);
+         len = sip_header->sip_hdr_current - name;
+         sip_header->sip_hdr_current = sip_header->sip_hdr_start;
+      }
+      else
+      {
+         len = strlen (header_name);
+      }
+      if (len == 0)
+         return (&sip_header_function_table[0]);
+      hn = sip_hdr_name_find (name, len);
+      return (hn != NULL ? hn->hn_func : NULL);
+   }
 
 
    if (sip_header_function_table_external != NULL)
@@ -723,7 +949,177 @@ sip_header_function_t *sip_get_header_functions (_sip_header_t * sip_header, cha
    return (func);
 }
 
-/* Search for the header name passed in. */
+/*
+ * The id of the header named by the len bytes at name: its entry in
+ * sip_header_function_table, by full or compact name, or 0 if it is not
+ * one of the built-in headers.
+ */
+int sip_header_id (const char *name, int len)
+{
+   sip_header_function_t *f;
+   sip_hdr_name_t *hn;
+   int id;
+
+   if (sip_hdr_names != NULL)
+   {
+      hn = sip_hdr_name_find (name, len);
+      return (hn != NULL ? hn->hn_id : 0);
+   }
+   for (id = 1; sip_header_function_table[id].header_name != NULL; id++)
+   {
+      f = &sip_header_function_table[id];
+      if (strlen (f->header_name) == len && strncasecmp (name, f->header_name, len) == 0)
+         return (id);
+      if (f->header_short_name != NULL && strlen (f->header_short_name) == len &&
+          strncasecmp (name, f->header_short_name, len) == 0)
+      {
+         return (id);
+      }
+   }
+   return (0);
+}
+
+/* Is id one of the headers parsed into sip_msg_core */
+#define	SIP_CORE_HEADER(id)						\
+	((id) == SIP_HDR_VIA || (id) == SIP_HDR_FROM || (id) == SIP_HDR_TO ||	\
+	(id) == SIP_HDR_CALL_ID || (id) == SIP_HDR_CSEQ ||			\
+	(id) == SIP_HDR_MAX_FORWARDS || (id) == SIP_HDR_CONTENT_LENGTH)
+
+/*
+ * Parse the first header of one of the SIP_CORE_HEADER() ids into
+ * sip_msg_core, with the built-in parser, as sip_get_header_value()
+ * would. Returns B_FALSE if the application overrides the header, in
+ * which case the core can't be used.
+ */
+static boolean_t sip_core_header (_sip_msg_t * sip_msg, _sip_header_t * header, int id)
+{
+   sip_msg_core_t *core = &sip_msg->sip_msg_core;
+   sip_parsed_header_t *parsed;
+   sip_hdr_value_t *value = NULL;
+
+   if (sip_hdr_id_funcs[id] != &sip_header_function_table[id])
+      return (B_FALSE);
+   header->sip_hdr_current = header->sip_hdr_start;
+   header->sip_header_functions = sip_hdr_id_funcs[id];
+   if (header->sip_header_parse (header, &parsed) == 0 && parsed != NULL)
+      value = (sip_hdr_value_t *) parsed->value;
+   switch (id)
+   {
+   case SIP_HDR_VIA:
+      core->sip_core_via_hdr = header;
+      core->sip_core_via = value;
+      if (value != NULL && value->sip_value_state != SIP_VALUE_BAD)
+         core->sip_core_branch = sip_get_param_value ((sip_header_value_t) value, "branch", NULL);
+      break;
+   case SIP_HDR_FROM:
+      core->sip_core_from_hdr = header;
+      core->sip_core_from = value;
+      if (value != NULL)
+         core->sip_core_from_tag = sip_get_param_value ((sip_header_value_t) value, "tag", NULL);
+      break;
+   case SIP_HDR_TO:
+      core->sip_core_to_hdr = header;
+      core->sip_core_to = value;
+      if (value != NULL)
+         core->sip_core_to_tag = sip_get_param_value ((sip_header_value_t) value, "tag", NULL);
+      break;
+   case SIP_HDR_CALL_ID:
+      core->sip_core_callid_hdr = header;
+      core->sip_core_callid = value;
+      break;
+   case SIP_HDR_CSEQ:
+      core->sip_core_cseq_hdr = header;
+      core->sip_core_cseq = value;
+      break;
+   case SIP_HDR_MAX_FORWARDS:
+      if (value != NULL)
+         core->sip_core_maxf = value->int_val;
+      break;
+   case SIP_HDR_CONTENT_LENGTH:
+      if (value != NULL)
+         core->sip_core_clen = value->int_val;
+      break;
+   }
+   return (B_TRUE);
+}
+
+/*
+ * Classify the headers of a message and link the ones of each id, so that
+ * sip_search_for_header() goes straight to them. This is done on the first
+ * lookup by id, not when the message is split: splitting is on the path
+ * of every received message and the index only pays for itself once
+ * headers are looked up. Adding or removing headers drops the index,
+ * deleting one (which only marks it) does not. With core set the
+ * mandatory headers are parsed into sip_msg_core on the way.
+ */
+void sip_index_headers (_sip_msg_t * sip_msg, boolean_t core)
+{
+   _sip_header_t *last[MAX_SIP_HEADERS];
+   _sip_header_t *header;
+   char *name;
+   char *p;
+   int id;
+
+   bzero (last, sizeof (last));
+   bzero (sip_msg->sip_msg_hdr_index, sizeof (sip_msg->sip_msg_hdr_index));
+   if (core)
+   {
+      bzero (&sip_msg->sip_msg_core, sizeof (sip_msg->sip_msg_core));
+      sip_msg->sip_msg_core.sip_core_maxf = -1;
+      sip_msg->sip_msg_core.sip_core_clen = -1;
+      sip_msg->sip_msg_core_parsed = B_FALSE;
+   }
+   for (header = sip_msg->sip_msg_headers_start; header != NULL; header = header->sip_hdr_next)
+   {
+      header->sip_hdr_id = 0;
+      header->sip_hdr_id_next = NULL;
+      for (p = header->sip_hdr_start; p < header->sip_hdr_end && isspace (*p); p++)
+         ;
+      for (name = p; p < header->sip_hdr_end && !isspace (*p) && *p != SIP_HCOLON; p++)
+         ;
+      id = sip_header_id (name, p - name);
+      while (p < header->sip_hdr_end && isspace (*p))
+         p++;
+      if (id == 0 || p == header->sip_hdr_end || *p != SIP_HCOLON)
+         continue;
+      header->sip_hdr_id = id;
+      if (last[id] != NULL)
+         last[id]->sip_hdr_id_next = header;
+      else
+         sip_msg->sip_msg_hdr_index[id] = header;
+      if (core && last[id] == NULL && SIP_CORE_HEADER (id))
+         core = sip_core_header (sip_msg, header, id);
+      last[id] = header;
+   }
+   sip_msg->sip_msg_hdr_indexed = B_TRUE;
+   if (core)
+      sip_msg->sip_msg_core_parsed = B_TRUE;
+}
+
+/*
+ * The first header of the given id in an indexed message, or the next one
+ * after old_header.
+ */
+static _sip_header_t *sip_search_index (_sip_msg_t * sip_msg, int id, sip_header_function_t * header_f_table,
+                                        _sip_header_t * old_header)
+{
+   _sip_header_t *header;
+
+   header = old_header != NULL ? old_header->sip_hdr_id_next : sip_msg->sip_msg_hdr_index[id];
+   while (header != NULL && header->sip_header_state == SIP_HEADER_DELETED)
+      header = header->sip_hdr_id_next;
+   if (header != NULL)
+   {
+      header->sip_hdr_current = header->sip_hdr_start;
+      header->sip_header_functions = header_f_table;
+   }
+   return (header);
+}
+
+/*
+ * Search for the header name passed in. A built-in header of an indexed
+ * message is found through the index, the others by walking the headers.
+ */
 _sip_header_t *sip_search_for_header (_sip_msg_t * sip_msg, char *header_name, _sip_header_t * old_header)
 {
    int len = 0;
@@ -733,6 +1129,7 @@ _sip_header_t *sip_search_for_header (_sip_msg_t * sip_msg, char *header_name, _
    char *compact_name = NULL;
    char *full_name = NULL;
    sip_header_function_t *header_f_table = NULL;
+   int id;
 
    if (sip_msg == NULL)
       return (NULL);
@@ -760,6 +1157,16 @@ _sip_header_t *sip_search_for_header (_sip_msg_t * sip_msg, char *header_name, _
       }
    }
 
+   id = 0;
+   if (header_f_table > sip_header_function_table && header_f_table < &sip_header_function_table[MAX_SIP_HEADERS])
+   {
+      id = header_f_table - sip_header_function_table;
+      if (!sip_msg->sip_msg_hdr_indexed)
+         sip_index_headers (sip_msg, B_FALSE);
+   }
+   if (id != 0 && (old_header == NULL || old_header->sip_hdr_id == id))
+      return (sip_search_index (sip_msg, id, header_f_table, old_header));
+
    if (old_header != NULL)
       header = old_header->sip_hdr_next;
    else
@@ -836,6 +1243,23 @@ _sip_header_t *sip_search_for_header (_sip_msg_t * sip_msg, char *header_name, _
    return (header);
 }
 
+/*
+ * Search for the header with the given id, as sip_search_for_header() does
+ * for its name but without resolving the name on an indexed message.
+ */
+_sip_header_t *sip_search_for_header_id (_sip_msg_t * sip_msg, int id, _sip_header_t * old_header)
+{
+   if (sip_msg == NULL || id <= SIP_HDR_UNKNOWN || id >= SIP_HDR_MAX)
+      return (NULL);
+   if (sip_hdr_id_funcs[id] == &sip_header_function_table[id] && (old_header == NULL || old_header->sip_hdr_id == id))
+   {
+      if (!sip_msg->sip_msg_hdr_indexed)
+         sip_index_headers (sip_msg, B_FALSE);
+      return (sip_search_index (sip_msg, id, sip_hdr_id_funcs[id], old_header));
+   }
+   return (sip_search_for_header (sip_msg, sip_header_function_table[id].header_name, old_header));
+}
+
 /* Return the start line as a string. Caller frees string */
 char *_sip_startline_to_str (_sip_msg_t * sip_msg, int *error)
 {
@@ -28,6 +28,7 @@
 #else
 #include <sys/varargs.h>
 #endif
+#include <stddef.h>
 #include "sip_miscdefs.h"
 #include "sip_xaction.h"
 #include "sip_hash.h"
@@ -35,9 +36,13 @@
 #include "sip_msg.h"
 
 #define	SIP_MSG_BUF_SZ	100
+#define	SIP_TCP_BATCH	16
+#define	SIP_PKT_BATCH	64
+#define	SIP_DISPATCH_MAX_THREADS	64
 
 
 void (*sip_ulp_recv) (const sip_conn_object_t, sip_msg_t, const sip_dialog_t) = NULL;
+void (*sip_ulp_recv_batch) (const sip_conn_object_t, sip_msg_t *, sip_dialog_t *, int) = NULL;
 uint_t (*sip_stack_timeout) (void *, void (*func) (void *), struct timeval *) = NULL;
 boolean_t (*sip_stack_untimeout) (uint_t) = NULL;
 void (*sip_ulp_dlg_del) (sip_dialog_t, sip_msg_t, void *) = NULL;
@@ -55,6 +60,7 @@ int (*sip_conn_timer4) (sip_conn_object_t) = NULL;
 int (*sip_conn_timerd) (sip_conn_object_t) = NULL;
 
 boolean_t sip_manage_dialog = B_FALSE;
+boolean_t sip_eager_parse = B_FALSE;
 
 uint64_t sip_hash_salt = 0;
 
@@ -64,8 +70,8 @@ int sip_timer_T2 = SIP_TIMER_T2;
 int sip_timer_T4 = SIP_TIMER_T4;
 int sip_timer_TD = 32 * SIP_SECONDS;
 
-/* Create and send an error response */
-void sip_send_resp_err (sip_conn_object_t conn_obj, _sip_msg_t * sip_msg, int resp)
+/* Create and send an error response, with Retry-After if not 0 */
+static void sip_send_resp_err_retry (sip_conn_object_t conn_obj, _sip_msg_t * sip_msg, int resp, int retry_after)
 {
    _sip_msg_t *sip_msg_resp;
 
@@ -78,6 +84,11 @@ void sip_send_resp_err (sip_conn_object_t conn_obj, _sip_msg_t * sip_msg, int re
        */
       return;
    }
+   if (retry_after > 0 && sip_add_retry_after ((sip_msg_t) sip_msg_resp, retry_after, NULL, NULL) != 0)
+   {
+      sip_free_msg ((sip_msg_t) sip_msg_resp);
+      return;
+   }
    /*
     * We directly send it to the transport here.
     */
@@ -87,13 +98,30 @@ void sip_send_resp_err (sip_conn_object_t conn_obj, _sip_msg_t * sip_msg, int re
       return;
    }
    (void) sip_stack_send (conn_obj, sip_msg_resp->sip_msg_buf, sip_msg_resp->sip_msg_len);
+   sip_free_msg ((sip_msg_t) sip_msg_resp);
+}
+
+/* Create and send an error response */
+void sip_send_resp_err (sip_conn_object_t conn_obj, _sip_msg_t * sip_msg, int resp)
+{
+   sip_send_resp_err_retry (conn_obj, sip_msg, resp, 0);
 }
 
 /* Validate some of the common headers */
 boolean_t sip_check_common_headers (sip_conn_object_t conn_obj, _sip_msg_t * sip_msg)
 {
+   const sip_msg_core_t *core = &sip_msg->sip_msg_core;
    int err;
 
+   if (sip_msg->sip_msg_core_parsed)
+   {
+      if (core->sip_core_to == NULL || core->sip_core_from == NULL || core->sip_core_cseq == NULL ||
+          core->sip_core_cseq->cseq_num < 0 || core->sip_core_callid == NULL)
+      {
+         goto error;
+      }
+      return (B_FALSE);
+   }
    if (sip_get_to_uri_str ((sip_msg_t) sip_msg, &err) == NULL)
       goto error;
    if (sip_get_from_uri_str ((sip_msg_t) sip_msg, &err) == NULL)
@@ -108,6 +136,68 @@ boolean_t sip_check_common_headers (sip_conn_object_t conn_obj, _sip_msg_t * sip
    return (B_TRUE);
 }
 
+/*
+ * Set up the headers from the line table the framer made, the same as
+ * sip_setup_header_pointers() would from the CRLFs. Returns the start of
+ * the content.
+ */
+static char *sip_setup_header_lines (_sip_msg_t * sip_msg, const sip_reass_lines_t * lines)
+{
+   _sip_header_t *sip_msg_header;
+   char *buf = sip_msg->sip_msg_buf;
+   int i;
+
+   for (i = 0; i < lines->sip_lines_n - 1; i++)
+   {
+      sip_msg_header = calloc (1, sizeof (_sip_header_t));
+      if (sip_msg_header == NULL)
+         return (NULL);
+      sip_msg_header->sip_hdr_start = buf + lines->sip_lines_off[i];
+      sip_msg_header->sip_hdr_current = sip_msg_header->sip_hdr_start;
+      sip_msg_header->sip_hdr_end = buf + lines->sip_lines_off[i + 1];
+      sip_msg_header->sip_hdr_allocated = B_FALSE;
+      sip_msg_header->sip_hdr_sipmsg = sip_msg;
+      sip_msg_header->sip_hdr_prev = sip_msg->sip_msg_headers_end;
+      if (sip_msg->sip_msg_headers_end != NULL)
+         sip_msg->sip_msg_headers_end->sip_hdr_next = sip_msg_header;
+      else
+         sip_msg->sip_msg_headers_start = sip_msg_header;
+      sip_msg->sip_msg_headers_end = sip_msg_header;
+   }
+   /* The last header ends with the empty line */
+   if (sip_msg->sip_msg_headers_end != NULL)
+      sip_msg->sip_msg_headers_end->sip_hdr_end += strlen (SIP_CRLF);
+   return (buf + lines->sip_lines_off[lines->sip_lines_n - 1] + strlen (SIP_CRLF));
+}
+
+/*
+ * Return where the header line at p ends: past its CRLF or, if the header
+ * is folded (a CRLF followed by white space continues it), past the CRLF
+ * of its last line. NULL if there is no CRLF before end. memchr() finds
+ * the LFs, the C library has it vectorized for the CPU it runs on.
+ * A fold is unfolded in place: the CRLF and the white space after it
+ * become SPs, so the value parsers see LWS (RFC 3261 7.3.1) and not the
+ * end of the value.
+ */
+static char *sip_header_line_end (char *p, char *end)
+{
+   char *lf = p;
+
+   while ((lf = memchr (lf, '\n', end - lf)) != NULL)
+   {
+      lf++;
+      if (lf - p < strlen (SIP_CRLF) || lf[-2] != SIP_CR)
+         continue;
+      if (lf == end || (*lf != SIP_SP && *lf != SIP_HTAB))
+         return (lf);
+      lf[-2] = SIP_SP;
+      lf[-1] = SIP_SP;
+      while (lf < end && (*lf == SIP_SP || *lf == SIP_HTAB))
+         *lf++ = SIP_SP;
+   }
+   return (NULL);
+}
+
 /*
  * setup pointers to where the headers are.
  */
@@ -116,89 +206,64 @@ int sip_setup_header_pointers (_sip_msg_t * sip_msg)
    char *msg;
    _sip_header_t *sip_msg_header;
    char *end;
+   char *eol;
+   const sip_reass_lines_t *lines;
 
+   lines = sip_msg->sip_msg_lines;
+   sip_msg->sip_msg_lines = NULL;
+   if (lines != NULL && lines->sip_lines_n > 0)
+   {
+      msg = sip_setup_header_lines (sip_msg, lines);
+      if (msg == NULL)
+         return (EINVAL);
+      goto headers_done;
+   }
    msg = sip_msg->sip_msg_buf;
    end = sip_msg->sip_msg_buf + sip_msg->sip_msg_len;
    /*
     * Skip while space.
     */
-   while (isspace (*msg))
-   {
-      if (msg < end)
-         msg++;
-      else
-         return (EINVAL);
-   }
+   while (msg < end && isspace (*msg))
+      msg++;
+   if (msg == end)
+      return (EINVAL);
 
    /*
-    * We consider Request and Response line as a header
+    * We consider Request and Response line as a header. Each one ends
+    * after its CRLF, an empty line ends them all and starts the content.
     */
    for (;;)
    {
-      /*
-       * Skip CRLF
-       */
-      if (strncmp (SIP_CRLF, msg, strlen (SIP_CRLF)) == 0)
-      {
-         if (sip_msg->sip_msg_headers_end != NULL)
-         {
-            SKIP_CRLF (msg);
-            sip_msg->sip_msg_headers_end->sip_hdr_end = msg;
-         }
-         /*
-          * Start of a header.
-          * Check for empty line.
-          */
-         if (strncmp (SIP_CRLF, msg, strlen (SIP_CRLF)) == 0)
-         {
-            /*
-             * empty line, start of content.
-             */
-            SKIP_CRLF (msg);
-            sip_msg->sip_msg_headers_end->sip_hdr_end = msg;
-            break;
-         }
-         /*
-          * store start of header.
-          */
-         sip_msg_header = calloc (1, sizeof (_sip_header_t));
-         if (sip_msg_header == NULL)
-            return (EINVAL);
-         sip_msg_header->sip_hdr_start = msg;
-         sip_msg_header->sip_hdr_current = msg;
-         sip_msg_header->sip_hdr_allocated = B_FALSE;
-         sip_msg_header->sip_hdr_prev = sip_msg->sip_msg_headers_end;
-         sip_msg_header->sip_hdr_next = NULL;
-         sip_msg_header->sip_hdr_sipmsg = sip_msg;
+      eol = sip_header_line_end (msg, end);
+      if (eol == NULL)
+         return (EINVAL);
+      sip_msg_header = calloc (1, sizeof (_sip_header_t));
+      if (sip_msg_header == NULL)
+         return (EINVAL);
+      sip_msg_header->sip_hdr_start = msg;
+      sip_msg_header->sip_hdr_current = msg;
+      sip_msg_header->sip_hdr_end = eol;
+      sip_msg_header->sip_hdr_allocated = B_FALSE;
+      sip_msg_header->sip_hdr_sipmsg = sip_msg;
+      sip_msg_header->sip_hdr_prev = sip_msg->sip_msg_headers_end;
+      if (sip_msg->sip_msg_headers_end != NULL)
          sip_msg->sip_msg_headers_end->sip_hdr_next = sip_msg_header;
-         sip_msg->sip_msg_headers_end = sip_msg_header;
-      }
       else
+         sip_msg->sip_msg_headers_start = sip_msg_header;
+      sip_msg->sip_msg_headers_end = sip_msg_header;
+      msg = eol;
+      if (end - msg >= strlen (SIP_CRLF) && strncmp (SIP_CRLF, msg, strlen (SIP_CRLF)) == 0)
       {
-         if (sip_msg->sip_msg_headers_start == NULL)
-         {
-            /*
-             * Allocate first header structure.
-             */
-            sip_msg_header = calloc (1, sizeof (_sip_header_t));
-            if (sip_msg_header == NULL)
-               return (EINVAL);
-            sip_msg_header->sip_hdr_allocated = B_FALSE;
-            sip_msg_header->sip_hdr_start = msg;
-            sip_msg_header->sip_hdr_current = msg;
-            sip_msg_header->sip_hdr_sipmsg = sip_msg;
-            sip_msg->sip_msg_headers_start = sip_msg_header;
-            sip_msg->sip_msg_headers_end = sip_msg_header;
-         }
-         msg++;
+         /*
+          * empty line, start of content.
+          */
+         SKIP_CRLF (msg);
+         sip_msg_header->sip_hdr_end = msg;
+         break;
       }
-      /*
-       * We have reached the end without hitting the empty line.
-       */
-      if (msg - sip_msg->sip_msg_buf >= sip_msg->sip_msg_len)
-         return (EINVAL);
    }
 
+ headers_done:
    if (sip_msg->sip_msg_headers_start == NULL)
       return (EPROTO);
 
@@ -213,6 +278,9 @@ int sip_setup_header_pointers (_sip_msg_t * sip_msg)
    if (sip_msg->sip_msg_headers_start == NULL)
       return (EINVAL);
    sip_msg->sip_msg_headers_start->sip_hdr_prev = NULL;
+   /* The index is otherwise built on the first lookup by id */
+   if (sip_eager_parse)
+      sip_index_headers (sip_msg, B_TRUE);
 
 
    /*
@@ -314,8 +382,17 @@ boolean_t sip_valid_sent_by (sip_msg_t sip_msg)
    sip_header_value_t value = NULL;
    int error;
    const sip_str_t *sent_by = NULL;
+   _sip_msg_t *_sip_msg = (_sip_msg_t *) sip_msg;
+   const sip_hdr_value_t *via_value;
 
-   via = (sip_header_t) sip_get_header (sip_msg, SIP_VIA, NULL, &error);
+   if (_sip_msg->sip_msg_core_parsed)
+   {
+      via_value = _sip_msg->sip_msg_core.sip_core_via;
+      if (via_value == NULL || via_value->sip_value_state == SIP_VALUE_BAD)
+         return (B_TRUE);
+      return (sip_sent_by_registered (&via_value->via_sent_by_host));
+   }
+   via = (sip_header_t) sip_get_header_by_id (sip_msg, SIP_HDR_VIA, NULL, &error);
    if (via == NULL || error != 0)
       return (B_TRUE);
    value = (sip_header_value_t) sip_get_header_value (via, &error);
@@ -331,73 +408,49 @@ boolean_t sip_valid_sent_by (sip_msg_t sip_msg)
 
 
 /*
- * The receive interface to the transport layer.
+ * Split a received message, its sip_msg_buf set up by the caller, into
+ * headers and parse the start line. The message is freed on error.
  */
-void sip_process_new_packet (sip_conn_object_t conn_object, void *msgstr, size_t msglen)
+static int sip_parse_msg (_sip_msg_t * sip_msg)
 {
-   _sip_msg_t *sip_msg;
-   sip_message_type_t *sip_msg_info;
-   sip_xaction_t *sip_trans;
-   sip_dialog_t dialog = NULL;
-   boolean_t dialog_created = B_FALSE;
-   int transport;
-   char *msgbuf = NULL;
-
-   sip_refhold_conn (conn_object);
-   transport = sip_conn_transport (conn_object);
-   if (transport == IPPROTO_TCP)
-   {
-    next_msg:
-      msgstr = (char *) sip_get_tcp_msg (conn_object, (char *) msgstr, &msglen);
-      if (msgstr == NULL)
-      {
-         sip_refrele_conn (conn_object);
-         return;
-      }
-   }
-   else
-   {
-      msgbuf = (char *) malloc (msglen + 1);
-      if (msgbuf == NULL)
-      {
-         sip_refrele_conn (conn_object);
-         return;
-      }
-      (void) strncpy (msgbuf, msgstr, msglen);
-      msgbuf[msglen] = '\0';
-      msgstr = msgbuf;
-   }
-   sip_msg = (_sip_msg_t *) sip_new_msg ();
-   if (sip_msg == NULL)
-   {
-      if (msgbuf != NULL)
-         free (msgbuf);
-      sip_refrele_conn (conn_object);
-      return;
-   }
-   sip_msg->sip_msg_buf = (char *) msgstr;
-   sip_msg->sip_msg_len = msglen;
    (void) pthread_mutex_lock (&sip_msg->sip_msg_mutex);
-   if (sip_setup_header_pointers (sip_msg) != 0)
+   if (sip_setup_header_pointers (sip_msg) != 0 ||
+       sip_parse_first_line (sip_msg->sip_msg_start_line, &sip_msg->sip_msg_req_res))
    {
       (void) pthread_mutex_unlock (&sip_msg->sip_msg_mutex);
-      sip_refrele_conn (conn_object);
       sip_free_msg ((sip_msg_t) sip_msg);
-      return;
-   }
-   if (sip_parse_first_line (sip_msg->sip_msg_start_line, &sip_msg->sip_msg_req_res))
-   {
-      (void) pthread_mutex_unlock (&sip_msg->sip_msg_mutex);
-      sip_refrele_conn (conn_object);
-      sip_free_msg ((sip_msg_t) sip_msg);
-      return;
+      return (EINVAL);
    }
-   sip_msg_info = sip_msg->sip_msg_req_res;
    (void) pthread_mutex_unlock (&sip_msg->sip_msg_mutex);
+   return (0);
+}
+
+/* Messages processed by sip_process_new_packets(), for sip_ulp_recv_batch() */
+typedef struct sip_recv_batch_s
+{
+   int sip_rb_n;
+   sip_msg_t sip_rb_msgs[SIP_PKT_BATCH];
+   sip_dialog_t sip_rb_dialogs[SIP_PKT_BATCH];
+   boolean_t sip_rb_held[SIP_PKT_BATCH];        /* dialog to release */
+} sip_recv_batch_t;
+
+/*
+ * Process one received message, parsed by sip_parse_msg(). The caller
+ * holds the connection. With a batch, the message is added to it instead
+ * of being passed to sip_ulp_recv().
+ */
+static void sip_process_msg (sip_conn_object_t conn_object, _sip_msg_t * sip_msg, sip_recv_batch_t * batch)
+{
+   sip_message_type_t *sip_msg_info;
+   sip_xaction_t *sip_trans;
+   sip_dialog_t dialog = NULL;
+   boolean_t dialog_created = B_FALSE;
+   int retry_after;
+   int ovl;
 
+   sip_msg_info = sip_msg->sip_msg_req_res;
    if (sip_check_common_headers (conn_object, sip_msg))
    {
-      sip_refrele_conn (conn_object);
       sip_free_msg ((sip_msg_t) sip_msg);
       return;
    }
@@ -409,7 +462,6 @@ void sip_process_new_packet (sip_conn_object_t conn_object, void *msgstr, size_t
     */
    if (!sip_msg_info->is_request && !sip_valid_sent_by (sip_msg))
    {
-      sip_refrele_conn (conn_object);
       sip_free_msg ((sip_msg_t) sip_msg);
       return;
 
@@ -423,7 +475,6 @@ void sip_process_new_packet (sip_conn_object_t conn_object, void *msgstr, size_t
       if (sip_xaction_input (conn_object, sip_trans, &sip_msg) != 0)
       {
          SIP_XACTION_REFCNT_DECR (sip_trans);
-         sip_refrele_conn (conn_object);
          sip_free_msg ((sip_msg_t) sip_msg);
          return;
       }
@@ -431,7 +482,19 @@ void sip_process_new_packet (sip_conn_object_t conn_object, void *msgstr, size_t
 
       /* msg was retransmission - handled by the transaction */
       if (sip_msg == NULL)
-         goto check_next;
+         return;
+   }
+   else if (sip_msg_info->is_request)
+   {
+      /* A new request, turn it away if overloaded */
+      ovl = sip_overload_check (sip_msg, &retry_after);
+      if (ovl == SIP_OVERLOAD_REJECT)
+         sip_send_resp_err_retry (conn_object, sip_msg, SIP_SERVICE_UNAVAILABLE, retry_after);
+      if (ovl != SIP_OVERLOAD_ACCEPT)
+      {
+         sip_free_msg ((sip_msg_t) sip_msg);
+         return;
+      }
    }
    if (sip_manage_dialog)
    {
@@ -460,25 +523,509 @@ void sip_process_new_packet (sip_conn_object_t conn_object, void *msgstr, size_t
       {
          if (dialog != NULL)
             sip_release_dialog (dialog);
-         sip_refrele_conn (conn_object);
          sip_free_msg ((sip_msg_t) sip_msg);
          return;
       }
    }
+   if (batch != NULL)
+   {
+      batch->sip_rb_msgs[batch->sip_rb_n] = (sip_msg_t) sip_msg;
+      batch->sip_rb_dialogs[batch->sip_rb_n] = dialog;
+      batch->sip_rb_held[batch->sip_rb_n] = dialog != NULL && !dialog_created;
+      batch->sip_rb_n++;
+      return;
+   }
    sip_ulp_recv (conn_object, (sip_msg_t) sip_msg, dialog);
    sip_free_msg ((sip_msg_t) sip_msg);
    if (dialog != NULL && !dialog_created)
       sip_release_dialog (dialog);
- check_next:
-   /*
-    * Check if there are more complete messages in the TCP fragment list
-    * to be consumed
-    */
-   if (transport == IPPROTO_TCP)
+}
+
+/* Pass the batch up to sip_ulp_recv_batch(), then free it */
+static void sip_recv_batch_flush (sip_conn_object_t conn_object, sip_recv_batch_t * batch)
+{
+   int i;
+
+   if (batch->sip_rb_n == 0)
+      return;
+   sip_ulp_recv_batch (conn_object, batch->sip_rb_msgs, batch->sip_rb_dialogs, batch->sip_rb_n);
+   for (i = 0; i < batch->sip_rb_n; i++)
+   {
+      sip_free_msg (batch->sip_rb_msgs[i]);
+      if (batch->sip_rb_held[i])
+         sip_release_dialog (batch->sip_rb_dialogs[i]);
+   }
+   batch->sip_rb_n = 0;
+}
+
+/*
+ * The optional receive dispatcher (sip_rx_threads). Each received message
+ * is queued to one of the dispatcher threads by a hash of its Call-ID,
+ * picked out before the message is parsed, so that all the messages of a
+ * dialog are processed by the same thread in the order they came in and
+ * a thread mostly touches its own dialogs and transactions.
+ */
+typedef struct sip_dispatch_item_s
+{
+   struct sip_dispatch_item_s *sip_item_next;
+   sip_conn_object_t sip_item_conn;     /* held for the item */
+   sip_reass_slice_t sip_item_slice;
+   void (*sip_item_release) (void *, void *);   /* of a borrowed buffer */
+   void *sip_item_arg;
+   uint64_t sip_item_queued;    /* sip_overload_now() */
+   char sip_item_data[1];       /* copy of a datagram */
+} sip_dispatch_item_t;
+
+typedef struct sip_dispatch_queue_s
+{
+   sip_dispatch_item_t *sip_dq_head;
+   sip_dispatch_item_t **sip_dq_tailp;
+   pthread_mutex_t sip_dq_mutex;
+   pthread_cond_t sip_dq_cv;
+} sip_dispatch_queue_t;
+
+static sip_dispatch_queue_t *sip_dispatch_queues = NULL;
+static int sip_dispatch_nqueues = 0;
+
+/*
+ * FNV-1a hash of the Call-ID of the message in [buf, buf + len), long or
+ * compact form. Messages without one, which the parser rejects, hash to 0.
+ */
+static uint64_t sip_dispatch_hash (const char *buf, size_t len)
+{
+   const char *end = buf + len;
+   const char *line;
+   const char *nl;
+   const char *p;
+   const char *e;
+   uint64_t h = 0xcbf29ce484222325ULL;
+
+   /* The start line is skipped */
+   if ((nl = memchr (buf, '\n', len)) == NULL)
+      return (0);
+   for (line = nl + 1; (nl = memchr (line, '\n', end - line)) != NULL; line = nl + 1)
+   {
+      e = nl;
+      if (e > line && e[-1] == '\r')
+         e--;
+      if (e == line)
+         break;
+      if ((p = sip_reass_hdr_value (line, e, "call-id", 'i')) == NULL)
+         continue;
+      while (e > p && (e[-1] == ' ' || e[-1] == '\t'))
+         e--;
+      for (; p < e; p++)
+      {
+         h ^= (uchar_t) * p;
+         h *= 0x100000001b3ULL;
+      }
+      return (h);
+   }
+   return (0);
+}
+
+/* Release function of the datagrams copied into an item */
+static void sip_dispatch_item_free (void *buf, void *arg)
+{
+   free (arg);
+}
+
+/*
+ * Give back the message of an item that could not be processed. An owned
+ * item is freed by its release function, so it is not looked at after.
+ */
+static void sip_dispatch_drop (sip_dispatch_item_t * item)
+{
+   sip_reass_slice_t *slice = &item->sip_item_slice;
+   void (*release) (void *, void *) = item->sip_item_release;
+   void *buf = slice->sip_slice_buf;
+   void *arg = item->sip_item_arg;
+
+   if (slice->sip_slice_chunk != NULL)
+      sip_reass_chunk_rele (slice->sip_slice_chunk);
+   else if (release == NULL)
+      free (buf);
+   if (release != sip_dispatch_item_free)
+      free (item);
+   if (release != NULL)
+      release (buf, arg);
+}
+
+/* Process a message taken off a dispatcher queue */
+static void sip_dispatch_run (sip_dispatch_item_t * item)
+{
+   sip_conn_object_t conn_object = item->sip_item_conn;
+   sip_reass_slice_t *slice = &item->sip_item_slice;
+   boolean_t owned = item->sip_item_release == sip_dispatch_item_free;
+   _sip_msg_t *sip_msg;
+
+   sip_overload_dequeue (item->sip_item_queued);
+   sip_msg = (_sip_msg_t *) sip_new_msg ();
+   if (sip_msg == NULL)
+   {
+      sip_dispatch_drop (item);
+      sip_refrele_conn (conn_object);
+      return;
+   }
+   sip_msg->sip_msg_buf = slice->sip_slice_buf;
+   sip_msg->sip_msg_len = slice->sip_slice_len;
+   sip_msg->sip_msg_chunk = slice->sip_slice_chunk;
+   sip_msg->sip_msg_lines = &slice->sip_slice_lines;
+   if (item->sip_item_release != NULL)
+   {
+      sip_msg->sip_msg_borrowed = slice->sip_slice_buf;
+      sip_msg->sip_msg_release = item->sip_item_release;
+      sip_msg->sip_msg_release_arg = item->sip_item_arg;
+   }
+   /* An owned item goes with the message, the others are done with here */
+   if (sip_parse_msg (sip_msg) == 0)
+   {
+      if (!owned)
+         free (item);
+      sip_process_msg (conn_object, sip_msg, NULL);
+   }
+   else if (!owned)
+   {
+      free (item);
+   }
+   sip_refrele_conn (conn_object);
+}
+
+static void *sip_dispatch_thr (void *arg)
+{
+   sip_dispatch_queue_t *dq = (sip_dispatch_queue_t *) arg;
+   sip_dispatch_item_t *item;
+   sip_dispatch_item_t *next;
+
+   for (;;)
+   {
+      (void) pthread_mutex_lock (&dq->sip_dq_mutex);
+      while (dq->sip_dq_head == NULL)
+         (void) pthread_cond_wait (&dq->sip_dq_cv, &dq->sip_dq_mutex);
+      item = dq->sip_dq_head;
+      dq->sip_dq_head = NULL;
+      dq->sip_dq_tailp = &dq->sip_dq_head;
+      (void) pthread_mutex_unlock (&dq->sip_dq_mutex);
+      for (; item != NULL; item = next)
+      {
+         next = item->sip_item_next;
+         sip_dispatch_run (item);
+      }
+   }
+   return (NULL);
+}
+
+/* Queue an item to the thread its Call-ID hashes to */
+static void sip_dispatch (sip_conn_object_t conn_object, sip_dispatch_item_t * item)
+{
+   sip_reass_slice_t *slice = &item->sip_item_slice;
+   sip_dispatch_queue_t *dq;
+
+   sip_refhold_conn (conn_object);
+   item->sip_item_conn = conn_object;
+   item->sip_item_next = NULL;
+   item->sip_item_queued = sip_overload_now ();
+   sip_overload_enqueue ();
+   dq = &sip_dispatch_queues[sip_dispatch_hash (slice->sip_slice_buf, slice->sip_slice_len) % sip_dispatch_nqueues];
+   (void) pthread_mutex_lock (&dq->sip_dq_mutex);
+   *dq->sip_dq_tailp = item;
+   dq->sip_dq_tailp = &item->sip_item_next;
+   if (dq->sip_dq_head == item)
+      (void) pthread_cond_signal (&dq->sip_dq_cv);
+   (void) pthread_mutex_unlock (&dq->sip_dq_mutex);
+}
+
+/* Dispatch a complete TCP message */
+static void sip_dispatch_slice (sip_conn_object_t conn_object, sip_reass_slice_t * slice)
+{
+   sip_dispatch_item_t *item;
+
+   item = malloc (sizeof (sip_dispatch_item_t));
+   if (item == NULL)
    {
+      if (slice->sip_slice_chunk != NULL)
+         sip_reass_chunk_rele (slice->sip_slice_chunk);
+      else
+         free (slice->sip_slice_buf);
+      return;
+   }
+   item->sip_item_slice = *slice;
+   item->sip_item_release = NULL;
+   item->sip_item_arg = NULL;
+   sip_dispatch (conn_object, item);
+}
+
+/* Dispatch a datagram, copied unless it comes with a release function */
+static void sip_dispatch_pkt (sip_conn_object_t conn_object, sip_packet_t * pkt)
+{
+   sip_dispatch_item_t *item;
+
+   /* Retransmissions are taken care of without a trip through a queue */
+   if (sip_xaction_absorb (conn_object, pkt->sip_pkt_buf, pkt->sip_pkt_len))
+   {
+      if (pkt->sip_pkt_release != NULL)
+         pkt->sip_pkt_release (pkt->sip_pkt_buf, pkt->sip_pkt_arg);
+      return;
+   }
+   if (pkt->sip_pkt_release != NULL)
+      item = malloc (sizeof (sip_dispatch_item_t));
+   else
+      item = malloc (offsetof (sip_dispatch_item_t, sip_item_data) + pkt->sip_pkt_len + 1);
+   if (item == NULL)
+   {
+      if (pkt->sip_pkt_release != NULL)
+         pkt->sip_pkt_release (pkt->sip_pkt_buf, pkt->sip_pkt_arg);
+      return;
+   }
+   if (pkt->sip_pkt_release != NULL)
+   {
+      item->sip_item_slice.sip_slice_buf = pkt->sip_pkt_buf;
+      item->sip_item_release = pkt->sip_pkt_release;
+      item->sip_item_arg = pkt->sip_pkt_arg;
+   }
+   else
+   {
+      (void) memcpy (item->sip_item_data, pkt->sip_pkt_buf, pkt->sip_pkt_len);
+      item->sip_item_data[pkt->sip_pkt_len] = '\0';
+      item->sip_item_slice.sip_slice_buf = item->sip_item_data;
+      item->sip_item_release = sip_dispatch_item_free;
+      item->sip_item_arg = item;
+   }
+   item->sip_item_slice.sip_slice_len = pkt->sip_pkt_len;
+   item->sip_item_slice.sip_slice_chunk = NULL;
+   item->sip_item_slice.sip_slice_lines.sip_lines_n = 0;
+   sip_dispatch (conn_object, item);
+}
+
+/* Start nthreads dispatcher threads */
+static int sip_dispatch_init (int nthreads)
+{
+   pthread_t thr;
+   int i;
+
+   sip_dispatch_queues = calloc (nthreads, sizeof (sip_dispatch_queue_t));
+   if (sip_dispatch_queues == NULL)
+      return (ENOMEM);
+   for (i = 0; i < nthreads; i++)
+   {
+      sip_dispatch_queues[i].sip_dq_tailp = &sip_dispatch_queues[i].sip_dq_head;
+      (void) pthread_mutex_init (&sip_dispatch_queues[i].sip_dq_mutex, NULL);
+      (void) pthread_cond_init (&sip_dispatch_queues[i].sip_dq_cv, NULL);
+      if (pthread_create (&thr, NULL, sip_dispatch_thr, &sip_dispatch_queues[i]) != 0)
+         break;
+      (void) pthread_detach (thr);
+   }
+   if (i == 0)
+   {
+      (void) pthread_mutex_destroy (&sip_dispatch_queues[0].sip_dq_mutex);
+      (void) pthread_cond_destroy (&sip_dispatch_queues[0].sip_dq_cv);
+      free (sip_dispatch_queues);
+      sip_dispatch_queues = NULL;
+      return (EAGAIN);
+   }
+   sip_dispatch_nqueues = i;
+   return (0);
+}
+
+/*
+ * Take all the complete messages of a TCP read from the reassembly chunk,
+ * in batches of SIP_TCP_BATCH, and process them. The caller holds the
+ * connection.
+ */
+static void sip_process_tcp (sip_conn_object_t conn_object, char *msgstr, size_t msglen)
+{
+   sip_reass_slice_t slices[SIP_TCP_BATCH];
+   _sip_msg_t *sip_msg;
+   int n;
+   int i;
+
+   do
+   {
+      n = sip_get_tcp_msgs (conn_object, msgstr, msglen, slices, SIP_TCP_BATCH);
+      for (i = 0; i < n; i++)
+      {
+         if (sip_dispatch_nqueues > 0)
+         {
+            sip_dispatch_slice (conn_object, &slices[i]);
+            continue;
+         }
+         sip_msg = (_sip_msg_t *) sip_new_msg ();
+         if (sip_msg == NULL)
+         {
+            if (slices[i].sip_slice_chunk != NULL)
+               sip_reass_chunk_rele (slices[i].sip_slice_chunk);
+            else
+               free (slices[i].sip_slice_buf);
+            continue;
+         }
+         sip_msg->sip_msg_buf = slices[i].sip_slice_buf;
+         sip_msg->sip_msg_len = slices[i].sip_slice_len;
+         sip_msg->sip_msg_chunk = slices[i].sip_slice_chunk;
+         sip_msg->sip_msg_lines = &slices[i].sip_slice_lines;
+         if (sip_parse_msg (sip_msg) == 0)
+            sip_process_msg (conn_object, sip_msg, NULL);
+      }
       msgstr = NULL;
       msglen = 0;
-      goto next_msg;
+   }
+   while (n == SIP_TCP_BATCH);
+}
+
+/*
+ * Make a message of a datagram. With a NULL release it is copied,
+ * otherwise the message points into msgstr and gives it back with
+ * release(msgstr, arg) once done, which happens here on failure.
+ */
+static _sip_msg_t *sip_udp_msg (void *msgstr, size_t msglen, void (*release) (void *, void *), void *arg)
+{
+   _sip_msg_t *sip_msg;
+   char *msgbuf;
+
+   sip_msg = (_sip_msg_t *) sip_new_msg ();
+   if (sip_msg == NULL)
+   {
+      if (release != NULL)
+         release (msgstr, arg);
+      return (NULL);
+   }
+   if (release != NULL)
+   {
+      sip_msg->sip_msg_buf = msgstr;
+      sip_msg->sip_msg_borrowed = msgstr;
+      sip_msg->sip_msg_release = release;
+      sip_msg->sip_msg_release_arg = arg;
+   }
+   else
+   {
+      msgbuf = (char *) malloc (msglen + 1);
+      if (msgbuf == NULL)
+      {
+         sip_free_msg ((sip_msg_t) sip_msg);
+         return (NULL);
+      }
+      (void) strncpy (msgbuf, msgstr, msglen);
+      msgbuf[msglen] = '\0';
+      sip_msg->sip_msg_buf = msgbuf;
+   }
+   sip_msg->sip_msg_len = msglen;
+   return (sip_msg);
+}
+
+/*
+ * The receive interface to the transport layer.
+ */
+void sip_process_new_packet (sip_conn_object_t conn_object, void *msgstr, size_t msglen)
+{
+   _sip_msg_t *sip_msg;
+   sip_packet_t pkt;
+
+   sip_refhold_conn (conn_object);
+   if (sip_conn_transport (conn_object) == IPPROTO_TCP)
+   {
+      sip_process_tcp (conn_object, (char *) msgstr, msglen);
+   }
+   else if (sip_dispatch_nqueues > 0)
+   {
+      pkt.sip_pkt_buf = msgstr;
+      pkt.sip_pkt_len = msglen;
+      pkt.sip_pkt_release = NULL;
+      pkt.sip_pkt_arg = NULL;
+      sip_dispatch_pkt (conn_object, &pkt);
+   }
+   else if (!sip_xaction_absorb (conn_object, msgstr, msglen))
+   {
+      sip_msg = sip_udp_msg (msgstr, msglen, NULL, NULL);
+      if (sip_msg != NULL && sip_parse_msg (sip_msg) == 0)
+         sip_process_msg (conn_object, sip_msg, NULL);
+   }
+   sip_refrele_conn (conn_object);
+}
+
+/*
+ * Same as sip_process_new_packet() for a datagram in a buffer the caller
+ * keeps: the message points into msgstr instead of a copy of it, and
+ * release(msgstr, arg) is called once the stack no longer uses it, which
+ * may be before this returns. msgstr need not be NUL terminated, folded
+ * header lines in it are unfolded in place. Stream connections still
+ * reassemble into their own buffer.
+ */
+void sip_process_packet_buf (sip_conn_object_t conn_object, void *msgstr, size_t msglen,
+                             void (*release) (void *, void *), void *arg)
+{
+   sip_packet_t pkt;
+
+   pkt.sip_pkt_buf = msgstr;
+   pkt.sip_pkt_len = msglen;
+   pkt.sip_pkt_release = release;
+   pkt.sip_pkt_arg = arg;
+   sip_process_new_packets (conn_object, &pkt, 1);
+}
+
+/*
+ * Process npkts packets received on conn_object, in order, as if each was
+ * passed to sip_process_packet_buf() or, with a NULL release, to
+ * sip_process_new_packet(). The connection is held once for all of them.
+ * Datagrams are taken SIP_PKT_BATCH at a time: all are parsed and have
+ * their transaction and dialog slots prefetched before the first one is
+ * looked up, and with sip_ulp_recv_batch() they are passed up together
+ * once all went through the transaction and dialog layers. Request
+ * retransmissions are absorbed before being parsed (sip_xaction_absorb()).
+ */
+void sip_process_new_packets (sip_conn_object_t conn_object, sip_packet_t * pkts, int npkts)
+{
+   _sip_msg_t *msgs[SIP_PKT_BATCH];
+   sip_recv_batch_t batch;
+   _sip_msg_t *sip_msg;
+   sip_packet_t *pkt;
+   int n;
+   int i;
+   int j;
+
+   sip_refhold_conn (conn_object);
+   if (sip_conn_transport (conn_object) == IPPROTO_TCP)
+   {
+      for (i = 0; i < npkts; i++)
+      {
+         pkt = &pkts[i];
+         sip_process_tcp (conn_object, pkt->sip_pkt_buf, pkt->sip_pkt_len);
+         if (pkt->sip_pkt_release != NULL)
+            pkt->sip_pkt_release (pkt->sip_pkt_buf, pkt->sip_pkt_arg);
+      }
+      sip_refrele_conn (conn_object);
+      return;
+   }
+   if (sip_dispatch_nqueues > 0)
+   {
+      for (i = 0; i < npkts; i++)
+         sip_dispatch_pkt (conn_object, &pkts[i]);
+      sip_refrele_conn (conn_object);
+      return;
+   }
+   batch.sip_rb_n = 0;
+   for (i = 0; i < npkts; i += SIP_PKT_BATCH)
+   {
+      n = 0;
+      for (j = i; j < npkts && j < i + SIP_PKT_BATCH; j++)
+      {
+         pkt = &pkts[j];
+         if (sip_xaction_absorb (conn_object, pkt->sip_pkt_buf, pkt->sip_pkt_len))
+         {
+            if (pkt->sip_pkt_release != NULL)
+               pkt->sip_pkt_release (pkt->sip_pkt_buf, pkt->sip_pkt_arg);
+            continue;
+         }
+         sip_msg = sip_udp_msg (pkt->sip_pkt_buf, pkt->sip_pkt_len, pkt->sip_pkt_release, pkt->sip_pkt_arg);
+         if (sip_msg == NULL || sip_parse_msg (sip_msg) != 0)
+            continue;
+         sip_xaction_prefetch (sip_msg);
+         if (sip_manage_dialog)
+            sip_dialog_prefetch (sip_msg);
+         msgs[n++] = sip_msg;
+      }
+      for (j = 0; j < n; j++)
+         sip_process_msg (conn_object, msgs[j], sip_ulp_recv_batch != NULL ? &batch : NULL);
+      if (sip_ulp_recv_batch != NULL)
+         sip_recv_batch_flush (conn_object, &batch);
    }
    sip_refrele_conn (conn_object);
 }
@@ -489,21 +1036,38 @@ void sip_process_new_packet (sip_conn_object_t conn_object, void *msgstr, size_t
  */
 int sip_stack_init (sip_stack_init_t * stack_val)
 {
+   int hash_size = 0;
+   int timer_threads = 0;
+   int rx_threads = 0;
+   uint64_t (*timer_clock) (void) = NULL;
 #ifdef	__linux__
    struct timespec tspec;
 #endif
 
    /* If the stack has already been configured, return error */
-   if (sip_stack_send != NULL || stack_val->sip_version != SIP_STACK_VERSION)
+   if (sip_stack_send != NULL || stack_val->sip_version < SIP_STACK_VERSION_1 ||
+       stack_val->sip_version > SIP_STACK_VERSION)
    {
       return (EINVAL);
    }
+   if (stack_val->sip_version >= SIP_STACK_VERSION_2)
+   {
+      if (stack_val->sip_hash_size < 0 || stack_val->sip_timer_threads < 0 || stack_val->sip_rx_threads < 0 ||
+          stack_val->sip_rx_threads > SIP_DISPATCH_MAX_THREADS)
+         return (EINVAL);
+      hash_size = stack_val->sip_hash_size;
+      rx_threads = stack_val->sip_rx_threads;
+      timer_threads = stack_val->sip_timer_threads;
+      timer_clock = stack_val->sip_timer_clock;
+      sip_ulp_recv_batch = stack_val->sip_ulp_recv_batch;
+   }
    if (stack_val->sip_io_pointers == NULL || stack_val->sip_ulp_pointers == NULL)
    {
       return (EINVAL);
    }
    sip_ulp_recv = stack_val->sip_ulp_pointers->sip_ulp_recv;
    sip_manage_dialog = stack_val->sip_stack_flags & SIP_STACK_DIALOGS;
+   sip_eager_parse = (stack_val->sip_stack_flags & SIP_STACK_EAGER_PARSE) != 0;
 
    sip_stack_send = stack_val->sip_io_pointers->sip_conn_send;
    sip_refhold_conn = stack_val->sip_io_pointers->sip_hold_conn_object;
@@ -522,6 +1086,7 @@ int sip_stack_init (sip_stack_init_t * stack_val)
    {
     err_ret:
       sip_ulp_recv = NULL;
+      sip_ulp_recv_batch = NULL;
       sip_stack_send = NULL;
       sip_refhold_conn = NULL;
       sip_refrele_conn = NULL;
@@ -531,6 +1096,7 @@ int sip_stack_init (sip_stack_init_t * stack_val)
       sip_conn_local_addr = NULL;
       sip_conn_transport = NULL;
       sip_header_function_table_external = NULL;
+      sip_ulp_dlg_del = NULL;
       sip_stack_timeout = NULL;
       sip_stack_untimeout = NULL;
       return (EINVAL);
@@ -553,7 +1119,8 @@ int sip_stack_init (sip_stack_init_t * stack_val)
    {
       if (stack_val->sip_ulp_pointers->sip_ulp_untimeout != NULL)
          goto err_ret;
-      sip_timeout_init ();
+      if (sip_timeout_init (timer_threads, (stack_val->sip_stack_flags & SIP_STACK_EXTERNAL_TIMER) != 0, timer_clock) != 0)
+         goto err_ret;
       sip_stack_timeout = sip_timeout;
       sip_stack_untimeout = sip_untimeout;
    }
@@ -565,18 +1132,39 @@ int sip_stack_init (sip_stack_init_t * stack_val)
       {
          sip_ulp_dlg_del = stack_val->sip_ulp_pointers->sip_ulp_dlg_del;
       }
-      sip_dialog_init (stack_val->sip_ulp_pointers->sip_ulp_dlg_state_cb);
+      if (sip_dialog_init (stack_val->sip_ulp_pointers->sip_ulp_dlg_state_cb, hash_size) != 0)
+         goto err_timeout;
+   }
+   if (sip_xaction_init (stack_val->sip_ulp_pointers->sip_ulp_trans_error,
+                         stack_val->sip_ulp_pointers->sip_ulp_trans_state_cb, hash_size) != 0)
+   {
+      goto err_dialog;
    }
-   sip_xaction_init (stack_val->sip_ulp_pointers->sip_ulp_trans_error,
-                     stack_val->sip_ulp_pointers->sip_ulp_trans_state_cb);
+   /* Replaced, not added to, if init is called again */
+   if (sip_header_names_init () != 0)
+      goto err_xaction;
 
 #ifdef	__linux__
    if (clock_gettime (CLOCK_REALTIME, &tspec) != 0)
-      goto err_ret;
+      goto err_xaction;
    sip_hash_salt = tspec.tv_nsec;
 #else
    sip_hash_salt = gethrtime ();
 #endif
    (void) pthread_mutex_init (&sip_sent_by_lock, NULL);
+   /* Last, it leaves no thread behind when it fails */
+   if (rx_threads > 0 && sip_dispatch_init (rx_threads) != 0)
+      goto err_xaction;
    return (0);
+
+   /* Undo what was set up, in reverse order */
+ err_xaction:
+   sip_xaction_fini ();
+ err_dialog:
+   if (sip_manage_dialog)
+      sip_dialog_fini ();
+ err_timeout:
+   if (sip_stack_timeout == sip_timeout)
+      sip_timeout_fini ();
+   goto err_ret;
 }
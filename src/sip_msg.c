@@ -62,6 +62,9 @@ int sip_copy_values (char *ptr, _sip_header_t * header)
    char *p = ptr;
    char *e;
 
+   /* Only parsed values are walked, so get the rest parsed too */
+   while (header->sip_hdr_unparsed != NULL)
+      (void) sip_parse_next_value (header);
    if (sip_parse_goto_values (header) != 0)
       return (0);
 
@@ -150,7 +153,7 @@ int sip_adjust_msgbuf (_sip_msg_t * msg)
     * We add the content-length header here, if it has not
     * already been added.
     */
-   header = sip_search_for_header (msg, SIP_CONTENT_LENGTH, NULL);
+   header = sip_search_for_header_id (msg, SIP_HDR_CONTENT_LENGTH, NULL);
    if (header != NULL)
    {
       /*
@@ -214,22 +217,28 @@ void sip_destroy_msg (_sip_msg_t * _sip_msg)
    assert (_sip_msg->sip_msg_ref_cnt == 0);
    sip_delete_all_headers ((sip_msg_t) _sip_msg);
    sip_free_content (_sip_msg);
-   if (_sip_msg->sip_msg_buf != NULL)
-      free (_sip_msg->sip_msg_buf);
+   if (_sip_msg->sip_msg_buf != NULL && _sip_msg->sip_msg_buf != _sip_msg->sip_msg_borrowed)
+      sip_reass_free_buf (_sip_msg->sip_msg_chunk, _sip_msg->sip_msg_buf);
+
+   if (_sip_msg->sip_msg_old_buf != NULL && _sip_msg->sip_msg_old_buf != _sip_msg->sip_msg_borrowed)
+      sip_reass_free_buf (_sip_msg->sip_msg_chunk, _sip_msg->sip_msg_old_buf);
+
+   if (_sip_msg->sip_msg_release != NULL)
+      _sip_msg->sip_msg_release (_sip_msg->sip_msg_borrowed, _sip_msg->sip_msg_release_arg);
 
-   if (_sip_msg->sip_msg_old_buf != NULL)
-      free (_sip_msg->sip_msg_old_buf);
+   if (_sip_msg->sip_msg_chunk != NULL)
+      sip_reass_chunk_rele (_sip_msg->sip_msg_chunk);
 
    while (_sip_msg->sip_msg_req_res != NULL)
    {
       sip_message_type_t *sip_msg_type_ptr;
 
       sip_msg_type_ptr = _sip_msg->sip_msg_req_res->sip_next;
-      if (sip_msg_type_ptr->is_request)
+      if (_sip_msg->sip_msg_req_res->is_request)
       {
          sip_request_t *reqline;
 
-         reqline = &sip_msg_type_ptr->U.sip_request;
+         reqline = &_sip_msg->sip_msg_req_res->U.sip_request;
          if (reqline->sip_parse_uri != NULL)
          {
             sip_free_parsed_uri (reqline->sip_parse_uri);
@@ -277,6 +286,8 @@ boolean_t sip_ok_to_modify_message (_sip_msg_t * _sip_msg)
       return (B_FALSE);
    if (_sip_msg->sip_msg_buf != NULL)
       _sip_msg->sip_msg_modified = B_TRUE;
+   /* The caller is about to change it, the parsed core may not hold */
+   _sip_msg->sip_msg_core_parsed = B_FALSE;
    return (B_TRUE);
 }
 
@@ -416,7 +427,7 @@ sip_msg_t sip_create_response (sip_msg_t sip_request, int response, char *respon
    /*
     * Copy RECORD-ROUTE header, if present.
     */
-   if (sip_search_for_header (_sip_request, SIP_RECORD_ROUTE, NULL) != NULL)
+   if (sip_search_for_header_id (_sip_request, SIP_HDR_RECORD_ROUTE, NULL) != NULL)
    {
       if (_sip_find_and_copy_all_header (_sip_request, new_msg, SIP_RECORD_ROUTE) != 0)
       {
@@ -2101,7 +2112,7 @@ sip_create_OKack (sip_msg_t response, sip_msg_t ack_msg, char *transport,
 
    /* Get URI from the response, Contact field */
    (void) pthread_mutex_lock (&_response->sip_msg_mutex);
-   if ((header = sip_search_for_header (_response, SIP_CONTACT, NULL)) == NULL)
+   if ((header = sip_search_for_header_id (_response, SIP_HDR_CONTACT, NULL)) == NULL)
    {
       (void) pthread_mutex_unlock (&_response->sip_msg_mutex);
       return (EINVAL);
@@ -2153,7 +2164,7 @@ sip_create_OKack (sip_msg_t response, sip_msg_t ack_msg, char *transport,
       return (ret);
    }
    /* Copy Max-Forward if present */
-   if (sip_search_for_header (_response, SIP_MAX_FORWARDS, NULL) != NULL)
+   if (sip_search_for_header_id (_response, SIP_HDR_MAX_FORWARDS, NULL) != NULL)
    {
       if ((ret = _sip_find_and_copy_header (_response, _ack_msg, SIP_MAX_FORWARDS, NULL)) != 0)
       {
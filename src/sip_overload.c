@@ -0,0 +1,144 @@
+/*
+ * CDDL HEADER START
+ *
+ * The contents of this file are subject to the terms of the
+ * Common Development and Distribution License (the "License").
+ * You may not use this file except in compliance with the License.
+ *
+ * You can obtain a copy of the license at usr/src/OPENSOLARIS.LICENSE
+ * or http://www.opensolaris.org/os/licensing.
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ * When distributing Covered Code, include this CDDL HEADER in each
+ * file and include the License file at usr/src/OPENSOLARIS.LICENSE.
+ * If applicable, add the following below this CDDL HEADER, with the
+ * fields enclosed by brackets "[]" replaced with your own identifying
+ * information: Portions Copyright [yyyy] [name of copyright owner]
+ *
+ * CDDL HEADER END
+ */
+
+/*
+ * Copyright 2006 Sun Microsystems, Inc.  All rights reserved.
+ * Use is subject to license terms.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "sip_miscdefs.h"
+#include "sip_msg.h"
+
+/*
+ * Overload control. The stack counts itself overloaded while any of the
+ * configured limits is passed: the messages waiting in the receive
+ * dispatcher queues, the time they wait there (a moving average), or
+ * the load the ULP last reported with sip_overload_load(). While it is,
+ * new INVITE and REGISTER requests are answered with a 503 that carries
+ * Retry-After, other requests outside of a dialog are dropped, and
+ * requests inside a dialog, ACK, CANCEL, BYE and responses go through.
+ */
+static sip_overload_t sip_ovl_conf;
+static int sip_ovl_queued;      /* messages in the dispatcher queues */
+static int sip_ovl_latency;     /* average wait in the queues, msecs x 8 */
+static int sip_ovl_load;        /* from the ULP */
+
+/*
+ * Set the limits, a zero limit is not checked. A zero Retry-After is
+ * SIP_OVERLOAD_RETRY_AFTER, a 503 without one would be retried at once.
+ */
+int sip_overload_init (const sip_overload_t * conf)
+{
+   if (conf->sip_ovl_max_queue < 0 || conf->sip_ovl_max_latency < 0 || conf->sip_ovl_max_load < 0 ||
+       conf->sip_ovl_retry_after < 0)
+   {
+      return (EINVAL);
+   }
+   sip_ovl_conf = *conf;
+   if (sip_ovl_conf.sip_ovl_retry_after == 0)
+      sip_ovl_conf.sip_ovl_retry_after = SIP_OVERLOAD_RETRY_AFTER;
+   return (0);
+}
+
+/* The ULP reports its load, in its own unit (CPU percent, queue length) */
+void sip_overload_load (int load)
+{
+   __atomic_store_n (&sip_ovl_load, load, __ATOMIC_RELAXED);
+}
+
+/* Milliseconds on a cheap monotonic clock, to time the dispatcher queues */
+uint64_t sip_overload_now ()
+{
+   struct timespec ts;
+
+   if (sip_ovl_conf.sip_ovl_max_latency == 0)
+      return (0);
+#ifdef	CLOCK_MONOTONIC_COARSE
+   (void) clock_gettime (CLOCK_MONOTONIC_COARSE, &ts);
+#else
+   (void) clock_gettime (CLOCK_MONOTONIC, &ts);
+#endif
+   return ((uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+/* A message was queued to the dispatcher */
+void sip_overload_enqueue ()
+{
+   (void) __atomic_add_fetch (&sip_ovl_queued, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * A message queued at 'queued' (sip_overload_now()) was taken off. The
+ * average is kept times 8 so that the 1/8 step does not truncate to 0
+ * when the wait is within 8 msecs of it.
+ */
+void sip_overload_dequeue (uint64_t queued)
+{
+   int latency;
+   int wait;
+
+   (void) __atomic_sub_fetch (&sip_ovl_queued, 1, __ATOMIC_RELAXED);
+   if (sip_ovl_conf.sip_ovl_max_latency == 0 || queued == 0)
+      return;
+   wait = sip_overload_now () - queued;
+   latency = __atomic_load_n (&sip_ovl_latency, __ATOMIC_RELAXED);
+   __atomic_store_n (&sip_ovl_latency, latency + wait - (latency >> 3), __ATOMIC_RELAXED);
+}
+
+static boolean_t sip_overloaded ()
+{
+   sip_overload_t *conf = &sip_ovl_conf;
+
+   return ((conf->sip_ovl_max_queue > 0 &&
+            __atomic_load_n (&sip_ovl_queued, __ATOMIC_RELAXED) > conf->sip_ovl_max_queue) ||
+           (conf->sip_ovl_max_latency > 0 &&
+            (__atomic_load_n (&sip_ovl_latency, __ATOMIC_RELAXED) >> 3) > conf->sip_ovl_max_latency) ||
+           (conf->sip_ovl_max_load > 0 &&
+            __atomic_load_n (&sip_ovl_load, __ATOMIC_RELAXED) > conf->sip_ovl_max_load));
+}
+
+/*
+ * What to do with a received request that no transaction took:
+ * SIP_OVERLOAD_ACCEPT it, SIP_OVERLOAD_REJECT it with a 503 or
+ * SIP_OVERLOAD_DROP it. Returns the Retry-After to use in *retry_after.
+ */
+int sip_overload_check (_sip_msg_t * sip_msg, int *retry_after)
+{
+   sip_method_t method;
+   int error;
+
+   if (!sip_overloaded ())
+      return (SIP_OVERLOAD_ACCEPT);
+   method = sip_msg->sip_msg_req_res->sip_req_method;
+   if (method == ACK || method == CANCEL || method == BYE)
+      return (SIP_OVERLOAD_ACCEPT);
+   if (sip_get_to_tag ((sip_msg_t) sip_msg, &error) != NULL)
+      return (SIP_OVERLOAD_ACCEPT);
+   if (method == INVITE || method == REGISTER)
+   {
+      *retry_after = sip_ovl_conf.sip_ovl_retry_after;
+      return (SIP_OVERLOAD_REJECT);
+   }
+   return (SIP_OVERLOAD_DROP);
+}
@@ -1067,6 +1067,157 @@ int sip_parse_useragt_header (_sip_header_t * sip_header, sip_parsed_header_t **
    return (r);
 }
 
+/*
+ * Parse the value at sip_hdr_unparsed and append it after *last_value.
+ * sip_hdr_unparsed is left at the next value, NULL if there is none.
+ */
+static int sip_parse_via_value (_sip_header_t * sip_header, sip_parsed_header_t * parsed_header,
+                                sip_hdr_value_t ** last_value)
+{
+   sip_hdr_value_t *value;
+   int ret;
+
+   sip_header->sip_hdr_current = sip_header->sip_hdr_unparsed;
+   sip_header->sip_hdr_unparsed = NULL;
+   value = calloc (1, sizeof (sip_hdr_value_t));
+   if (value == NULL)
+      return (ENOMEM);
+   if (*last_value != NULL)
+      (*last_value)->sip_next_value = value;
+   else
+      parsed_header->value = (sip_value_t *) value;
+   *last_value = value;
+
+   value->sip_value_version = SIP_VALUE_VERSION_1;
+   value->sip_value_start = sip_header->sip_hdr_current;
+   value->sip_value_header = parsed_header;
+   value->via_protocol_name.sip_str_ptr = sip_header->sip_hdr_current;
+
+   /*
+    * Check to see if there is a version number
+    */
+   if (sip_get_protocol_version (sip_header, &value->via_protocol) != 0)
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_via_value;
+   }
+
+   if (sip_find_token (sip_header, SIP_SLASH) != 0)
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_via_value;
+   }
+
+   if (sip_skip_white_space (sip_header) != 0)
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_via_value;
+   }
+
+   value->via_protocol_transport.sip_str_ptr = sip_header->sip_hdr_current;
+   if (sip_find_white_space (sip_header) != 0)
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_via_value;
+   }
+
+   value->via_protocol_transport.sip_str_len =
+      sip_header->sip_hdr_current - value->via_protocol_transport.sip_str_ptr;
+
+   if (sip_skip_white_space (sip_header) != 0)
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_via_value;
+   }
+
+   value->via_sent_by_host.sip_str_ptr = sip_header->sip_hdr_current;
+   if (*sip_header->sip_hdr_current == '[')
+   {
+      if (sip_find_token (sip_header, ']'))
+      {
+         if (sip_goto_next_value (sip_header) != 0)
+            return (EPROTO);
+         value->sip_value_state = SIP_VALUE_BAD;
+         goto get_next_via_value;
+      }
+   }
+   else if (sip_find_separator (sip_header, SIP_SEMI, SIP_COMMA, SIP_HCOLON))
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_via_value;
+   }
+   value->via_sent_by_host.sip_str_len = sip_header->sip_hdr_current - value->via_sent_by_host.sip_str_ptr;
+
+   if (sip_skip_white_space (sip_header) != 0)
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_via_value;
+   }
+
+   if (*sip_header->sip_hdr_current == SIP_HCOLON)
+   {
+      sip_header->sip_hdr_current++;
+      /*
+       * We have a port number
+       */
+      if (sip_atoi (sip_header, &value->via_sent_by_port) != 0)
+      {
+         if (sip_goto_next_value (sip_header) != 0)
+            return (EPROTO);
+         value->sip_value_state = SIP_VALUE_BAD;
+         goto get_next_via_value;
+      }
+
+   }
+
+   /*
+    * Do some sanity checking.
+    * This should be replaced by a v4/v6 address check.
+    */
+   if (value->via_sent_by_host.sip_str_len == 0 ||
+       (!isalnum (*value->via_sent_by_host.sip_str_ptr) && *value->via_sent_by_host.sip_str_ptr != '['))
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_via_value;
+   }
+
+   ret = sip_parse_params (sip_header, &value->sip_param_list);
+   if (ret == EPROTO)
+   {
+      value->sip_value_state = SIP_VALUE_BAD;
+   }
+   else if (ret != 0)
+   {
+      return (ret);
+   }
+ get_next_via_value:
+   value->sip_value_end = sip_header->sip_hdr_current;
+
+   if (sip_find_token (sip_header, SIP_COMMA) == 0)
+   {
+      (void) sip_skip_white_space (sip_header);
+      if (sip_header->sip_hdr_current < sip_header->sip_hdr_end)
+         sip_header->sip_hdr_unparsed = sip_header->sip_hdr_current;
+   }
+   return (0);
+}
+
 /*
  * Via =  ( "Via" / "v" ) HCOLON via-parm *(COMMA via-parm)
  * via-parm          =  sent-protocol LWS sent-by *( SEMI via-params )
@@ -1093,7 +1244,6 @@ int sip_parse_via_header (_sip_header_t * sip_header, sip_parsed_header_t ** hea
 {
    sip_parsed_header_t *parsed_header;
    int ret;
-   sip_hdr_value_t *value = NULL;
    sip_hdr_value_t *last_value = NULL;
 
    if (sip_header == NULL || header == NULL)
@@ -1117,192 +1267,236 @@ int sip_parse_via_header (_sip_header_t * sip_header, sip_parsed_header_t ** hea
       return (ENOMEM);
    parsed_header->sip_parsed_header_version = SIP_PARSED_HEADER_VERSION_1;
    parsed_header->sip_header = sip_header;
-   while (sip_header->sip_hdr_current < sip_header->sip_hdr_end)
+   /*
+    * Only the top value is parsed here, sip_get_next_value() parses the
+    * others as it gets to them.
+    */
+   if (sip_header->sip_hdr_current < sip_header->sip_hdr_end)
    {
-
-      value = calloc (1, sizeof (sip_hdr_value_t));
-      if (value == NULL)
+      sip_header->sip_hdr_unparsed = sip_header->sip_hdr_current;
+      ret = sip_parse_via_value (sip_header, parsed_header, &last_value);
+      if (ret != 0)
       {
          sip_free_phdr (parsed_header);
-         return (ENOMEM);
+         return (ret);
       }
-      if (last_value != NULL)
-         last_value->sip_next_value = value;
-      else
-         parsed_header->value = (sip_value_t *) value;
+   }
 
-      value->sip_value_version = SIP_VALUE_VERSION_1;
-      value->sip_value_start = sip_header->sip_hdr_current;
-      value->sip_value_header = parsed_header;
-      value->via_protocol_name.sip_str_ptr = sip_header->sip_hdr_current;
+   sip_header->sip_hdr_parsed = parsed_header;
 
-      /*
-       * Check to see if there is a version number
-       */
-      if (sip_get_protocol_version (sip_header, &value->via_protocol) != 0)
-      {
-         if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_phdr (parsed_header);
-            return (EPROTO);
-         }
-         value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_via_value;
-      }
+   *header = parsed_header;
+   return (0);
+}
 
-      if (sip_find_token (sip_header, SIP_SLASH) != 0)
-      {
-         if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_phdr (parsed_header);
-            return (EPROTO);
-         }
-         value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_via_value;
-      }
+/* As sip_parse_via_value(), for Contact, From, To, Route and Record-Route */
+static int sip_parse_cftr_value (_sip_header_t * sip_header, sip_parsed_header_t * parsed_header,
+                                 sip_hdr_value_t ** last_value)
+{
+   sip_hdr_value_t *value;
+   char *tmp_ptr;
+   char *tmp_ptr_2;
+   int ret;
+   boolean_t quoted_name = B_FALSE;
 
-      if (sip_skip_white_space (sip_header) != 0)
-      {
-         if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_phdr (parsed_header);
-            return (EPROTO);
-         }
-         value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_via_value;
-      }
+   sip_header->sip_hdr_current = sip_header->sip_hdr_unparsed;
+   sip_header->sip_hdr_unparsed = NULL;
+   value = calloc (1, sizeof (sip_hdr_value_t));
+   if (value == NULL)
+      return (ENOMEM);
+   if (*last_value != NULL)
+      (*last_value)->sip_next_value = value;
+   else
+      parsed_header->value = (sip_value_t *) value;
+   *last_value = value;
+   if (*sip_header->sip_hdr_current == SIP_QUOTE)
+   {
+      sip_header->sip_hdr_current++;
+      quoted_name = B_TRUE;
+   }
+   value->sip_value_version = SIP_VALUE_VERSION_1;
+   value->sip_value_start = sip_header->sip_hdr_current;
+   value->sip_value_header = parsed_header;
+   /*
+    * lets see if there is a display name
+    */
+   if (*sip_header->sip_hdr_current != '<')
+   {
 
-      value->via_protocol_transport.sip_str_ptr = sip_header->sip_hdr_current;
-      if (sip_find_white_space (sip_header) != 0)
+      tmp_ptr = sip_header->sip_hdr_current;
+      /*
+       * According to 20.10 '<' may not have a leading
+       * space.
+       */
+      if (quoted_name && sip_find_token (sip_header, SIP_QUOTE))
       {
          if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_phdr (parsed_header);
             return (EPROTO);
-         }
          value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_via_value;
+         goto get_next_cftr_value;
       }
-
-      value->via_protocol_transport.sip_str_len =
-         sip_header->sip_hdr_current - value->via_protocol_transport.sip_str_ptr;
-
-      if (sip_skip_white_space (sip_header) != 0)
+      else if (sip_find_separator (sip_header, SIP_SEMI, SIP_LAQUOT, SIP_COMMA))
       {
-         if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_phdr (parsed_header);
-            return (EPROTO);
-         }
-         value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_via_value;
-      }
 
-      value->via_sent_by_host.sip_str_ptr = sip_header->sip_hdr_current;
-      if (*sip_header->sip_hdr_current == '[')
-      {
-         if (sip_find_token (sip_header, ']'))
+         /*
+          * only a uri.
+          */
+         value->cftr_uri.sip_str_ptr = tmp_ptr;
+         value->cftr_uri.sip_str_len = sip_header->sip_hdr_current - tmp_ptr;
+         /*
+          * It's an error not to have a uri.
+          */
+         if (value->cftr_uri.sip_str_len == 0)
          {
             if (sip_goto_next_value (sip_header) != 0)
-            {
-               sip_free_phdr (parsed_header);
                return (EPROTO);
-            }
             value->sip_value_state = SIP_VALUE_BAD;
-            goto get_next_via_value;
-         }
-      }
-      else if (sip_find_separator (sip_header, SIP_SEMI, SIP_COMMA, SIP_HCOLON))
-      {
-         if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_phdr (parsed_header);
-            return (EPROTO);
+            goto get_next_cftr_value;
          }
-         value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_via_value;
+         goto more_cftr_values;
       }
-      value->via_sent_by_host.sip_str_len = sip_header->sip_hdr_current - value->via_sent_by_host.sip_str_ptr;
 
-      if (sip_skip_white_space (sip_header) != 0)
+      tmp_ptr_2 = sip_header->sip_hdr_current;
+      if (*sip_header->sip_hdr_current == SIP_SP)
       {
-         if (sip_goto_next_value (sip_header) != 0)
+         if (sip_skip_white_space (sip_header) != 0)
          {
-            sip_free_phdr (parsed_header);
-            return (EPROTO);
+            /*
+             * only a uri.
+             */
+            value->cftr_uri.sip_str_ptr = tmp_ptr;
+            value->cftr_uri.sip_str_len = tmp_ptr_2 - tmp_ptr;
+            /*
+             * It's an error not to have a uri.
+             */
+            if (value->cftr_uri.sip_str_len == 0)
+            {
+               if (sip_goto_next_value (sip_header) != 0)
+                  return (EPROTO);
+               value->sip_value_state = SIP_VALUE_BAD;
+               goto get_next_cftr_value;
+            }
+            goto more_cftr_values;
          }
-         value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_via_value;
       }
 
-      if (*sip_header->sip_hdr_current == SIP_HCOLON)
+      if (*sip_header->sip_hdr_current != SIP_LAQUOT)
       {
-         sip_header->sip_hdr_current++;
          /*
-          * We have a port number
+          * No display name here.
           */
-         if (sip_atoi (sip_header, &value->via_sent_by_port) != 0)
+         value->cftr_uri.sip_str_ptr = tmp_ptr;
+         value->cftr_uri.sip_str_len = tmp_ptr_2 - tmp_ptr;
+         /*
+          * It's an error not to have a uri.
+          */
+         if (value->cftr_uri.sip_str_len == 0)
          {
             if (sip_goto_next_value (sip_header) != 0)
-            {
-               sip_free_phdr (parsed_header);
                return (EPROTO);
-            }
             value->sip_value_state = SIP_VALUE_BAD;
-            goto get_next_via_value;
+            goto get_next_cftr_value;
          }
-
+         goto get_params;
       }
 
-      /*
-       * Do some sanity checking.
-       * This should be replaced by a v4/v6 address check.
-       */
-      if (value->via_sent_by_host.sip_str_len == 0 ||
-          (!isalnum (*value->via_sent_by_host.sip_str_ptr) && *value->via_sent_by_host.sip_str_ptr != '['))
+      value->cftr_name = malloc (sizeof (sip_str_t));
+      if (value->cftr_name == NULL)
+         return (ENOMEM);
+      value->cftr_name->sip_str_ptr = tmp_ptr;
+      value->cftr_name->sip_str_len = tmp_ptr_2 - tmp_ptr;
+      if (quoted_name)
+         value->cftr_name->sip_str_len--;
+   }
+
+   if (sip_find_token (sip_header, SIP_LAQUOT) != 0)
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_cftr_value;
+   }
+
+   if (*sip_header->sip_hdr_current == SIP_SP)
+   {
+      if (sip_skip_white_space (sip_header) != 0)
       {
          if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_phdr (parsed_header);
             return (EPROTO);
-         }
          value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_via_value;
+         goto get_next_cftr_value;
       }
+   }
+
+   tmp_ptr = sip_header->sip_hdr_current;
+
+   if (sip_find_separator (sip_header, SIP_RAQUOT, '\0', '\0'))
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_cftr_value;
+   }
+
+   value->cftr_uri.sip_str_ptr = tmp_ptr;
+   value->cftr_uri.sip_str_len = sip_header->sip_hdr_current - tmp_ptr;
+
+   if (sip_find_token (sip_header, '>') != 0)
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EINVAL);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_cftr_value;
+   }
+
+   if (value->cftr_uri.sip_str_len <= strlen ("<>"))
+   {
+      if (sip_goto_next_value (sip_header) != 0)
+         return (EPROTO);
+      value->sip_value_state = SIP_VALUE_BAD;
+      goto get_next_cftr_value;
+   }
+
+ get_params:
+   ret = sip_parse_params (sip_header, &value->sip_param_list);
+   if (ret == EPROTO)
+   {
+      value->sip_value_state = SIP_VALUE_BAD;
+   }
+   else if (ret != 0)
+   {
+      return (ret);
+   }
+ get_next_cftr_value:
+   value->sip_value_end = sip_header->sip_hdr_current;
 
-      ret = sip_parse_params (sip_header, &value->sip_param_list);
-      if (ret == EPROTO)
+   /*
+    * Parse uri
+    */
+   if (value->cftr_uri.sip_str_len > 0)
+   {
+      int error;
+
+      value->sip_value_parsed_uri = sip_parse_uri (&value->cftr_uri, &error);
+      if (value->sip_value_parsed_uri == NULL)
+         return (ENOMEM);
+      if (error != 0 || ((_sip_uri_t *) value->sip_value_parsed_uri)->sip_uri_errflags != 0)
       {
          value->sip_value_state = SIP_VALUE_BAD;
       }
-      else if (ret != 0)
-      {
-         sip_free_phdr (parsed_header);
-         return (ret);
-      }
-    get_next_via_value:
-      value->sip_value_end = sip_header->sip_hdr_current;
-
-      if (sip_find_token (sip_header, SIP_COMMA) != 0)
-         break;
-      last_value = value;
-      (void) sip_skip_white_space (sip_header);
    }
 
-   sip_header->sip_hdr_parsed = parsed_header;
-
-   *header = parsed_header;
+   (void) sip_find_token (sip_header, SIP_COMMA);
+   (void) sip_skip_white_space (sip_header);
+ more_cftr_values:
+   if (sip_header->sip_hdr_current < sip_header->sip_hdr_end)
+      sip_header->sip_hdr_unparsed = sip_header->sip_hdr_current;
    return (0);
 }
 
-/* Generic parser for Contact, From, To, Route and Record-Route  headers */
-int sip_parse_cftr_header (_sip_header_t * sip_header, sip_parsed_header_t ** header)
+static int sip_parse_cftr_values (_sip_header_t * sip_header, sip_parsed_header_t ** header, boolean_t top_only)
 {
    sip_parsed_header_t *parsed_header;
-   char *tmp_ptr;
-   char *tmp_ptr_2;
    int ret;
-   sip_hdr_value_t *value = NULL;
    sip_hdr_value_t *last_value = NULL;
 
    if (sip_header == NULL || header == NULL)
@@ -1325,234 +1519,18 @@ int sip_parse_cftr_header (_sip_header_t * sip_header, sip_parsed_header_t ** he
       return (ENOMEM);
    parsed_header->sip_parsed_header_version = SIP_PARSED_HEADER_VERSION_1;
    parsed_header->sip_header = sip_header;
-   while (sip_header->sip_hdr_current < sip_header->sip_hdr_end)
+   if (sip_header->sip_hdr_current < sip_header->sip_hdr_end)
+      sip_header->sip_hdr_unparsed = sip_header->sip_hdr_current;
+   while (sip_header->sip_hdr_unparsed != NULL)
    {
-      boolean_t quoted_name = B_FALSE;
-
-      value = calloc (1, sizeof (sip_hdr_value_t));
-      if (value == NULL)
-      {
-         sip_free_cftr_header (parsed_header);
-         return (ENOMEM);
-      }
-      if (last_value != NULL)
-         last_value->sip_next_value = value;
-      else
-         parsed_header->value = (sip_value_t *) value;
-      if (*sip_header->sip_hdr_current == SIP_QUOTE)
-      {
-         sip_header->sip_hdr_current++;
-         quoted_name = B_TRUE;
-      }
-      value->sip_value_version = SIP_VALUE_VERSION_1;
-      value->sip_value_start = sip_header->sip_hdr_current;
-      value->sip_value_header = parsed_header;
-      /*
-       * lets see if there is a display name
-       */
-      if (*sip_header->sip_hdr_current != '<')
-      {
-
-         tmp_ptr = sip_header->sip_hdr_current;
-         /*
-          * According to 20.10 '<' may not have a leading
-          * space.
-          */
-         if (quoted_name && sip_find_token (sip_header, SIP_QUOTE))
-         {
-            if (sip_goto_next_value (sip_header) != 0)
-            {
-               sip_free_cftr_header (parsed_header);
-               return (EPROTO);
-            }
-            value->sip_value_state = SIP_VALUE_BAD;
-            goto get_next_cftr_value;
-         }
-         else if (sip_find_separator (sip_header, SIP_SEMI, SIP_LAQUOT, SIP_COMMA))
-         {
-
-            /*
-             * only a uri.
-             */
-            value->cftr_uri.sip_str_ptr = tmp_ptr;
-            value->cftr_uri.sip_str_len = sip_header->sip_hdr_current - tmp_ptr;
-            /*
-             * It's an error not to have a uri.
-             */
-            if (value->cftr_uri.sip_str_len == 0)
-            {
-               if (sip_goto_next_value (sip_header) != 0)
-               {
-                  sip_free_cftr_header (parsed_header);
-                  return (EPROTO);
-               }
-               value->sip_value_state = SIP_VALUE_BAD;
-               goto get_next_cftr_value;
-            }
-            continue;
-         }
-
-         tmp_ptr_2 = sip_header->sip_hdr_current;
-         if (*sip_header->sip_hdr_current == SIP_SP)
-         {
-            if (sip_skip_white_space (sip_header) != 0)
-            {
-               /*
-                * only a uri.
-                */
-               value->cftr_uri.sip_str_ptr = tmp_ptr;
-               value->cftr_uri.sip_str_len = tmp_ptr_2 - tmp_ptr;
-               /*
-                * It's an error not to have a uri.
-                */
-               if (value->cftr_uri.sip_str_len == 0)
-               {
-                  if (sip_goto_next_value (sip_header) != 0)
-                  {
-                     sip_free_cftr_header (parsed_header);
-                     return (EPROTO);
-                  }
-                  value->sip_value_state = SIP_VALUE_BAD;
-                  goto get_next_cftr_value;
-               }
-               continue;
-            }
-         }
-
-         if (*sip_header->sip_hdr_current != SIP_LAQUOT)
-         {
-            /*
-             * No display name here.
-             */
-            value->cftr_uri.sip_str_ptr = tmp_ptr;
-            value->cftr_uri.sip_str_len = tmp_ptr_2 - tmp_ptr;
-            /*
-             * It's an error not to have a uri.
-             */
-            if (value->cftr_uri.sip_str_len == 0)
-            {
-               if (sip_goto_next_value (sip_header) != 0)
-               {
-                  sip_free_cftr_header (parsed_header);
-                  return (EPROTO);
-               }
-               value->sip_value_state = SIP_VALUE_BAD;
-               goto get_next_cftr_value;
-            }
-            goto get_params;
-         }
-
-         value->cftr_name = malloc (sizeof (sip_str_t));
-         if (value->cftr_name == NULL)
-         {
-            sip_free_cftr_header (parsed_header);
-            return (ENOMEM);
-         }
-         value->cftr_name->sip_str_ptr = tmp_ptr;
-         value->cftr_name->sip_str_len = tmp_ptr_2 - tmp_ptr;
-         if (quoted_name)
-            value->cftr_name->sip_str_len--;
-      }
-
-      if (sip_find_token (sip_header, SIP_LAQUOT) != 0)
-      {
-         if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_cftr_header (parsed_header);
-            return (EPROTO);
-         }
-         value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_cftr_value;
-      }
-
-      if (*sip_header->sip_hdr_current == SIP_SP)
-      {
-         if (sip_skip_white_space (sip_header) != 0)
-         {
-            if (sip_goto_next_value (sip_header) != 0)
-            {
-               sip_free_cftr_header (parsed_header);
-               return (EPROTO);
-            }
-            value->sip_value_state = SIP_VALUE_BAD;
-            goto get_next_cftr_value;
-         }
-      }
-
-      tmp_ptr = sip_header->sip_hdr_current;
-
-      if (sip_find_separator (sip_header, SIP_RAQUOT, '\0', '\0'))
-      {
-         if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_cftr_header (parsed_header);
-            return (EPROTO);
-         }
-         value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_cftr_value;
-      }
-
-      value->cftr_uri.sip_str_ptr = tmp_ptr;
-      value->cftr_uri.sip_str_len = sip_header->sip_hdr_current - tmp_ptr;
-
-      if (sip_find_token (sip_header, '>') != 0)
-      {
-         if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_cftr_header (parsed_header);
-            return (EINVAL);
-         }
-         value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_cftr_value;
-      }
-
-      if (value->cftr_uri.sip_str_len <= strlen ("<>"))
-      {
-         if (sip_goto_next_value (sip_header) != 0)
-         {
-            sip_free_cftr_header (parsed_header);
-            return (EPROTO);
-         }
-         value->sip_value_state = SIP_VALUE_BAD;
-         goto get_next_cftr_value;
-      }
-
-    get_params:
-      ret = sip_parse_params (sip_header, &value->sip_param_list);
-      if (ret == EPROTO)
-      {
-         value->sip_value_state = SIP_VALUE_BAD;
-      }
-      else if (ret != 0)
+      ret = sip_parse_cftr_value (sip_header, parsed_header, &last_value);
+      if (ret != 0)
       {
          sip_free_cftr_header (parsed_header);
          return (ret);
       }
-    get_next_cftr_value:
-      value->sip_value_end = sip_header->sip_hdr_current;
-
-      /*
-       * Parse uri
-       */
-      if (value->cftr_uri.sip_str_len > 0)
-      {
-         int error;
-
-         value->sip_value_parsed_uri = sip_parse_uri (&value->cftr_uri, &error);
-         if (value->sip_value_parsed_uri == NULL)
-         {
-            sip_free_cftr_header (parsed_header);
-            return (ENOMEM);
-         }
-         if (error != 0 || ((_sip_uri_t *) value->sip_value_parsed_uri)->sip_uri_errflags != 0)
-         {
-            value->sip_value_state = SIP_VALUE_BAD;
-         }
-      }
-
-      (void) sip_find_token (sip_header, SIP_COMMA);
-      last_value = value;
-      (void) sip_skip_white_space (sip_header);
+      if (top_only)
+         break;
    }
 
    sip_header->sip_hdr_parsed = parsed_header;
@@ -1561,6 +1539,50 @@ int sip_parse_cftr_header (_sip_header_t * sip_header, sip_parsed_header_t ** he
    return (0);
 }
 
+/* Generic parser for Contact, From and To headers */
+int sip_parse_cftr_header (_sip_header_t * sip_header, sip_parsed_header_t ** header)
+{
+   return (sip_parse_cftr_values (sip_header, header, B_FALSE));
+}
+
+/*
+ * Route and Record-Route, only the top value is parsed here, the rest
+ * when sip_get_next_value() gets to them.
+ */
+int sip_parse_route_header (_sip_header_t * sip_header, sip_parsed_header_t ** header)
+{
+   return (sip_parse_cftr_values (sip_header, header, B_TRUE));
+}
+
+/*
+ * Parse one more value of a header left with sip_hdr_unparsed set and
+ * append it to the parsed values. A value that fails to parse is kept,
+ * marked bad, and ends the list. Called with the message lock held.
+ */
+int sip_parse_next_value (_sip_header_t * sip_header)
+{
+   sip_parsed_header_t *parsed_header = sip_header->sip_hdr_parsed;
+   sip_hdr_value_t *last_value;
+   sip_hdr_value_t *prev_value;
+   int ret;
+
+   if (parsed_header == NULL || sip_header->sip_hdr_unparsed == NULL)
+      return (EINVAL);
+   last_value = (sip_hdr_value_t *) parsed_header->value;
+   while (last_value != NULL && last_value->sip_next_value != NULL)
+      last_value = last_value->sip_next_value;
+   prev_value = last_value;
+   if (sip_header->sip_header_functions != NULL && sip_header->sip_header_parse == sip_parse_via_header)
+      ret = sip_parse_via_value (sip_header, parsed_header, &last_value);
+   else
+      ret = sip_parse_cftr_value (sip_header, parsed_header, &last_value);
+   if (ret != 0 && last_value != prev_value)
+      last_value->sip_value_state = SIP_VALUE_BAD;
+   /* as found after sip_search_for_header() */
+   sip_header->sip_hdr_current = sip_header->sip_hdr_start;
+   return (ret);
+}
+
 /*
  * Parse RAck header
  * "RAck" HCOLON response-num LWS CSeq-num LWS Method
@@ -1843,14 +1865,8 @@ static int _sip_get_request_uri (_sip_header_t * sip_header, sip_message_type_t
 
    msg_info->U.sip_request.sip_request_uri.sip_str_ptr = start_ptr;
    msg_info->U.sip_request.sip_request_uri.sip_str_len = size;
-   if (size > 0)
-   {                            /* Parse uri */
-      int error;
-
-      msg_info->U.sip_request.sip_parse_uri = sip_parse_uri (&msg_info->U.sip_request.sip_request_uri, &error);
-      if (msg_info->U.sip_request.sip_parse_uri == NULL)
-         return (1);
-   }
+   /* Parsing the uri waits for sip_get_request_uri() */
+   msg_info->U.sip_request.sip_parse_uri = NULL;
    return (0);
 }
 
@@ -24,225 +24,295 @@
  * Use is subject to license terms.
  */
 
+#include <limits.h>
+#include <stddef.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include "sip_miscdefs.h"
+#include "sip_msg.h"
 
 /*
- * Local version of case insensitive strstr().
+ * If the header line [p, e) is the header name (lower case) or its compact
+ * form, return where its value starts, else NULL. Used to pick a few
+ * headers out of a message that has not been parsed.
  */
-static char *sip_reass_strstr (const char *as1, const char *as2)
+const char *sip_reass_hdr_value (const char *p, const char *e, const char *name, char compact)
 {
-   const char *s1;
-   const char *s2;
-   const char *tptr;
-   char c;
+   size_t n = 0;
 
-   s1 = as1;
-   s2 = as2;
+   if (e - p > 1 && (p[1] == ':' || p[1] == ' ' || p[1] == '\t') && tolower ((unsigned char) p[0]) == compact)
+   {
+      p++;
+   }
+   else
+   {
+      while (name[n] != '\0' && p + n < e && tolower ((unsigned char) p[n]) == name[n])
+         n++;
+      if (name[n] != '\0')
+         return (NULL);
+      p += n;
+   }
+   while (p < e && (*p == ' ' || *p == '\t'))
+      p++;
+   if (p == e || *p++ != ':')
+      return (NULL);
+   while (p < e && (*p == ' ' || *p == '\t'))
+      p++;
+   return (p);
+}
 
-   if (s2 == NULL || *s2 == '\0')
-      return ((char *) s1);
-   c = *s2;
+/*
+ * If the header line [p, e) is Content-Length, long or compact form, set
+ * *value to it. Returns B_FALSE for other headers.
+ */
+static boolean_t sip_frame_clen (const char *p, const char *e, size_t * value)
+{
+   size_t v = 0;
 
-   while (*s1)
-      if (tolower (*s1++) == c)
-      {
-         tptr = s1;
-         while ((c = *++s2) == tolower (*s1++) && c)
-            ;
-         if (c == 0)
-            return ((char *) tptr - 1);
-         s1 = tptr;
-         s2 = as2;
-         c = *s2;
-      }
+   if ((p = sip_reass_hdr_value (p, e, "content-length", 'l')) == NULL)
+      return (B_FALSE);
+   while (p < e && *p >= '0' && *p <= '9')
+   {
+      if (v > (INT_MAX - 9) / 10)
+         break;
+      v = v * 10 + (*p++ - '0');
+   }
+   *value = v;
+   return (B_TRUE);
+}
 
-   return (NULL);
+/* Reset the framing state for the next message */
+static void sip_frame_reset (sip_reass_frame_t * frame)
+{
+   frame->sip_frame_scan = 0;
+   frame->sip_frame_hlen = 0;
+   frame->sip_frame_clen = 0;
+   frame->sip_frame_start = B_FALSE;
+   frame->sip_frame_lines.sip_lines_n = 0;
 }
 
 /*
- * Get the value in the content-length field and add it to the header length
- * and return the total length. returns -1 if the length cannot be determined
- * or if the message does not contain the entire message.
+ * Frame the message at p, len bytes of which have been received. Only
+ * the lines not scanned by a previous call are looked at: memchr() finds
+ * the end of each one, the empty line ends the header and the body is
+ * Content-Length long. The start of each header line goes to the line
+ * table; a folded header drops it, the header is then set up from the
+ * CRLFs where the fold is undone.
+ * Returns the length of the message or -1 if it is not complete yet. A
+ * message without Content-Length has no body (it is mandatory on stream
+ * transports, the parser rejects it).
  */
-static int sip_get_msglen (char *p, size_t msglen)
+static int sip_frame_msg (sip_reass_frame_t * frame, const char *p, size_t len)
 {
-   int value = 0;
-   int hlen;
-   char *c;
-   char *e;
-   int base = 10;
-   char *edge;
-   int digits = 0;
+   sip_reass_lines_t *lines;
+   const char *line;
+   const char *nl;
+   const char *e;
 
-   edge = p + msglen;
-   if ((c = sip_reass_strstr (p, "content-length")) == NULL)
-      return (-1);
-   hlen = c - p;
-   if ((hlen + strlen ("content-length")) >= msglen)
-      return (-1);
-   c += strlen ("content-length");
-   e = c + 1;
-   while (*e == ' ' || *e == ':')
+   while (frame->sip_frame_hlen == 0 && frame->sip_frame_scan < len)
    {
-      e++;
-      if (e == edge)
+      line = p + frame->sip_frame_scan;
+      nl = memchr (line, '\n', len - frame->sip_frame_scan);
+      if (nl == NULL)
          return (-1);
+      lines = &frame->sip_frame_lines;
+      if (lines->sip_lines_n >= 0)
+      {
+         if (nl == line || nl[-1] != '\r' || lines->sip_lines_n == SIP_REASS_LINES ||
+             *line == SIP_SP || *line == SIP_HTAB)
+            lines->sip_lines_n = -1;
+         else
+            lines->sip_lines_off[lines->sip_lines_n++] = frame->sip_frame_scan;
+      }
+      frame->sip_frame_scan = nl + 1 - p;
+      e = nl;
+      if (e > line && e[-1] == '\r')
+         e--;
+      if (e == line)
+         frame->sip_frame_hlen = frame->sip_frame_scan;
+      else if (!frame->sip_frame_start)
+         frame->sip_frame_start = B_TRUE;
+      else if (*line != ' ' && *line != '\t')
+         (void) sip_frame_clen (line, e, &frame->sip_frame_clen);
    }
-   while (*e != '\r' && *e != ' ')
-   {
-      if (e == edge)
-         return (-1);
-      if (*e >= '0' && *e <= '9')
-         digits = *e - '0';
-      else
-         return (-1);
-      value = (value * base) + digits;
-      e++;
-   }
-   while (*e != '\r')
+   if (frame->sip_frame_hlen == 0 || frame->sip_frame_hlen + frame->sip_frame_clen > len)
+      return (-1);
+   return (frame->sip_frame_hlen + frame->sip_frame_clen);
+}
+
+/* Drop a reference to a chunk, freeing it with the last one */
+void sip_reass_chunk_rele (sip_reass_chunk_t * chunk)
+{
+   if (__atomic_sub_fetch (&chunk->sip_chunk_ref, 1, __ATOMIC_ACQ_REL) == 0)
+      free (chunk);
+}
+
+/* Free a message buffer, unless it is a slice of chunk */
+void sip_reass_free_buf (sip_reass_chunk_t * chunk, char *buf)
+{
+   if (chunk != NULL && buf >= chunk->sip_chunk_data && buf <= chunk->sip_chunk_data + chunk->sip_chunk_size)
+      return;
+   free (buf);
+}
+
+/*
+ * Make room for len more bytes in the reassembly chunk. The bytes not
+ * handed out yet are moved to the front if nothing else uses the chunk,
+ * or else to a new chunk, big enough for at least twice of them so that
+ * a large message is copied a bounded number of times.
+ */
+static int sip_reass_reserve (sip_reass_entry_t * reass, size_t len)
+{
+   sip_reass_chunk_t *chunk = reass->sip_reass_chunk;
+   sip_reass_chunk_t *newchunk;
+   size_t pending;
+   size_t size;
+
+   if (chunk != NULL && chunk->sip_chunk_size - reass->sip_reass_end >= len)
+      return (0);
+   pending = reass->sip_reass_end - reass->sip_reass_start;
+   if (chunk != NULL && __atomic_load_n (&chunk->sip_chunk_ref, __ATOMIC_ACQUIRE) == 1 &&
+       chunk->sip_chunk_size - pending >= len)
    {
-      e++;
-      if (e == edge)
-         return (-1);
+      (void) memmove (chunk->sip_chunk_data, chunk->sip_chunk_data + reass->sip_reass_start, pending);
+      reass->sip_reass_start = 0;
+      reass->sip_reass_end = pending;
+      chunk->sip_chunk_data[pending] = '\0';
+      return (0);
    }
-   hlen = e - p + 4;            /* 4 for 2 CRLFs ?? */
-   value += hlen;
-
-   return (value);
+   size = SIP_REASS_CHUNK_SZ;
+   while (size < pending + len || (pending > 0 && size < 2 * pending))
+      size *= 2;
+   newchunk = malloc (offsetof (sip_reass_chunk_t, sip_chunk_data) + size + 1);
+   if (newchunk == NULL)
+      return (ENOMEM);
+   newchunk->sip_chunk_ref = 1;
+   newchunk->sip_chunk_size = size;
+   if (pending > 0)
+      (void) memcpy (newchunk->sip_chunk_data, chunk->sip_chunk_data + reass->sip_reass_start, pending);
+   newchunk->sip_chunk_data[pending] = '\0';
+   if (chunk != NULL)
+      sip_reass_chunk_rele (chunk);
+   reass->sip_reass_chunk = newchunk;
+   reass->sip_reass_start = 0;
+   reass->sip_reass_end = pending;
+   return (0);
 }
 
 /*
- * We have determined that msg does not contain a *single* complete message.
- * Add it to the reassembly list and check if we have a complete message.
- * a NULL 'msg' means we are just checking if there are more complete
- * messages in the list that can be passed up.
+ * Append msg, a TCP segment of msglen bytes, to the connection's
+ * reassembly chunk and fill slices with up to nslices of the complete
+ * messages in it, in one go under the reassembly lock. A NULL 'msg' means
+ * we are just checking if there are more complete messages in the chunk
+ * that can be passed up. Returns the number of slices filled, so that
+ * nslices of them means there may be more.
+ *
+ * The messages are not copied: each is a slice of the chunk that holds a
+ * reference to it (see sip_reass_free_buf()). A slice is only NUL
+ * terminated if it is the last one in the chunk. A NULL sip_slice_chunk
+ * means the message is a plain malloc'd buffer.
  */
-char *sip_get_tcp_msg (sip_conn_object_t obj, char *msg, size_t * msglen)
+int sip_get_tcp_msgs (sip_conn_object_t obj, char *msg, size_t msglen, sip_reass_slice_t * slices, int nslices)
 {
    int value;
+   int n = 0;
    sip_conn_obj_pvt_t *pvt_data;
    sip_reass_entry_t *reass;
+   sip_reass_chunk_t *chunk;
+   sip_reass_frame_t frame;
+   sip_reass_lines_t *lines;
    void **obj_val;
-   char *msgbuf = NULL;
-   int splitlen;
-   char *splitbuf;
+   char *msgbuf;
+   size_t pending;
+   int refs;
 
-   if (msg != NULL)
-   {
-      assert (*msglen > 0);
-      msgbuf = (char *) malloc (*msglen + 1);
-      if (msgbuf == NULL)
-         return (NULL);
-      (void) strncpy (msgbuf, msg, *msglen);
-      msgbuf[*msglen] = '\0';
-      msg = msgbuf;
-   }
+   assert (nslices > 0);
    obj_val = (void *) obj;
    pvt_data = (sip_conn_obj_pvt_t *) * obj_val;
    /* connection object not initialized */
    if (pvt_data == NULL)
    {
       if (msg == NULL)
-         return (NULL);
-      value = sip_get_msglen (msg, *msglen);
-      if (value == *msglen)
-      {
-         return (msg);
-      }
-      else
+         return (0);
+      assert (msglen > 0);
+      msgbuf = (char *) malloc (msglen + 1);
+      if (msgbuf == NULL)
+         return (0);
+      (void) strncpy (msgbuf, msg, msglen);
+      msgbuf[msglen] = '\0';
+      sip_frame_reset (&frame);
+      value = sip_frame_msg (&frame, msgbuf, msglen);
+      if (value != msglen)
       {
-         if (msgbuf != NULL)
-            free (msgbuf);
-         return (NULL);
+         free (msgbuf);
+         return (0);
       }
+      slices[0].sip_slice_buf = msgbuf;
+      slices[0].sip_slice_len = msglen;
+      slices[0].sip_slice_chunk = NULL;
+      slices[0].sip_slice_lines = frame.sip_frame_lines;
+      return (1);
    }
    (void) pthread_mutex_lock (&pvt_data->sip_conn_obj_reass_lock);
    reass = pvt_data->sip_conn_obj_reass;
    assert (reass != NULL);
-   if (reass->sip_reass_msg == NULL)
-   {
-      assert (reass->sip_reass_msglen == 0);
-      if (msg == NULL)
-      {
-         (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_reass_lock);
-         return (NULL);
-      }
-      value = sip_get_msglen (msg, *msglen);
-      if (value == *msglen)
-      {
-         (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_reass_lock);
-         return (msg);
-      }
-      reass->sip_reass_msg = msg;
-      reass->sip_reass_msglen = *msglen;
-      if (value != -1 && value < reass->sip_reass_msglen)
-         goto tryone;
-      (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_reass_lock);
-      return (NULL);
-   }
-   else if (msg != NULL)
+   if (msg != NULL)
    {
-      /* Resize, not optimal */
-      int newlen = reass->sip_reass_msglen + *msglen;
-      char *newmsg;
-
-      assert (strlen (reass->sip_reass_msg) == reass->sip_reass_msglen);
-      newmsg = malloc (newlen + 1);
-      if (newmsg == NULL)
+      assert (msglen > 0);
+      if (sip_reass_reserve (reass, msglen) != 0)
       {
          (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_reass_lock);
-         if (msgbuf != NULL)
-            free (msgbuf);
-         return (NULL);
+         return (0);
       }
-      (void) strncpy (newmsg, reass->sip_reass_msg, reass->sip_reass_msglen);
-      newmsg[reass->sip_reass_msglen] = '\0';
-      (void) strncat (newmsg, msg, *msglen);
-      newmsg[newlen] = '\0';
-      assert (strlen (newmsg) == newlen);
-      reass->sip_reass_msglen = newlen;
-      free (msg);
-      free (reass->sip_reass_msg);
-      reass->sip_reass_msg = newmsg;
+      chunk = reass->sip_reass_chunk;
+      (void) memcpy (chunk->sip_chunk_data + reass->sip_reass_end, msg, msglen);
+      reass->sip_reass_end += msglen;
+      chunk->sip_chunk_data[reass->sip_reass_end] = '\0';
    }
-   value = sip_get_msglen (reass->sip_reass_msg, reass->sip_reass_msglen);
-   if (value == -1 || value > reass->sip_reass_msglen)
+   chunk = reass->sip_reass_chunk;
+   while (n < nslices)
    {
-      (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_reass_lock);
-      return (NULL);
+      /* CRLFs before the start line are keep-alives */
+      while (!reass->sip_reass_frame.sip_frame_start && reass->sip_reass_start < reass->sip_reass_end &&
+             (chunk->sip_chunk_data[reass->sip_reass_start] == '\r' ||
+              chunk->sip_chunk_data[reass->sip_reass_start] == '\n'))
+         reass->sip_reass_start++;
+      pending = reass->sip_reass_end - reass->sip_reass_start;
+      if (pending == 0)
+         break;
+      msgbuf = chunk->sip_chunk_data + reass->sip_reass_start;
+      value = sip_frame_msg (&reass->sip_reass_frame, msgbuf, pending);
+      if (value == -1)
+         break;
+      reass->sip_reass_start += value;
+      slices[n].sip_slice_buf = msgbuf;
+      slices[n].sip_slice_len = value;
+      slices[n].sip_slice_chunk = chunk;
+      lines = &reass->sip_reass_frame.sip_frame_lines;
+      slices[n].sip_slice_lines.sip_lines_n = lines->sip_lines_n;
+      if (lines->sip_lines_n > 0)
+         (void) memcpy (slices[n].sip_slice_lines.sip_lines_off, lines->sip_lines_off,
+                        lines->sip_lines_n * sizeof (uint32_t));
+      sip_frame_reset (&reass->sip_reass_frame);
+      n++;
    }
- tryone:
-   if (value == reass->sip_reass_msglen)
+   if (n == 0)
    {
-      msg = reass->sip_reass_msg;
-      *msglen = reass->sip_reass_msglen;
-      reass->sip_reass_msg = NULL;
-      reass->sip_reass_msglen = 0;
       (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_reass_lock);
-      return (msg);
+      return (0);
    }
-   splitlen = reass->sip_reass_msglen - value;
-   msg = (char *) malloc (value + 1);
-   splitbuf = (char *) malloc (splitlen + 1);
-   if (msg == NULL || splitbuf == NULL)
+   /* One reference per slice, taken at once */
+   refs = n;
+   if (reass->sip_reass_start == reass->sip_reass_end && __atomic_load_n (&chunk->sip_chunk_ref, __ATOMIC_ACQUIRE) == 1)
    {
-      if (msg != NULL)
-         free (msg);
-      if (splitbuf != NULL)
-         free (splitbuf);
-      (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_reass_lock);
-      return (NULL);
+      /* All handed out, the chunk goes with the messages */
+      reass->sip_reass_chunk = NULL;
+      reass->sip_reass_start = 0;
+      reass->sip_reass_end = 0;
+      refs--;
    }
-   (void) strncpy (msg, reass->sip_reass_msg, value);
-   msg[value] = '\0';
-   (void) strncpy (splitbuf, reass->sip_reass_msg + value, splitlen);
-   splitbuf[splitlen] = '\0';
-   free (reass->sip_reass_msg);
-   reass->sip_reass_msg = splitbuf;
-   reass->sip_reass_msglen = splitlen;
+   if (refs > 0)
+      (void) __atomic_add_fetch (&chunk->sip_chunk_ref, refs, __ATOMIC_ACQ_REL);
    (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_reass_lock);
-   *msglen = value;
-   return (msg);
+   return (n);
 }
@@ -40,6 +40,731 @@ error:
    return (NULL);
 }
 
+/*
+ * Benchmark: sip_test -b [count [rx_threads [eager]]]
+ * Feeds count distinct INVITE datagrams through sip_process_new_packet()
+ * one at a time, then through sip_process_new_packets() in batches of 64.
+ * A non-zero eager runs the stack with SIP_STACK_EAGER_PARSE.
+ */
+#define BENCH_BATCH 64
+
+struct sip_conn_object
+{
+   void *pvt;
+   boolean_t stream;            /* TCP, for sip_test -t */
+};
+
+static int bench_recvd;
+
+static int bench_send (const sip_conn_object_t obj, char *msg, int len)
+{
+   return (0);
+}
+
+static void bench_hold (sip_conn_object_t obj)
+{
+}
+
+static void bench_rele (sip_conn_object_t obj)
+{
+}
+
+static boolean_t bench_false (sip_conn_object_t obj)
+{
+   return (B_FALSE);
+}
+
+static int bench_addr (sip_conn_object_t obj, struct sockaddr *sa, socklen_t *len)
+{
+   return (EINVAL);
+}
+
+static int bench_udp (sip_conn_object_t obj)
+{
+   return (IPPROTO_UDP);
+}
+
+static void bench_recv (const sip_conn_object_t obj, sip_msg_t msg, const sip_dialog_t dialog)
+{
+   __atomic_add_fetch (&bench_recvd, 1, __ATOMIC_RELAXED);
+}
+
+static char **bench_msgs (const char *tag, int count)
+{
+   char **msgs = malloc (count * sizeof (char *));
+   int i;
+
+   for (i = 0; i < count; i++)
+   {
+      msgs[i] = malloc (512);
+      snprintf (msgs[i], 512,
+                "INVITE sip:bob@example.com SIP/2.0\r\n"
+                "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK%s%d\r\n"
+                "Max-Forwards: 70\r\n"
+                "From: <sip:alice@example.com>;tag=%s%d\r\n"
+                "To: <sip:bob@example.com>\r\n"
+                "Call-ID: %s%d@10.0.0.1\r\n"
+                "CSeq: 1 INVITE\r\n"
+                "Contact: <sip:alice@10.0.0.1>\r\n"
+                "Content-Length: 0\r\n\r\n", tag, i, tag, i, tag, i);
+   }
+   return (msgs);
+}
+
+static double bench_elapsed (struct timespec *start)
+{
+   struct timespec end;
+
+   clock_gettime (CLOCK_MONOTONIC, &end);
+   return ((end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+/* Feed count new INVITEs, one at a time or in batches, returns the time taken */
+static double bench_run (sip_conn_object_t conn, const char *tag, int count, boolean_t batch)
+{
+   sip_packet_t pkts[BENCH_BATCH];
+   struct timespec start;
+   char **msgs;
+   double t;
+   int i;
+   int j;
+   int n;
+   int expect;
+
+   msgs = bench_msgs (tag, count);
+   expect = __atomic_load_n (&bench_recvd, __ATOMIC_RELAXED) + count;
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   for (i = 0; i < count; i += n)
+   {
+      for (n = 0, j = i; j < count && n < (batch ? BENCH_BATCH : 1); j++, n++)
+      {
+         pkts[n].sip_pkt_buf = msgs[j];
+         pkts[n].sip_pkt_len = strlen (msgs[j]);
+         pkts[n].sip_pkt_release = NULL;
+         pkts[n].sip_pkt_arg = NULL;
+      }
+      if (batch)
+         sip_process_new_packets (conn, pkts, n);
+      else
+         sip_process_new_packet (conn, pkts[0].sip_pkt_buf, pkts[0].sip_pkt_len);
+   }
+   /* With receive threads, wait for them to be done */
+   while (__atomic_load_n (&bench_recvd, __ATOMIC_RELAXED) < expect)
+      sched_yield ();
+   t = bench_elapsed (&start);
+   for (i = 0; i < count; i++)
+      free (msgs[i]);
+   free (msgs);
+   return (t);
+}
+
+/* Alternate the two so that neither gets the emptier tables */
+static int bench (int count, int rx_threads, int eager)
+{
+   sip_io_pointers_t io = { bench_send, bench_hold, bench_rele, bench_false, bench_false,
+      bench_addr, bench_addr, bench_udp };
+   sip_ulp_pointers_t ulp = { bench_recv };
+   sip_stack_init_t init = { SIP_STACK_VERSION, SIP_STACK_DIALOGS, &io, &ulp };
+   struct sip_conn_object conn = { NULL };
+   double single = 0;
+   double batch = 0;
+   char tag[16];
+   int round;
+
+   init.sip_rx_threads = rx_threads;
+   if (eager)
+      init.sip_stack_flags |= SIP_STACK_EAGER_PARSE;
+   if (sip_stack_init (&init) != 0)
+   {
+      printf ("sip_stack_init failed\n");
+      return (1);
+   }
+   count /= 8;
+   for (round = 0; round < 4; round++)
+   {
+      snprintf (tag, sizeof (tag), "b%d-", round);
+      if (round & 1)
+         batch += bench_run (&conn, tag, count, B_TRUE);
+      snprintf (tag, sizeof (tag), "s%d-", round);
+      single += bench_run (&conn, tag, count, B_FALSE);
+      snprintf (tag, sizeof (tag), "b%d-", round);
+      if (!(round & 1))
+         batch += bench_run (&conn, tag, count, B_TRUE);
+   }
+   printf ("sip_process_new_packet:  %d msgs %.3fs %.0f msgs/s\n", 4 * count, single, 4 * count / single);
+   printf ("sip_process_new_packets: %d msgs %.3fs %.0f msgs/s\n", 4 * count, batch, 4 * count / batch);
+   printf ("%d delivered\n", __atomic_load_n (&bench_recvd, __ATOMIC_RELAXED));
+   return (0);
+}
+
+/*
+ * Benchmark: sip_test -d [dialogs [count]]
+ * Sets up dialogs dialogs, each an INVITE answered with a 200, then feeds
+ * count in-dialog INFOs to dialogs picked at random, one at a time and
+ * in batches of BENCH_BATCH (passed up with sip_ulp_recv_batch()), so
+ * that the dialog and transaction lookups go to tables much larger than
+ * the caches.
+ */
+static int bench_dlg_hits;
+
+static void bench_dlg_recv (const sip_conn_object_t obj, sip_msg_t msg, const sip_dialog_t dialog)
+{
+   sip_msg_t resp;
+   char totag[32];
+
+   __atomic_add_fetch (&bench_recvd, 1, __ATOMIC_RELAXED);
+   if (sip_get_request_method (msg, NULL) != INVITE)
+   {
+      if (dialog != NULL)
+         bench_dlg_hits++;
+      return;
+   }
+   (void) snprintf (totag, sizeof (totag), "t%d", bench_recvd);
+   resp = sip_create_response (msg, SIP_OK, "OK", totag, "sip:bob@10.0.0.2");
+   if (resp == NULL)
+      return;
+   (void) sip_sendmsg (obj, resp, dialog, SIP_SEND_STATEFUL);
+   sip_free_msg (resp);
+}
+
+static void bench_dlg_recv_batch (const sip_conn_object_t obj, sip_msg_t * msgs, sip_dialog_t * dialogs, int n)
+{
+   int i;
+
+   for (i = 0; i < n; i++)
+      bench_dlg_recv (obj, msgs[i], dialogs[i]);
+}
+
+/* An INVITE, or an INFO in the dialog it set up, for dialog i */
+static void bench_dlg_msg (char *buf, size_t size, int i, int seq, boolean_t info)
+{
+   char totag[32];
+
+   (void) snprintf (totag, sizeof (totag), ";tag=t%d", i + 1);
+   (void) snprintf (buf, size,
+                    "%s sip:bob@10.0.0.2 SIP/2.0\r\n"
+                    "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bKd%d-%d\r\n"
+                    "Max-Forwards: 70\r\n"
+                    "From: <sip:alice@example.com>;tag=f%d\r\n"
+                    "To: <sip:bob@example.com>%s\r\n"
+                    "Call-ID: d%d@10.0.0.1\r\n"
+                    "CSeq: %d %s\r\n"
+                    "Contact: <sip:alice@10.0.0.1>\r\n"
+                    "Content-Length: 0\r\n\r\n", info ? "INFO" : "INVITE", i, seq, i, info ? totag : "", i,
+                    seq, info ? "INFO" : "INVITE");
+}
+
+/* Feed count INFOs from msgs, returns the time taken */
+static double bench_dlg_run (sip_conn_object_t conn, char **msgs, int count, boolean_t batch)
+{
+   sip_packet_t pkts[BENCH_BATCH];
+   struct timespec start;
+   int i;
+   int n;
+
+   clock_gettime (CLOCK_MONOTONIC, &start);
+   for (i = 0; i < count; i += n)
+   {
+      for (n = 0; i + n < count && n < (batch ? BENCH_BATCH : 1); n++)
+      {
+         pkts[n].sip_pkt_buf = msgs[i + n];
+         pkts[n].sip_pkt_len = strlen (msgs[i + n]);
+         pkts[n].sip_pkt_release = NULL;
+         pkts[n].sip_pkt_arg = NULL;
+      }
+      if (batch)
+         sip_process_new_packets (conn, pkts, n);
+      else
+         sip_process_new_packet (conn, pkts[0].sip_pkt_buf, pkts[0].sip_pkt_len);
+   }
+   return (bench_elapsed (&start));
+}
+
+static int bench_dialogs (int dialogs, int count)
+{
+   sip_io_pointers_t io = { bench_send, bench_hold, bench_rele, bench_false, bench_false,
+      bench_addr, bench_addr, bench_udp };
+   sip_ulp_pointers_t ulp = { bench_dlg_recv };
+   sip_stack_init_t init = { SIP_STACK_VERSION, SIP_STACK_DIALOGS, &io, &ulp };
+   struct sip_conn_object conn = { NULL };
+   char buf[512];
+   char **msgs;
+   double single = 0;
+   double batch = 0;
+   int round;
+   int i;
+
+   init.sip_hash_size = dialogs;
+   init.sip_ulp_recv_batch = bench_dlg_recv_batch;
+   if (sip_stack_init (&init) != 0)
+   {
+      printf ("sip_stack_init failed\n");
+      return (1);
+   }
+   for (i = 0; i < dialogs; i++)
+   {
+      bench_dlg_msg (buf, sizeof (buf), i, 1, B_FALSE);
+      sip_process_new_packet (&conn, buf, strlen (buf));
+   }
+   msgs = malloc (count * sizeof (char *));
+   srandom (1);
+   for (round = 0; round < 4; round++)
+   {
+      for (i = 0; i < count; i++)
+      {
+         msgs[i] = malloc (512);
+         bench_dlg_msg (msgs[i], 512, random () % dialogs, 2 + round * count + i, B_TRUE);
+      }
+      /* Alternate which goes first */
+      if (round & 1)
+      {
+         batch += bench_dlg_run (&conn, msgs, count / 2, B_TRUE);
+         single += bench_dlg_run (&conn, msgs + count / 2, count - count / 2, B_FALSE);
+      }
+      else
+      {
+         single += bench_dlg_run (&conn, msgs, count / 2, B_FALSE);
+         batch += bench_dlg_run (&conn, msgs + count / 2, count - count / 2, B_TRUE);
+      }
+      for (i = 0; i < count; i++)
+         free (msgs[i]);
+   }
+   free (msgs);
+   printf ("%d dialogs, %d in-dialog msgs each way\n", dialogs, 2 * count);
+   printf ("sip_process_new_packet:  %.3fs %.0f msgs/s\n", single, 2 * count / single);
+   printf ("sip_process_new_packets: %.3fs %.0f msgs/s\n", batch, 2 * count / batch);
+   printf ("%d in a dialog\n", bench_dlg_hits);
+   return (0);
+}
+
+/*
+ * Benchmark: sip_test -s [file [rounds]]
+ * Splits the messages in file (sip_msgs.txt) into header lines with
+ * sip_setup_header_pointers() rounds times, reports bytes per cycle.
+ */
+static uint64_t bench_cycles (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   return (__builtin_ia32_rdtsc ());
+#else
+   struct timespec now;
+
+   /* No cycle counter, count nanoseconds */
+   clock_gettime (CLOCK_MONOTONIC, &now);
+   return ((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec);
+#endif
+}
+
+static void bench_keep (void *buf, void *arg)
+{
+}
+
+static int bench_split (const char *path, int rounds)
+{
+   _sip_msg_t *sip_msg;
+   char *msgs[1024];
+   size_t lens[1024];
+   char *data;
+   char *p;
+   char *e;
+   const char *clen;
+   size_t size;
+   size_t bytes = 0;
+   uint64_t start;
+   uint64_t cycles;
+   FILE *file;
+   int n = 0;
+   int i;
+   int r;
+   int bad = 0;
+
+   file = fopen (path, "r");
+   if (file == NULL)
+   {
+      perror (path);
+      return (1);
+   }
+   data = malloc (1 << 20);
+   size = fread (data, 1, (1 << 20) - 1, file);
+   fclose (file);
+   data[size] = '\0';
+   /* A message is its header and Content-Length bytes of body */
+   for (p = data; n < 1024 && (e = strstr (p, "\r\n\r\n")) != NULL; n++)
+   {
+      e += 4;
+      clen = strstr (p, "Content-Length:");
+      if (clen != NULL && clen < e)
+         e += atoi (clen + strlen ("Content-Length:"));
+      if (e > data + size)
+         e = data + size;
+      msgs[n] = p;
+      lens[n] = e - p;
+      for (p = e; *p == '\r' || *p == '\n'; p++)
+         ;
+   }
+   /* Build the header name hash as sip_stack_init() would */
+   if (sip_header_names_init () != 0)
+   {
+      printf ("sip_header_names_init failed\n");
+      free (data);
+      return (1);
+   }
+   start = bench_cycles ();
+   for (r = 0; r < rounds; r++)
+   {
+      for (i = 0; i < n; i++)
+      {
+         sip_msg = (_sip_msg_t *) sip_new_msg ();
+         sip_msg->sip_msg_buf = msgs[i];
+         sip_msg->sip_msg_len = lens[i];
+         sip_msg->sip_msg_borrowed = msgs[i];
+         sip_msg->sip_msg_release = bench_keep;
+         if (sip_setup_header_pointers (sip_msg) != 0)
+            bad++;
+         sip_free_msg ((sip_msg_t) sip_msg);
+         bytes += lens[i];
+      }
+   }
+   cycles = bench_cycles () - start;
+#if defined(__x86_64__) || defined(__i386__)
+   printf ("sip_setup_header_pointers: %d msgs x %d, %zu bytes, %.3f bytes/cycle\n", n, rounds, bytes,
+           (double) bytes / cycles);
+#else
+   printf ("sip_setup_header_pointers: %d msgs x %d, %zu bytes, %.3f bytes/ns\n", n, rounds, bytes,
+           (double) bytes / cycles);
+#endif
+   if (bad > 0)
+      printf ("%d failed\n", bad / rounds);
+   free (data);
+   return (0);
+}
+
+/*
+ * Behaviour checks: sip_test -t
+ * Each check drives the stack as a transport and ULP would and compares
+ * what comes out. The failed ones are reported, the exit status is the
+ * number of them.
+ */
+static int test_failed;
+static int test_recvd;
+static int test_sent;
+static boolean_t test_respond;
+static char test_last_sent[2048];
+static char test_callid[64];
+static char test_subject[64];
+
+static void test_check (boolean_t ok, const char *what)
+{
+   if (ok)
+      return;
+   printf ("FAIL: %s\n", what);
+   test_failed++;
+}
+
+static void test_copy (char *dst, size_t size, const sip_str_t * str)
+{
+   (void) snprintf (dst, size, "%.*s", str != NULL ? str->sip_str_len : 0, str != NULL ? str->sip_str_ptr : "");
+}
+
+static int test_send (const sip_conn_object_t obj, char *msg, int len)
+{
+   (void) snprintf (test_last_sent, sizeof (test_last_sent), "%.*s", len, msg);
+   test_sent++;
+   return (0);
+}
+
+static boolean_t test_stream (sip_conn_object_t obj)
+{
+   return (obj->stream);
+}
+
+static int test_transport (sip_conn_object_t obj)
+{
+   return (obj->stream ? IPPROTO_TCP : IPPROTO_UDP);
+}
+
+/* Keep what the checks look at, answer with a 180 if asked to */
+static void test_recv (const sip_conn_object_t obj, sip_msg_t msg, const sip_dialog_t dialog)
+{
+   sip_msg_t resp;
+
+   test_recvd++;
+   test_copy (test_callid, sizeof (test_callid), sip_get_callid (msg, NULL));
+   test_copy (test_subject, sizeof (test_subject), sip_get_subject (msg, NULL));
+   if (!test_respond)
+      return;
+   resp = sip_create_response (msg, SIP_RINGING, "Ringing", "t1", NULL);
+   if (resp == NULL)
+      return;
+   (void) sip_sendmsg (obj, resp, NULL, SIP_SEND_STATEFUL);
+   sip_free_msg (resp);
+}
+
+static int test_batches;
+static int test_batch_size;
+
+/* Each message of a batch as test_recv() would see it */
+static void test_recv_batch (const sip_conn_object_t obj, sip_msg_t * msgs, sip_dialog_t * dialogs, int n)
+{
+   int i;
+
+   test_batches++;
+   test_batch_size = n;
+   for (i = 0; i < n; i++)
+      test_recv (obj, msgs[i], dialogs[i]);
+}
+
+/* Parse a message the way the stack does on ingest, NULL if it can't */
+static _sip_msg_t *test_parse (char *buf)
+{
+   _sip_msg_t *sip_msg;
+
+   sip_msg = (_sip_msg_t *) sip_new_msg ();
+   if (sip_msg == NULL)
+      return (NULL);
+   sip_msg->sip_msg_buf = strdup (buf);
+   sip_msg->sip_msg_len = strlen (buf);
+   if (sip_msg->sip_msg_buf == NULL || sip_setup_header_pointers (sip_msg) != 0 ||
+       sip_parse_first_line (sip_msg->sip_msg_start_line, &sip_msg->sip_msg_req_res) != 0)
+   {
+      sip_free_msg ((sip_msg_t) sip_msg);
+      return (NULL);
+   }
+   return (sip_msg);
+}
+
+/*
+ * A TCP message split across reads is passed up once, when its last byte
+ * is in: first in three pieces, the last one carrying the start of the
+ * next message, then the rest of that one a byte at a time. The folded
+ * Subject comes up unfolded.
+ */
+static void test_tcp_split ()
+{
+   static char msgs[] =
+      "INVITE sip:bob@example.com SIP/2.0\r\n"
+      "Via: SIP/2.0/TCP 10.0.0.1:5060;branch=z9hG4bKtcp1\r\n"
+      "Max-Forwards: 70\r\n"
+      "From: <sip:alice@example.com>;tag=tcp1\r\n"
+      "To: <sip:bob@example.com>\r\n"
+      "Call-ID: tcp1@10.0.0.1\r\n"
+      "CSeq: 1 INVITE\r\n"
+      "Subject: hello\r\n\tworld\r\n"
+      "Content-Type: application/sdp\r\n"
+      "Content-Length: 4\r\n\r\n"
+      "v=0\n"
+      "OPTIONS sip:bob@example.com SIP/2.0\r\n"
+      "Via: SIP/2.0/TCP 10.0.0.1:5060;branch=z9hG4bKtcp2\r\n"
+      "Max-Forwards: 70\r\n"
+      "From: <sip:alice@example.com>;tag=tcp2\r\n"
+      "To: <sip:bob@example.com>\r\n"
+      "Call-ID: tcp2@10.0.0.1\r\n"
+      "CSeq: 1 OPTIONS\r\n"
+      "Content-Length: 0\r\n\r\n";
+   struct sip_conn_object conn = { NULL, B_TRUE };
+   char *second;
+   char *p;
+   size_t total = strlen (msgs);
+   int recvd = test_recvd;
+
+   if (sip_init_conn_object (&conn) != 0)
+   {
+      test_check (B_FALSE, "tcp: sip_init_conn_object");
+      return;
+   }
+   second = strstr (msgs, "OPTIONS");
+   /* Inside the header, inside the end of the header, then the body */
+   sip_process_new_packet (&conn, msgs, 40);
+   sip_process_new_packet (&conn, msgs + 40, strstr (msgs, "\r\n\r\n") + 2 - (msgs + 40));
+   test_check (test_recvd == recvd, "tcp: partial message passed up");
+   p = strstr (msgs, "\r\n\r\n") + 2;
+   sip_process_new_packet (&conn, p, second + 10 - p);
+   test_check (test_recvd == recvd + 1, "tcp: complete message not passed up");
+   test_check (strcmp (test_callid, "tcp1@10.0.0.1") == 0, "tcp: first Call-ID");
+   test_check (strncmp (test_subject, "hello", 5) == 0 && strchr (test_subject, '\n') == NULL &&
+               strcmp (test_subject + strlen (test_subject) - 5, "world") == 0, "tcp: folded Subject");
+   for (p = second + 10; p < msgs + total; p++)
+   {
+      test_check (test_recvd == recvd + 1, "tcp: byte at a time passed up early");
+      sip_process_new_packet (&conn, p, 1);
+   }
+   test_check (test_recvd == recvd + 2, "tcp: byte at a time not passed up");
+   test_check (strcmp (test_callid, "tcp2@10.0.0.1") == 0, "tcp: second Call-ID");
+   sip_conn_destroyed (&conn);
+}
+
+/*
+ * A retransmitted INVITE is absorbed by its server transaction, which
+ * sends the last response again; the ULP sees the request once.
+ */
+static void test_retransmit ()
+{
+   static char invite[] =
+      "INVITE sip:bob@example.com SIP/2.0\r\n"
+      "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bKretx1\r\n"
+      "Max-Forwards: 70\r\n"
+      "From: <sip:alice@example.com>;tag=retx1\r\n"
+      "To: <sip:bob@example.com>\r\n"
+      "Call-ID: retx1@10.0.0.1\r\n"
+      "CSeq: 1 INVITE\r\n"
+      "Content-Length: 0\r\n\r\n";
+   struct sip_conn_object conn = { NULL, B_FALSE };
+   char first[sizeof (test_last_sent)];
+   int recvd = test_recvd;
+   int sent = test_sent;
+
+   test_respond = B_TRUE;
+   sip_process_new_packet (&conn, invite, strlen (invite));
+   test_respond = B_FALSE;
+   test_check (test_recvd == recvd + 1, "retransmit: INVITE not passed up");
+   test_check (test_sent == sent + 1 && strncmp (test_last_sent, "SIP/2.0 180", 11) == 0,
+               "retransmit: 180 not sent");
+   (void) strcpy (first, test_last_sent);
+   sip_process_new_packet (&conn, invite, strlen (invite));
+   test_check (test_recvd == recvd + 1, "retransmit: retransmission passed up");
+   test_check (test_sent == sent + 2, "retransmit: last response not sent again");
+   test_check (strcmp (test_last_sent, first) == 0, "retransmit: a different response sent");
+}
+
+/* Via and Route values, several to a header and over several headers */
+/*
+ * The datagrams of a sip_process_new_packets() call come up in one
+ * sip_ulp_recv_batch() call, in order; a single one from
+ * sip_process_new_packet() still goes to sip_ulp_recv().
+ */
+static void test_batch ()
+{
+   struct sip_conn_object conn = { NULL, B_FALSE };
+   sip_packet_t pkts[3];
+   char msgs[3][512];
+   int batches = test_batches;
+   int recvd = test_recvd;
+   int i;
+
+   for (i = 0; i < 3; i++)
+   {
+      (void) snprintf (msgs[i], sizeof (msgs[i]),
+                       "OPTIONS sip:bob@example.com SIP/2.0\r\n"
+                       "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bKbatch%d\r\n"
+                       "Max-Forwards: 70\r\n"
+                       "From: <sip:alice@example.com>;tag=batch%d\r\n"
+                       "To: <sip:bob@example.com>\r\n"
+                       "Call-ID: batch%d@10.0.0.1\r\n"
+                       "CSeq: 1 OPTIONS\r\n"
+                       "Content-Length: 0\r\n\r\n", i, i, i);
+      pkts[i].sip_pkt_buf = msgs[i];
+      pkts[i].sip_pkt_len = strlen (msgs[i]);
+      pkts[i].sip_pkt_release = NULL;
+      pkts[i].sip_pkt_arg = NULL;
+   }
+   sip_process_new_packets (&conn, pkts, 2);
+   test_check (test_batches == batches + 1 && test_batch_size == 2, "batch: not passed up as one batch");
+   test_check (test_recvd == recvd + 2, "batch: messages missing");
+   test_check (strcmp (test_callid, "batch1@10.0.0.1") == 0, "batch: out of order");
+   sip_process_new_packet (&conn, pkts[2].sip_pkt_buf, pkts[2].sip_pkt_len);
+   test_check (test_batches == batches + 1 && test_recvd == recvd + 3, "batch: single message not passed up");
+}
+
+static void test_values ()
+{
+   static const char *hosts[] = { "a.example.com", "b.example.com", "c.example.com" };
+   static const char *routes[] = { "sip:p1.example.com;lr", "sip:p2.example.com;lr" };
+   _sip_msg_t *sip_msg;
+   const struct sip_header *hdr;
+   const struct sip_value *value;
+   char str[64];
+   int n;
+   int err;
+
+   sip_msg = test_parse ("INVITE sip:bob@example.com SIP/2.0\r\n"
+                         "Via: SIP/2.0/UDP a.example.com;branch=z9hG4bKv1, SIP/2.0/TCP b.example.com:5070"
+                         ";branch=z9hG4bKv2\r\n"
+                         "Via: SIP/2.0/UDP c.example.com;branch=z9hG4bKv3\r\n"
+                         "Route: <sip:p1.example.com;lr>, <sip:p2.example.com;lr>\r\n"
+                         "Max-Forwards: 70\r\n"
+                         "From: <sip:alice@example.com>;tag=v1\r\n"
+                         "To: <sip:bob@example.com>\r\n"
+                         "Call-ID: v1@10.0.0.1\r\n" "CSeq: 1 INVITE\r\n" "Content-Length: 0\r\n\r\n");
+   if (sip_msg == NULL)
+   {
+      test_check (B_FALSE, "values: message not parsed");
+      return;
+   }
+   n = 0;
+   for (hdr = sip_get_header ((sip_msg_t) sip_msg, SIP_VIA, NULL, &err); hdr != NULL;
+        hdr = sip_get_header ((sip_msg_t) sip_msg, SIP_VIA, (sip_header_t) hdr, &err))
+   {
+      for (value = sip_get_header_value (hdr, &err); value != NULL;
+           value = sip_get_next_value ((sip_header_value_t) value, &err))
+      {
+         test_copy (str, sizeof (str), sip_get_via_sent_by_host ((sip_header_value_t) value, &err));
+         test_check (n < 3 && strcmp (str, hosts[n]) == 0, "values: Via host");
+         if (n == 1)
+            test_check (sip_get_via_sent_by_port ((sip_header_value_t) value, &err) == 5070, "values: Via port");
+         n++;
+      }
+   }
+   test_check (n == 3, "values: Via count");
+   n = 0;
+   hdr = sip_get_header ((sip_msg_t) sip_msg, SIP_ROUTE, NULL, &err);
+   for (value = hdr != NULL ? sip_get_header_value (hdr, &err) : NULL; value != NULL;
+        value = sip_get_next_value ((sip_header_value_t) value, &err))
+   {
+      test_copy (str, sizeof (str), sip_get_route_uri_str ((sip_header_value_t) value, &err));
+      test_check (n < 2 && strcmp (str, routes[n]) == 0, "values: Route URI");
+      n++;
+   }
+   test_check (n == 2, "values: Route count");
+   sip_free_msg ((sip_msg_t) sip_msg);
+}
+
+/* The Request-URI is parsed on first use, a bad one is EPROTO then */
+static void test_request_uri ()
+{
+   _sip_msg_t *sip_msg;
+   const sip_str_t *uri;
+   int err;
+
+   sip_msg = test_parse ("INVITE sip:bob@[::1 SIP/2.0\r\n"
+                         "Via: SIP/2.0/UDP 10.0.0.1;branch=z9hG4bKruri1\r\n"
+                         "Max-Forwards: 70\r\n"
+                         "From: <sip:alice@example.com>;tag=ruri1\r\n"
+                         "To: <sip:bob@example.com>\r\n"
+                         "Call-ID: ruri1@10.0.0.1\r\n" "CSeq: 1 INVITE\r\n" "Content-Length: 0\r\n\r\n");
+   if (sip_msg == NULL)
+   {
+      test_check (B_FALSE, "request uri: message not parsed");
+      return;
+   }
+   uri = sip_get_request_uri_str ((sip_msg_t) sip_msg, &err);
+   test_check (uri != NULL && err == EPROTO, "request uri: bad URI not EPROTO");
+   uri = sip_get_request_uri_str ((sip_msg_t) sip_msg, &err);
+   test_check (uri != NULL && err == EPROTO, "request uri: bad URI not EPROTO again");
+   sip_free_msg ((sip_msg_t) sip_msg);
+}
+
+static int test (void)
+{
+   sip_io_pointers_t io = { test_send, bench_hold, bench_rele, test_stream, test_stream,
+      bench_addr, bench_addr, test_transport };
+   sip_ulp_pointers_t ulp = { test_recv };
+   sip_stack_init_t init = { SIP_STACK_VERSION, 0, &io, &ulp };
+
+   init.sip_ulp_recv_batch = test_recv_batch;
+   if (sip_stack_init (&init) != 0)
+   {
+      printf ("sip_stack_init failed\n");
+      return (1);
+   }
+   test_tcp_split ();
+   test_retransmit ();
+   test_batch ();
+   test_values ();
+   test_request_uri ();
+   printf ("%d failed\n", test_failed);
+   return (test_failed);
+}
+
 int main (int argc, char *argv[])
 {
    FILE *file;
@@ -47,6 +772,16 @@ int main (int argc, char *argv[])
    char *buffer, *ptr; 
    sip_msg_t sip_msg;
 
+   if (argc > 1 && strcmp (argv[1], "-b") == 0)
+      return (bench (argc > 2 ? atoi (argv[2]) : 100000, argc > 3 ? atoi (argv[3]) : 0,
+                     argc > 4 ? atoi (argv[4]) : 0));
+   if (argc > 1 && strcmp (argv[1], "-d") == 0)
+      return (bench_dialogs (argc > 2 ? atoi (argv[2]) : 200000, argc > 3 ? atoi (argv[3]) : 100000));
+   if (argc > 1 && strcmp (argv[1], "-s") == 0)
+      return (bench_split (argc > 2 ? argv[2] : "sip_msgs.txt", argc > 3 ? atoi (argv[3]) : 10000));
+   if (argc > 1 && strcmp (argv[1], "-t") == 0)
+      return (test ());
+
    if (argc > 0)
    {
       int body = 0;
@@ -25,142 +25,789 @@
  */
 
 /*
- * Simple implementation of timeout functionality. The granuality is a sec
+ * Implementation of timeout functionality using a hierarchical timing
+ * wheel. The granularity is a msec. Adding and removing a timeout is
+ * constant time.
+ *
+ * The wheel is split into SIP_TIMEOUT_SHARDS shards, each with its own
+ * lock, slots and pool of free timeouts. A timeout is armed on the shard
+ * picked from its arg and stays with it, its id leads back to it, so
+ * arming and cancelling only lock one shard and threads arming timeouts
+ * for different objects mostly don't contend. The timer thread runs the
+ * shards one after the other.
+ *
+ * Level 0 has a slot per msec for the next SIP_WHEEL_L0_SZ msecs, each
+ * higher level has SIP_WHEEL_LN_SZ slots covering SIP_WHEEL_LN_SZ times
+ * the span of a slot of the level below. When level 0 wraps around, the
+ * next slot of level 1 is cascaded, i.e. its timeouts are re-added and
+ * so land in level 0; the same goes for the higher levels. With the
+ * sizes below, level 1 covers up to ~16 secs (Timer A/E/G backoff, T4),
+ * level 2 up to ~17 mins (Timer B/F/H/J at 64*T1, Timer D); timeouts
+ * further out than level 3 can hold are parked in its furthest slot and
+ * re-added when it is cascaded.
+ *
+ * Timeouts are taken from a pool that grows in chunks and is never freed,
+ * a chunk belongs to the shard that grew it. The id handed out is the
+ * index of the timeout in the pool plus a generation number that changes
+ * every time the timeout is reused, so cancelling is a direct lookup and
+ * a stale id (of a timeout that has already fired or been cancelled)
+ * doesn't match, within the bound given below.
+ *
+ * The callbacks of the timeouts that fire are run by a fixed set of
+ * worker threads. The timer thread hands each timeout to a worker over
+ * a lock free queue, picking the worker from the object the timeout is
+ * for (see sip_timeout_affinity()), so that the timeouts of one object,
+ * e.g. Timer A and Timer B of a transaction, always run on the same
+ * worker, one after the other. A timeout that has fired can still be
+ * cancelled until its worker gets to it.
+ *
+ * Time is CLOCK_MONOTONIC msecs, read once per tick; new timeouts are
+ * armed relative to the time of the last tick. Ticks are at most
+ * SIP_TIMEOUT_TICK apart while timeouts are pending, so that time is
+ * never more than that behind. Instead of the timer thread, the ULP can
+ * drive the wheel from its own event loop: it polls sip_timer_fd() and
+ * calls sip_timer_process() when it is readable (or when the time it
+ * returned has passed).
+ *
+ * The ULP can also supply the clock (sip_timer_clock). It is read when
+ * each timeout is armed, so there is no tick of slack. With
+ * sip_virtual_clock() time only moves by sip_virtual_clock_advance(),
+ * so long timers can be run through at CPU speed and in a repeatable
+ * order; the timer thread then sleeps until the clock is advanced.
  */
 #include <stdio.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/errno.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#ifdef	__linux__
+#include <sys/timerfd.h>
+#endif
 
 #include "sip_miscdefs.h"
 
 uint_t sip_timeout (void *arg, void (*callback_func) (void *), struct timeval * timeout_time);
 boolean_t sip_untimeout (uint_t);
 
+#define	SIP_WHEEL_L0_BITS	8
+#define	SIP_WHEEL_L0_SZ		(1 << SIP_WHEEL_L0_BITS)
+#define	SIP_WHEEL_LN_BITS	6
+#define	SIP_WHEEL_LN_SZ		(1 << SIP_WHEEL_LN_BITS)
+#define	SIP_WHEEL_LEVELS	4
+
+/* Bits of the expiry time below the slot index of a level */
+#define	SIP_WHEEL_SHIFT(level)						\
+	((level) == 0 ? 0 : SIP_WHEEL_L0_BITS + ((level) - 1) * SIP_WHEEL_LN_BITS)
+
+/* Furthest a timeout can be from now and still be placed exactly */
+#define	SIP_WHEEL_MAX_DELTA						\
+	((hrtime_t) 1 << SIP_WHEEL_SHIFT(SIP_WHEEL_LEVELS))
+
+/*
+ * A timeout id is (generation << SIP_TIMEOUT_SLOT_BITS | index), so the
+ * pool holds up to 16M timeouts, ten times the ~1.6M Completed
+ * transactions of 50k calls/sec with a 32 sec Timer D/J. The generation
+ * is 8 bits: a stale id is mistaken for a newer one only once the same
+ * timeout has been reused 255 times. Free timeouts are reused oldest
+ * first and a shard grows its pool rather than let fewer than its share
+ * of SIP_TIMEOUT_RESERVE be free, so that takes over 16M other timeouts
+ * being armed, more than a minute at 50k calls/sec; the stack lets go
+ * of a timer id well before (it is held by a transaction or dialog).
+ */
+#define	SIP_TIMEOUT_SLOT_BITS	24
+#define	SIP_TIMEOUT_MAX		(1 << SIP_TIMEOUT_SLOT_BITS)
+#define	SIP_TIMEOUT_GEN_MASK	((1U << (32 - SIP_TIMEOUT_SLOT_BITS)) - 1)
+#define	SIP_TIMEOUT_CHUNK_BITS	12
+#define	SIP_TIMEOUT_CHUNK_SZ	(1 << SIP_TIMEOUT_CHUNK_BITS)
+#define	SIP_TIMEOUT_NCHUNKS	(SIP_TIMEOUT_MAX / SIP_TIMEOUT_CHUNK_SZ)
+#define	SIP_TIMEOUT_RESERVE	(16 * SIP_TIMEOUT_CHUNK_SZ)
+
+#define	SIP_TIMEOUT_SHARD_BITS	3
+#define	SIP_TIMEOUT_SHARDS	(1 << SIP_TIMEOUT_SHARD_BITS)
+
+#define	SIP_TIMEOUT_ID(timeout)						\
+	((uint_t)(timeout)->sip_timeout_gen << SIP_TIMEOUT_SLOT_BITS |	\
+	(timeout)->sip_timeout_index)
+
+/* State of a timeout in the pool */
+#define	SIP_TIMEOUT_FREE	0
+#define	SIP_TIMEOUT_ARMED	1       /* on the wheel */
+#define	SIP_TIMEOUT_FIRED	2       /* queued to a worker */
+#define	SIP_TIMEOUT_RUNNING	3       /* callback taken by the worker */
+#define	SIP_TIMEOUT_CANCELLED	4       /* cancelled while queued */
+
+/* Callback threads */
+#define	SIP_TIMEOUT_THREADS	4
+#define	SIP_TIMEOUT_MAX_THREADS	64
+
+/* Longest the wheel goes without a tick while timeouts are pending */
+#define	SIP_TIMEOUT_TICK	10
+
+/* Timeouts a worker runs before giving them back to the pool */
+#define	SIP_TIMEOUT_BATCH	32
+
+/* Callbacks whose timeouts are spread by the object they are for */
+#define	SIP_TIMEOUT_MAX_AFFINITY	4
+
+/* Circular doubly linked list */
+typedef struct sip_timeout_list_s
+{
+   struct sip_timeout_list_s *sip_list_next;
+   struct sip_timeout_list_s *sip_list_prev;
+} sip_timeout_list_t;
+
 typedef struct timeout
 {
-   struct timeout *sip_timeout_next;
-   hrtime_t sip_timeout_val;
+   sip_timeout_list_t sip_timeout_link;        /* wheel slot */
+   struct timeout *sip_timeout_free_next;
+   struct timeout *sip_timeout_qnext;   /* worker queue */
+   hrtime_t sip_timeout_val;    /* expiry, msecs */
    void (*sip_timeout_callback_func) (void *);
    void *sip_timeout_callback_func_arg;
-   int sip_timeout_id;
+   uint_t sip_timeout_index;    /* in the pool */
+   uint_t sip_timeout_gen;
+   int sip_timeout_state;
+   int sip_timeout_shard;       /* it belongs to */
 } sip_timeout_t;
 
+/* A shard of the wheel, sip_shard_wheel_now is the last msec it has run */
+typedef struct sip_timeout_shard_s
+{
+   pthread_mutex_t sip_shard_mutex;
+   sip_timeout_list_t sip_shard_l0[SIP_WHEEL_L0_SZ];
+   sip_timeout_list_t sip_shard_ln[SIP_WHEEL_LEVELS - 1][SIP_WHEEL_LN_SZ];
+   hrtime_t sip_shard_wheel_now;
+   int sip_shard_count;         /* armed */
+   /* Free timeouts are taken from the head and put at the tail */
+   sip_timeout_t *sip_shard_free_head;
+   sip_timeout_t *sip_shard_free_tail;
+   int sip_shard_nfree;
+} sip_timeout_shard_t;
+
+/*
+ * A callback thread. Its queue is an intrusive MPSC queue: producers
+ * swap themselves in at the tail, the worker takes from the head. The
+ * stub keeps the queue from ever being empty so that neither end has to
+ * check for the other.
+ */
+typedef struct sip_timeout_worker_s
+{
+   sip_timeout_t *sip_worker_head;      /* worker end */
+   sip_timeout_t *sip_worker_tail;      /* producer end */
+   sip_timeout_t sip_worker_stub;
+   int sip_worker_pending;      /* queued or being queued */
+   int sip_worker_sleeping;
+   pthread_mutex_t sip_worker_mutex;
+   pthread_cond_t sip_worker_cv;
+   pthread_t sip_worker_thread;
+} sip_timeout_worker_t;
+
+typedef struct sip_timeout_affinity_s
+{
+   void (*sip_affinity_func) (void *);
+   void *(*sip_affinity_key) (void *);
+} sip_timeout_affinity_t;
+
+/*
+ * Held by the timer thread (or sip_timer_process()) while it runs the
+ * wheel, and to wake it up. Taken before a shard lock.
+ */
 static pthread_mutex_t timeout_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t timeout_cond_var = PTHREAD_COND_INITIALIZER;
-static sip_timeout_t *timeout_list;
-static sip_timeout_t *timeout_current_start;
-static sip_timeout_t *timeout_current_end;
+
+static sip_timeout_shard_t timeout_shards[SIP_TIMEOUT_SHARDS];
+
+/* The callback threads */
+static sip_timeout_worker_t *timeout_workers;
+static int timeout_nworkers;
+static sip_timeout_affinity_t timeout_affinity[SIP_TIMEOUT_MAX_AFFINITY];
+static int timeout_naffinity;
 
 /*
- * LONG_SLEEP_TIME = (24 * 60 * 60 * NANOSEC)
+ * When the timer thread (or sip_timer_process()) will next run, LLONG_MAX
+ * while it runs the wheel
  */
-#define	LONG_SLEEP_TIME	(0x15180LL * 0x3B9ACA00LL)
+static hrtime_t timeout_wakeup;
 
-uint_t timer_id = 0;
+/* The time of the last tick, new timeouts are armed from it */
+static hrtime_t timeout_now;
 
-/* Invoke the callback function */
-/* ARGSUSED */
-static void *sip_run_to_functions (void *arg)
+/*
+ * Driven by sip_timer_process() rather than the timer thread, through
+ * timeout_fd on linux. With no worker threads the callbacks are run by
+ * sip_timer_process() too, from the single worker queue.
+ */
+static boolean_t timeout_external = B_FALSE;
+static boolean_t timeout_inline = B_FALSE;
+static int timeout_fd = -1;
+
+/* Set up by sip_timeout_init(), the threads exit when stop is set */
+static boolean_t timeout_initialized = B_FALSE;
+static boolean_t timeout_stop = B_FALSE;
+static pthread_t timeout_thread;
+
+/* The ULP clock, NULL for CLOCK_MONOTONIC */
+static uint64_t (*timeout_clock) (void);
+
+/* The time of sip_virtual_clock() */
+static uint64_t timeout_virtual_now;
+
+/* The pool, chunks are numbered in the order they are taken */
+static sip_timeout_t *timeout_chunks[SIP_TIMEOUT_NCHUNKS];
+static int timeout_nchunks;
+
+/*
+ * LONG_SLEEP_TIME = (24 * 60 * 60 * MILLISEC)
+ */
+#define	LONG_SLEEP_TIME	(0x15180LL * 0x3E8LL)
+
+#define	SIP_LIST_INIT(list) {						\
+	(list)->sip_list_next = (list);					\
+	(list)->sip_list_prev = (list);					\
+}
+
+#define	SIP_LIST_EMPTY(list)	((list)->sip_list_next == (list))
+
+#define	SIP_LIST_INSERT_TAIL(list, elem) {				\
+	(elem)->sip_list_prev = (list)->sip_list_prev;			\
+	(elem)->sip_list_next = (list);					\
+	(list)->sip_list_prev->sip_list_next = (elem);			\
+	(list)->sip_list_prev = (elem);					\
+}
+
+#define	SIP_LIST_REMOVE(elem) {						\
+	(elem)->sip_list_prev->sip_list_next = (elem)->sip_list_next;	\
+	(elem)->sip_list_next->sip_list_prev = (elem)->sip_list_prev;	\
+	(elem)->sip_list_next = (elem)->sip_list_prev = (elem);		\
+}
+
+/* Current time in msecs, on the system clock */
+static hrtime_t sip_timeout_real_now ()
 {
-   sip_timeout_t *timeout = NULL;
+#ifdef	__linux__
+   struct timespec tspec;
 
-   (void) pthread_mutex_lock (&timeout_mutex);
-   while (timeout_current_start != NULL)
+   if (clock_gettime (CLOCK_MONOTONIC, &tspec) != 0)
+      return (__atomic_load_n (&timeout_now, __ATOMIC_RELAXED));
+   return ((hrtime_t) tspec.tv_sec * MILLISEC + tspec.tv_nsec / MICROSEC);
+#else
+   return (gethrtime () / MICROSEC);
+#endif
+}
+
+/* Current time in msecs */
+static hrtime_t sip_timeout_now ()
+{
+   if (timeout_clock != NULL)
+      return ((hrtime_t) timeout_clock ());
+   return (sip_timeout_real_now ());
+}
+
+/* Move timeout_now up to now, it never goes back */
+static void sip_timeout_advance (hrtime_t now)
+{
+   hrtime_t prev = __atomic_load_n (&timeout_now, __ATOMIC_RELAXED);
+
+   while (now > prev && !__atomic_compare_exchange_n (&timeout_now, &prev, now, B_TRUE,
+                                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      ;
+}
+
+/* The shard the timeouts for arg are armed on */
+static sip_timeout_shard_t *sip_timeout_shard (void *arg)
+{
+   uint64_t hash = ((uint64_t) (uintptr_t) arg >> 4) * 0x9E3779B97F4A7C15ULL;
+
+   return (&timeout_shards[hash >> (64 - SIP_TIMEOUT_SHARD_BITS)]);
+}
+
+/* Add a chunk of free timeouts to the shard, which is locked */
+static int sip_timeout_grow (sip_timeout_shard_t * shard)
+{
+   sip_timeout_t *chunk;
+   int nchunk;
+   int index;
+
+   if (__atomic_load_n (&timeout_nchunks, __ATOMIC_RELAXED) >= SIP_TIMEOUT_NCHUNKS)
+      return (ENOMEM);
+   nchunk = __atomic_fetch_add (&timeout_nchunks, 1, __ATOMIC_RELAXED);
+   if (nchunk >= SIP_TIMEOUT_NCHUNKS)
+      return (ENOMEM);
+   chunk = calloc (SIP_TIMEOUT_CHUNK_SZ, sizeof (sip_timeout_t));
+   if (chunk == NULL)
+      return (ENOMEM);
+   for (index = 0; index < SIP_TIMEOUT_CHUNK_SZ; index++)
    {
-      timeout = timeout_current_start;
-      if (timeout_current_end == timeout_current_start)
-         timeout_current_start = timeout_current_end = NULL;
-      else
-         timeout_current_start = timeout->sip_timeout_next;
-      (void) pthread_mutex_unlock (&timeout_mutex);
-      timeout->sip_timeout_callback_func (timeout->sip_timeout_callback_func_arg);
-      free (timeout);
-      (void) pthread_mutex_lock (&timeout_mutex);
+      chunk[index].sip_timeout_index = nchunk * SIP_TIMEOUT_CHUNK_SZ + index;
+      chunk[index].sip_timeout_gen = 1;
+      chunk[index].sip_timeout_state = SIP_TIMEOUT_FREE;
+      chunk[index].sip_timeout_shard = shard - timeout_shards;
+      chunk[index].sip_timeout_free_next = index + 1 < SIP_TIMEOUT_CHUNK_SZ ? &chunk[index + 1] : NULL;
    }
-   (void) pthread_mutex_unlock (&timeout_mutex);
-   pthread_exit (NULL);
-   return ((void *) 0);
+   if (shard->sip_shard_free_tail == NULL)
+      shard->sip_shard_free_head = chunk;
+   else
+      shard->sip_shard_free_tail->sip_timeout_free_next = chunk;
+   shard->sip_shard_free_tail = &chunk[SIP_TIMEOUT_CHUNK_SZ - 1];
+   shard->sip_shard_nfree += SIP_TIMEOUT_CHUNK_SZ;
+   /* sip_untimeout() looks the chunk up without the shard lock */
+   __atomic_store_n (&timeout_chunks[nchunk], chunk, __ATOMIC_RELEASE);
+   return (0);
 }
 
 /*
- * In the very very unlikely case timer id wraps around and we have two timers
- * with the same id. If that happens timer with the least amount of time left
- * will be deleted. In case both timers have same time left than the one that
- * was scheduled first will be deleted as it will be in the front of the list.
+ * Take a free timeout from the shard, growing its pool while less than
+ * its share of SIP_TIMEOUT_RESERVE is free. Once the pool can't grow, the
+ * reserve is used.
  */
-boolean_t sip_untimeout (uint_t id)
+static sip_timeout_t *sip_timeout_get (sip_timeout_shard_t * shard)
 {
-   boolean_t ret = B_FALSE;
-   sip_timeout_t *current, *last;
+   sip_timeout_t *timeout;
 
-   last = NULL;
-   (void) pthread_mutex_lock (&timeout_mutex);
+   if (shard->sip_shard_nfree < SIP_TIMEOUT_RESERVE / SIP_TIMEOUT_SHARDS && sip_timeout_grow (shard) != 0 &&
+       shard->sip_shard_free_head == NULL)
+   {
+      return (NULL);
+   }
+   timeout = shard->sip_shard_free_head;
+   shard->sip_shard_free_head = timeout->sip_timeout_free_next;
+   if (shard->sip_shard_free_head == NULL)
+      shard->sip_shard_free_tail = NULL;
+   shard->sip_shard_nfree--;
+   timeout->sip_timeout_free_next = NULL;
+   return (timeout);
+}
+
+/* Return a timeout to its shard, which is locked; its id is no longer valid */
+static void sip_timeout_put (sip_timeout_shard_t * shard, sip_timeout_t * timeout)
+{
+   timeout->sip_timeout_state = SIP_TIMEOUT_FREE;
+   timeout->sip_timeout_callback_func = NULL;
+   timeout->sip_timeout_callback_func_arg = NULL;
+   /* Generation 0 is never used so that no id is 0 */
+   timeout->sip_timeout_gen = (timeout->sip_timeout_gen + 1) & SIP_TIMEOUT_GEN_MASK;
+   if (timeout->sip_timeout_gen == 0)
+      timeout->sip_timeout_gen = 1;
+   if (shard->sip_shard_free_tail == NULL)
+      shard->sip_shard_free_head = timeout;
+   else
+      shard->sip_shard_free_tail->sip_timeout_free_next = timeout;
+   shard->sip_shard_free_tail = timeout;
+   shard->sip_shard_nfree++;
+}
+
+/* The timeout in the pool an id is for, NULL if there is none */
+static sip_timeout_t *sip_timeout_slot (uint_t id)
+{
+   sip_timeout_t *chunk;
+   uint_t index = id & (SIP_TIMEOUT_MAX - 1);
+
+   chunk = __atomic_load_n (&timeout_chunks[index >> SIP_TIMEOUT_CHUNK_BITS], __ATOMIC_ACQUIRE);
+   if (chunk == NULL)
+      return (NULL);
+   return (&chunk[index & (SIP_TIMEOUT_CHUNK_SZ - 1)]);
+}
+
+/* Whether the timeout is still the one of the id, its shard is locked */
+static boolean_t sip_timeout_match (sip_timeout_t * timeout, uint_t id)
+{
+   return (__atomic_load_n (&timeout->sip_timeout_state, __ATOMIC_RELAXED) != SIP_TIMEOUT_FREE &&
+           timeout->sip_timeout_gen == id >> SIP_TIMEOUT_SLOT_BITS);
+}
+
+/* Link a timeout in at the tail of a worker queue */
+static void sip_worker_enqueue (sip_timeout_worker_t * worker, sip_timeout_t * timeout)
+{
+   sip_timeout_t *prev;
+
+   timeout->sip_timeout_qnext = NULL;
+   prev = __atomic_exchange_n (&worker->sip_worker_tail, timeout, __ATOMIC_ACQ_REL);
+   __atomic_store_n (&prev->sip_timeout_qnext, timeout, __ATOMIC_RELEASE);
+}
+
+/*
+ * Take a timeout from the head of the worker queue, only ever called by
+ * the worker. Returns NULL if the queue is empty or a producer has not
+ * finished linking its timeout in yet.
+ */
+static sip_timeout_t *sip_worker_dequeue (sip_timeout_worker_t * worker)
+{
+   sip_timeout_t *stub = &worker->sip_worker_stub;
+   sip_timeout_t *head = worker->sip_worker_head;
+   sip_timeout_t *next;
+
+   next = __atomic_load_n (&head->sip_timeout_qnext, __ATOMIC_ACQUIRE);
+   if (head == stub)
+   {
+      if (next == NULL)
+         return (NULL);
+      worker->sip_worker_head = next;
+      head = next;
+      next = __atomic_load_n (&head->sip_timeout_qnext, __ATOMIC_ACQUIRE);
+   }
+   if (next != NULL)
+   {
+      worker->sip_worker_head = next;
+      return (head);
+   }
+   if (head != __atomic_load_n (&worker->sip_worker_tail, __ATOMIC_ACQUIRE))
+      return (NULL);
+   /* head is the last one, put the stub behind it so it can be taken */
+   sip_worker_enqueue (worker, stub);
+   next = __atomic_load_n (&head->sip_timeout_qnext, __ATOMIC_ACQUIRE);
+   if (next == NULL)
+      return (NULL);
+   worker->sip_worker_head = next;
+   return (head);
+}
+
+/* Hand a timeout that has fired to a worker, waking it up if it sleeps */
+static void sip_worker_push (sip_timeout_worker_t * worker, sip_timeout_t * timeout)
+{
+   (void) __atomic_add_fetch (&worker->sip_worker_pending, 1, __ATOMIC_SEQ_CST);
+   sip_worker_enqueue (worker, timeout);
+   if (__atomic_load_n (&worker->sip_worker_sleeping, __ATOMIC_SEQ_CST))
+   {
+      (void) pthread_mutex_lock (&worker->sip_worker_mutex);
+      __atomic_store_n (&worker->sip_worker_sleeping, 0, __ATOMIC_RELAXED);
+      (void) pthread_cond_signal (&worker->sip_worker_cv);
+      (void) pthread_mutex_unlock (&worker->sip_worker_mutex);
+   }
+}
+
+/* The worker the callback of a timeout runs on */
+static sip_timeout_worker_t *sip_worker_pick (sip_timeout_t * timeout)
+{
+   void *key = timeout->sip_timeout_callback_func_arg;
+   uint64_t hash;
+   int index;
 
-   /* Check if this is in the to-be run list */
-   if (timeout_current_start != NULL)
+   for (index = 0; index < timeout_naffinity; index++)
    {
-      current = timeout_current_start;
-      while (current != NULL)
+      if (timeout_affinity[index].sip_affinity_func == timeout->sip_timeout_callback_func)
       {
-         if (current->sip_timeout_id == id)
-         {
-            if (current == timeout_current_start)
-            {
-               timeout_current_start = current->sip_timeout_next;
-            }
-            else
-            {
-               last->sip_timeout_next = current->sip_timeout_next;
-            }
-            if (current == timeout_current_end)
-               timeout_current_end = last;
-            if (current->sip_timeout_callback_func_arg != NULL)
-            {
-               free (current->sip_timeout_callback_func_arg);
-               current->sip_timeout_callback_func_arg = NULL;
-            }
-            free (current);
-            ret = B_TRUE;
-            break;
-         }
-         last = current;
-         current = current->sip_timeout_next;
+         key = timeout_affinity[index].sip_affinity_key (key);
+         break;
       }
    }
+   hash = ((uint64_t) (uintptr_t) key >> 4) * 0x9E3779B97F4A7C15ULL;
+   return (&timeout_workers[(hash >> 32) % timeout_nworkers]);
+}
 
-   /* Check if this is in the to-be scheduled list */
-   if (!ret && timeout_list != NULL)
+/* Put the timeout in its slot of the shard, relative to its wheel now */
+static void sip_wheel_add (sip_timeout_shard_t * shard, sip_timeout_t * timeout)
+{
+   hrtime_t expiry = timeout->sip_timeout_val;
+   hrtime_t delta;
+   sip_timeout_list_t *slot;
+   int level;
+
+   delta = expiry - shard->sip_shard_wheel_now;
+   if (delta <= 0)
+   {
+      /* Already due, run it on the next tick */
+      expiry = shard->sip_shard_wheel_now + 1;
+      delta = 1;
+   }
+   else if (delta >= SIP_WHEEL_MAX_DELTA)
    {
-      last = NULL;
-      current = timeout_list;
-      while (current != NULL)
+      /* Park it, it will be re-added when the slot is cascaded */
+      expiry = shard->sip_shard_wheel_now + SIP_WHEEL_MAX_DELTA - 1;
+      delta = SIP_WHEEL_MAX_DELTA - 1;
+   }
+   if (delta < SIP_WHEEL_L0_SZ)
+   {
+      slot = &shard->sip_shard_l0[expiry & (SIP_WHEEL_L0_SZ - 1)];
+   }
+   else
+   {
+      for (level = 1; delta >= ((hrtime_t) 1 << SIP_WHEEL_SHIFT (level + 1)); level++)
+         ;
+      slot = &shard->sip_shard_ln[level - 1][(expiry >> SIP_WHEEL_SHIFT (level)) & (SIP_WHEEL_LN_SZ - 1)];
+   }
+   SIP_LIST_INSERT_TAIL (slot, &timeout->sip_timeout_link);
+}
+
+/* Re-add all the timeouts in a slot of a higher level of the shard */
+static void sip_wheel_cascade (sip_timeout_shard_t * shard, sip_timeout_list_t * slot)
+{
+   sip_timeout_list_t list;
+   sip_timeout_list_t *elem;
+
+   if (SIP_LIST_EMPTY (slot))
+      return;
+   /* Detach the slot, sip_wheel_add() may put timeouts back into it */
+   list.sip_list_next = slot->sip_list_next;
+   list.sip_list_prev = slot->sip_list_prev;
+   list.sip_list_next->sip_list_prev = &list;
+   list.sip_list_prev->sip_list_next = &list;
+   SIP_LIST_INIT (slot);
+   while (!SIP_LIST_EMPTY (&list))
+   {
+      elem = list.sip_list_next;
+      SIP_LIST_REMOVE (elem);
+      sip_wheel_add (shard, (sip_timeout_t *) elem);
+   }
+}
+
+/*
+ * Advance the shard by a msec, cascading the higher levels as needed and
+ * handing the timeouts that are due to the workers.
+ */
+static void sip_wheel_tick (sip_timeout_shard_t * shard)
+{
+   sip_timeout_list_t *slot;
+   sip_timeout_list_t *elem;
+   sip_timeout_t *timeout;
+   hrtime_t now;
+   int level;
+   int index;
+
+   now = ++shard->sip_shard_wheel_now;
+   for (level = 1; level < SIP_WHEEL_LEVELS; level++)
+   {
+      if ((now & (((hrtime_t) 1 << SIP_WHEEL_SHIFT (level)) - 1)) != 0)
+         break;
+      index = (now >> SIP_WHEEL_SHIFT (level)) & (SIP_WHEEL_LN_SZ - 1);
+      sip_wheel_cascade (shard, &shard->sip_shard_ln[level - 1][index]);
+   }
+   slot = &shard->sip_shard_l0[now & (SIP_WHEEL_L0_SZ - 1)];
+   while (!SIP_LIST_EMPTY (slot))
+   {
+      elem = slot->sip_list_next;
+      SIP_LIST_REMOVE (elem);
+      timeout = (sip_timeout_t *) elem;
+      __atomic_store_n (&timeout->sip_timeout_state, SIP_TIMEOUT_FIRED, __ATOMIC_RELAXED);
+      shard->sip_shard_count--;
+      sip_worker_push (sip_worker_pick (timeout), timeout);
+   }
+}
+
+/*
+ * The next msec the timer thread needs to run the shard at: the next non
+ * empty slot in level 0 or, failing that, the next cascade.
+ */
+static hrtime_t sip_wheel_next (sip_timeout_shard_t * shard)
+{
+   hrtime_t next;
+
+   if (shard->sip_shard_count == 0)
+      return (shard->sip_shard_wheel_now + LONG_SLEEP_TIME);
+   for (next = shard->sip_shard_wheel_now + 1;; next++)
+   {
+      if (!SIP_LIST_EMPTY (&shard->sip_shard_l0[next & (SIP_WHEEL_L0_SZ - 1)]) ||
+          (next & (SIP_WHEEL_L0_SZ - 1)) == 0)
+      {
+         return (next);
+      }
+   }
+}
+
+/* Give the timeouts a worker is done with back to their shards */
+static void sip_worker_put_list (sip_timeout_t * done)
+{
+   sip_timeout_shard_t *locked = NULL;
+   sip_timeout_shard_t *shard;
+   sip_timeout_t *next;
+
+   while (done != NULL)
+   {
+      next = done->sip_timeout_qnext;
+      shard = &timeout_shards[done->sip_timeout_shard];
+      if (shard != locked)
+      {
+         if (locked != NULL)
+            (void) pthread_mutex_unlock (&locked->sip_shard_mutex);
+         (void) pthread_mutex_lock (&shard->sip_shard_mutex);
+         locked = shard;
+      }
+      sip_timeout_put (shard, done);
+      done = next;
+   }
+   if (locked != NULL)
+      (void) pthread_mutex_unlock (&locked->sip_shard_mutex);
+}
+
+/* Sleep until a timeout is pushed to the worker */
+static void sip_worker_wait (sip_timeout_worker_t * worker)
+{
+   /* A push is half way through, it won't be long */
+   if (__atomic_load_n (&worker->sip_worker_pending, __ATOMIC_SEQ_CST) > 0)
+   {
+      (void) sched_yield ();
+      return;
+   }
+   __atomic_store_n (&worker->sip_worker_sleeping, 1, __ATOMIC_SEQ_CST);
+   if (__atomic_load_n (&worker->sip_worker_pending, __ATOMIC_SEQ_CST) > 0 ||
+       __atomic_load_n (&timeout_stop, __ATOMIC_SEQ_CST))
+   {
+      __atomic_store_n (&worker->sip_worker_sleeping, 0, __ATOMIC_RELAXED);
+      return;
+   }
+   (void) pthread_mutex_lock (&worker->sip_worker_mutex);
+   while (__atomic_load_n (&worker->sip_worker_sleeping, __ATOMIC_RELAXED))
+      (void) pthread_cond_wait (&worker->sip_worker_cv, &worker->sip_worker_mutex);
+   (void) pthread_mutex_unlock (&worker->sip_worker_mutex);
+}
+
+/*
+ * Invoke the callback functions of the timeouts pushed to the worker in
+ * order. Returns once the queue is empty unless block is set, then only
+ * once it is empty and the threads are being stopped.
+ */
+static void sip_worker_run (sip_timeout_worker_t * worker, boolean_t block)
+{
+   sip_timeout_t *timeout;
+   sip_timeout_t *done = NULL;
+   int ndone = 0;
+   int state;
+
+   for (;;)
+   {
+      timeout = sip_worker_dequeue (worker);
+      if (timeout == NULL)
       {
-         if (current->sip_timeout_id == id)
+         if (done != NULL)
+         {
+            sip_worker_put_list (done);
+            done = NULL;
+            ndone = 0;
+         }
+         else if (!block)
+         {
+            if (__atomic_load_n (&worker->sip_worker_pending, __ATOMIC_SEQ_CST) == 0)
+               return;
+            (void) sched_yield ();
+         }
+         else if (__atomic_load_n (&timeout_stop, __ATOMIC_SEQ_CST))
+         {
+            return;
+         }
+         else
          {
-            if (current == timeout_list)
-            {
-               timeout_list = current->sip_timeout_next;
-            }
-            else
-            {
-               last->sip_timeout_next = current->sip_timeout_next;
-            }
-            if (current->sip_timeout_callback_func_arg != NULL)
-            {
-               free (current->sip_timeout_callback_func_arg);
-               current->sip_timeout_callback_func_arg = NULL;
-            }
-            free (current);
-            ret = B_TRUE;
-            break;
+            sip_worker_wait (worker);
          }
-         last = current;
-         current = current->sip_timeout_next;
+         continue;
+      }
+      (void) __atomic_sub_fetch (&worker->sip_worker_pending, 1, __ATOMIC_RELAXED);
+      /* From here on the timeout can't be cancelled */
+      state = SIP_TIMEOUT_FIRED;
+      if (__atomic_compare_exchange_n (&timeout->sip_timeout_state, &state, SIP_TIMEOUT_RUNNING,
+                                       B_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      {
+         timeout->sip_timeout_callback_func (timeout->sip_timeout_callback_func_arg);
+      }
+      /* The id stays taken until the timeout is back in the pool */
+      timeout->sip_timeout_qnext = done;
+      done = timeout;
+      if (++ndone == SIP_TIMEOUT_BATCH)
+      {
+         sip_worker_put_list (done);
+         done = NULL;
+         ndone = 0;
       }
    }
+}
+
+/* A callback thread */
+static void *sip_worker_thr (void *arg)
+{
+   sip_worker_run ((sip_timeout_worker_t *) arg, B_TRUE);
+   return ((void *) 0);
+}
+
+/*
+ * Run the callbacks of the timeouts for func on the worker picked from
+ * key (arg), instead of from arg itself, so that the timeouts of one
+ * object never run concurrently.
+ */
+int sip_timeout_affinity (void (*func) (void *), void *(*key) (void *))
+{
+   int index;
+
+   (void) pthread_mutex_lock (&timeout_mutex);
+   for (index = 0; index < timeout_naffinity; index++)
+   {
+      if (timeout_affinity[index].sip_affinity_func == func)
+         break;
+   }
+   if (index == SIP_TIMEOUT_MAX_AFFINITY)
+   {
+      (void) pthread_mutex_unlock (&timeout_mutex);
+      return (ENOMEM);
+   }
+   timeout_affinity[index].sip_affinity_func = func;
+   timeout_affinity[index].sip_affinity_key = key;
+   if (index == timeout_naffinity)
+      timeout_naffinity++;
    (void) pthread_mutex_unlock (&timeout_mutex);
-   return (ret);
+   return (0);
+}
+
+/*
+ * Cancel a timeout, returns B_FALSE if the id is stale, i.e. the timeout
+ * has already run or been cancelled. The arg belongs to the caller, it
+ * is not freed.
+ */
+boolean_t sip_untimeout (uint_t id)
+{
+   sip_timeout_shard_t *shard;
+   sip_timeout_t *timeout;
+   int state;
+
+   timeout = sip_timeout_slot (id);
+   if (timeout == NULL)
+      return (B_FALSE);
+   shard = &timeout_shards[timeout->sip_timeout_shard];
+   (void) pthread_mutex_lock (&shard->sip_shard_mutex);
+   if (!sip_timeout_match (timeout, id))
+   {
+      (void) pthread_mutex_unlock (&shard->sip_shard_mutex);
+      return (B_FALSE);
+   }
+   state = SIP_TIMEOUT_FIRED;
+   if (__atomic_load_n (&timeout->sip_timeout_state, __ATOMIC_RELAXED) == SIP_TIMEOUT_ARMED)
+   {
+      SIP_LIST_REMOVE (&timeout->sip_timeout_link);
+      shard->sip_shard_count--;
+      sip_timeout_put (shard, timeout);
+   }
+   else if (!__atomic_compare_exchange_n (&timeout->sip_timeout_state, &state, SIP_TIMEOUT_CANCELLED,
+                                          B_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+   {
+      /* Its callback is running or has run */
+      (void) pthread_mutex_unlock (&shard->sip_shard_mutex);
+      return (B_FALSE);
+   }
+   /* If it had fired its worker gives it back to the pool */
+   (void) pthread_mutex_unlock (&shard->sip_shard_mutex);
+   return (B_TRUE);
+}
+
+/* Have the wheel run at timeout_wakeup */
+static void sip_timeout_wake ()
+{
+#ifdef	__linux__
+   struct itimerspec its;
+#endif
+
+   if (!timeout_external)
+   {
+      (void) pthread_cond_signal (&timeout_cond_var);
+      return;
+   }
+#ifdef	__linux__
+   if (timeout_fd == -1)
+      return;
+   (void) memset (&its, 0, sizeof (its));
+   its.it_value.tv_sec = timeout_wakeup / MILLISEC;
+   its.it_value.tv_nsec = (timeout_wakeup % MILLISEC) * MICROSEC;
+   (void) timerfd_settime (timeout_fd, TFD_TIMER_ABSTIME, &its, NULL);
+#endif
 }
 
 /*
@@ -168,135 +815,122 @@ boolean_t sip_untimeout (uint_t id)
  */
 uint_t sip_timeout (void *arg, void (*callback_func) (void *), struct timeval * timeout_time)
 {
+   sip_timeout_shard_t *shard;
    sip_timeout_t *new_timeout;
-   sip_timeout_t *current, *last;
    hrtime_t future_time;
-   uint_t tid;
-#ifdef	__linux__
-   struct timespec tspec;
    hrtime_t now;
-#endif
+   uint_t tid;
 
-   new_timeout = malloc (sizeof (sip_timeout_t));
-   if (new_timeout == NULL)
+   future_time = (hrtime_t) timeout_time->tv_sec * MILLISEC + (hrtime_t) (timeout_time->tv_usec / MILLISEC);
+   if (future_time < 0L)
       return (0);
 
-#ifdef	__linux__
-   if (clock_gettime (CLOCK_REALTIME, &tspec) != 0)
-      return (0);
-   now = (hrtime_t) tspec.tv_sec * (hrtime_t) NANOSEC + tspec.tv_nsec;
-   future_time = (hrtime_t) timeout_time->tv_sec * (hrtime_t) NANOSEC +
-      (hrtime_t) (timeout_time->tv_usec * MILLISEC) + now;
-#else
-   future_time = (hrtime_t) timeout_time->tv_sec * (hrtime_t) NANOSEC +
-      (hrtime_t) (timeout_time->tv_usec * MILLISEC) + gethrtime ();
-#endif
-   if (future_time <= 0L)
+   shard = sip_timeout_shard (arg);
+   (void) pthread_mutex_lock (&shard->sip_shard_mutex);
+   new_timeout = sip_timeout_get (shard);
+   if (new_timeout == NULL)
    {
-      free (new_timeout);
+      (void) pthread_mutex_unlock (&shard->sip_shard_mutex);
       return (0);
    }
-
-   new_timeout->sip_timeout_next = NULL;
-   new_timeout->sip_timeout_val = future_time;
-   new_timeout->sip_timeout_callback_func = callback_func;
-   new_timeout->sip_timeout_callback_func_arg = arg;
-   (void) pthread_mutex_lock (&timeout_mutex);
-   timer_id++;
-   if (timer_id == 0)
-      timer_id++;
-   tid = timer_id;
-   new_timeout->sip_timeout_id = tid;
-   last = current = timeout_list;
-   while (current != NULL)
-   {
-      if (current->sip_timeout_val <= new_timeout->sip_timeout_val)
-      {
-         last = current;
-         current = current->sip_timeout_next;
-      }
-      else
-      {
-         break;
-      }
+   if (shard->sip_shard_count == 0)
+   {
+      /* Nothing has been ticking the shard, catch it up */
+      now = sip_timeout_now ();
+      sip_timeout_advance (now);
+      if (now > shard->sip_shard_wheel_now)
+         shard->sip_shard_wheel_now = now;
+      future_time += now;
    }
-
-   if (current == timeout_list)
+   else if (timeout_clock != NULL)
    {
-      new_timeout->sip_timeout_next = timeout_list;
-      timeout_list = new_timeout;
+      /* A ULP clock is cheap to read and exact, no slack needed */
+      future_time += sip_timeout_now ();
    }
    else
    {
-      new_timeout->sip_timeout_next = current, last->sip_timeout_next = new_timeout;
+      /* timeout_now can be up to a tick behind, never fire early */
+      future_time += __atomic_load_n (&timeout_now, __ATOMIC_RELAXED) + SIP_TIMEOUT_TICK;
+   }
+   new_timeout->sip_timeout_val = future_time;
+   new_timeout->sip_timeout_callback_func = callback_func;
+   new_timeout->sip_timeout_callback_func_arg = arg;
+   new_timeout->sip_timeout_state = SIP_TIMEOUT_ARMED;
+   tid = SIP_TIMEOUT_ID (new_timeout);
+   sip_wheel_add (shard, new_timeout);
+   shard->sip_shard_count++;
+   (void) pthread_mutex_unlock (&shard->sip_shard_mutex);
+   /*
+    * Only wake the timer thread up if it would sleep past this one. While
+    * it runs the wheel timeout_wakeup is LLONG_MAX, so a timeout added to
+    * a shard it has already been through waits for it to be done.
+    */
+   if (future_time < __atomic_load_n (&timeout_wakeup, __ATOMIC_SEQ_CST))
+   {
+      (void) pthread_mutex_lock (&timeout_mutex);
+      if (future_time < timeout_wakeup)
+      {
+         __atomic_store_n (&timeout_wakeup, future_time, __ATOMIC_SEQ_CST);
+         sip_timeout_wake ();
+      }
+      (void) pthread_mutex_unlock (&timeout_mutex);
    }
-   (void) pthread_cond_signal (&timeout_cond_var);
-   (void) pthread_mutex_unlock (&timeout_mutex);
    return (tid);
 }
 
-/* Schedule the next timeout */
-static hrtime_t sip_schedule_to_functions ()
+/*
+ * Run the shards up to current_time, the workers invoke the callbacks of
+ * the timeouts that fired. Returns the msec at which to run next, which
+ * the caller sets timeout_wakeup to.
+ */
+static hrtime_t sip_schedule_to_functions (hrtime_t current_time)
 {
-#ifdef	__linux__
-   struct timespec tspec;
-#endif
-   sip_timeout_t *timeout = NULL;
-   sip_timeout_t *last = NULL;
-   boolean_t create_thread = B_FALSE;
-/* hack to get it to compile */
-   hrtime_t current_time = 0;;
+   sip_timeout_shard_t *shard;
+   hrtime_t next = LLONG_MAX;
+   hrtime_t shard_next;
+   int index;
 
    /*
     * Thread is holding the mutex.
     */
-#ifdef	__linux__
-   if (clock_gettime (CLOCK_REALTIME, &tspec) != 0)
-      return ((hrtime_t) LONG_SLEEP_TIME + current_time);
-   current_time = (hrtime_t) tspec.tv_sec * (hrtime_t) NANOSEC + tspec.tv_nsec;
-#else
-   current_time = gethrtime ();
-#endif
-   if (timeout_list == NULL)
-      return ((hrtime_t) LONG_SLEEP_TIME + current_time);
-   timeout = timeout_list;
-
-   /*
-    * Get all the timeouts that have fired.
-    */
-   while (timeout != NULL && timeout->sip_timeout_val <= current_time)
+   __atomic_store_n (&timeout_wakeup, LLONG_MAX, __ATOMIC_SEQ_CST);
+   sip_timeout_advance (current_time);
+   current_time = __atomic_load_n (&timeout_now, __ATOMIC_RELAXED);
+   for (index = 0; index < SIP_TIMEOUT_SHARDS; index++)
    {
-      last = timeout;
-      timeout = timeout->sip_timeout_next;
+      shard = &timeout_shards[index];
+      (void) pthread_mutex_lock (&shard->sip_shard_mutex);
+      if (shard->sip_shard_count == 0 && current_time > shard->sip_shard_wheel_now)
+         shard->sip_shard_wheel_now = current_time;
+      while (shard->sip_shard_wheel_now < current_time && shard->sip_shard_count > 0)
+         sip_wheel_tick (shard);
+      if (shard->sip_shard_count == 0 && current_time > shard->sip_shard_wheel_now)
+         shard->sip_shard_wheel_now = current_time;
+      shard_next = sip_wheel_next (shard);
+      if (shard->sip_shard_count > 0 && shard_next > current_time + SIP_TIMEOUT_TICK)
+         shard_next = current_time + SIP_TIMEOUT_TICK;
+      (void) pthread_mutex_unlock (&shard->sip_shard_mutex);
+      if (shard_next < next)
+         next = shard_next;
    }
+   return (next);
+}
 
-   timeout = last;
-   if (timeout != NULL)
-   {
-      if (timeout_current_end != NULL)
-      {
-         timeout_current_end->sip_timeout_next = timeout_list;
-         timeout_current_end = timeout;
-      }
-      else
-      {
-         timeout_current_start = timeout_list;
-         timeout_current_end = timeout;
-         create_thread = B_TRUE;
-      }
-      timeout_list = timeout->sip_timeout_next;
-      timeout->sip_timeout_next = NULL;
-      if (create_thread)
-      {
-         pthread_t thr;
+/* Timeouts armed on all the shards */
+static int sip_timeout_pending ()
+{
+   sip_timeout_shard_t *shard;
+   int count = 0;
+   int index;
 
-         (void) pthread_create (&thr, NULL, sip_run_to_functions, NULL);
-      }
+   for (index = 0; index < SIP_TIMEOUT_SHARDS; index++)
+   {
+      shard = &timeout_shards[index];
+      (void) pthread_mutex_lock (&shard->sip_shard_mutex);
+      count += shard->sip_shard_count;
+      (void) pthread_mutex_unlock (&shard->sip_shard_mutex);
    }
-   if (timeout_list != NULL)
-      return (timeout_list->sip_timeout_val);
-   else
-      return ((hrtime_t) LONG_SLEEP_TIME + current_time);
+   return (count);
 }
 
 /* The timer routine */
@@ -304,57 +938,299 @@ static hrtime_t sip_schedule_to_functions ()
 static void *sip_timer_thr (void *arg)
 {
    timestruc_t to;
-   hrtime_t current_time;
-   hrtime_t next_timeout;
+   hrtime_t wakeup;
+#ifndef	__linux__
    hrtime_t delta;
-#ifdef	__linux__
-   struct timespec tspec;
 #endif
-   to.tv_sec = time (NULL) + 5;
-   to.tv_nsec = 0;
+
    (void) pthread_mutex_lock (&timeout_mutex);
-   for (;;)
+   while (!__atomic_load_n (&timeout_stop, __ATOMIC_RELAXED))
    {
-      (void) pthread_cond_timedwait (&timeout_cond_var, &timeout_mutex, &to);
+      wakeup = sip_schedule_to_functions (sip_timeout_now ());
+      __atomic_store_n (&timeout_wakeup, wakeup, __ATOMIC_SEQ_CST);
+      /* Virtual time only moves when sip_virtual_clock_advance() wakes us */
+      if (timeout_clock == sip_virtual_clock)
+      {
+         (void) pthread_cond_wait (&timeout_cond_var, &timeout_mutex);
+         continue;
+      }
+      /* Another ULP clock can't be slept on, look at it every tick */
+      if (timeout_clock != NULL)
+         wakeup = sip_timeout_real_now () + SIP_TIMEOUT_TICK;
       /*
        * We return from timedwait because we either timed out
        * or a new element was added and we need to reset the time
        */
-    again:
-      next_timeout = sip_schedule_to_functions ();
 #ifdef	__linux__
-      if (clock_gettime (CLOCK_REALTIME, &tspec) != 0)
-         goto again;            /* ??? */
-      current_time = (hrtime_t) tspec.tv_sec * (hrtime_t) NANOSEC + tspec.tv_nsec;
+      /* timeout_cond_var waits on CLOCK_MONOTONIC */
+      to.tv_sec = wakeup / MILLISEC;
+      to.tv_nsec = (wakeup % MILLISEC) * MICROSEC;
+      (void) pthread_cond_timedwait (&timeout_cond_var, &timeout_mutex, &to);
 #else
-      current_time = gethrtime ();
-#endif
-      delta = next_timeout - current_time;
+      delta = SIP_TIMEOUT_TICK;
+      if (timeout_clock == NULL)
+         delta = wakeup - __atomic_load_n (&timeout_now, __ATOMIC_RELAXED);
       if (delta <= 0)
-         goto again;
-      to.tv_sec = time (NULL) + (delta / NANOSEC);
-      to.tv_nsec = delta % NANOSEC;
+         continue;
+      to.tv_sec = delta / MILLISEC;
+      to.tv_nsec = (delta % MILLISEC) * MICROSEC;
+      (void) pthread_cond_reltimedwait_np (&timeout_cond_var, &timeout_mutex, &to);
+#endif
    }
-   /* NOTREACHED */
+   (void) pthread_mutex_unlock (&timeout_mutex);
    return ((void *) 0);
 }
 
-/* The init routine, starts the timer thread */
-void sip_timeout_init ()
+/*
+ * The fd the ULP polls to drive the stack timer itself, -1 if it can't
+ * (no SIP_STACK_EXTERNAL_TIMER, a ULP clock, or no timerfd on this
+ * platform).
+ */
+int sip_timer_fd ()
+{
+   return (timeout_fd);
+}
+
+/*
+ * Run the timeouts that are due at now (CLOCK_MONOTONIC; the current
+ * time if NULL or with a ULP clock), with SIP_STACK_EXTERNAL_TIMER.
+ * Without worker threads their callbacks run here, so it must be called
+ * from one thread at a time. Returns the msecs until it needs to be
+ * called again, -1 if no timeout is pending.
+ */
+int sip_timer_process (const struct timespec *now)
+{
+   hrtime_t current_time;
+   hrtime_t delta;
+#ifdef	__linux__
+   uint64_t expirations;
+#endif
+
+   if (!timeout_external)
+      return (-1);
+   if (now == NULL || timeout_clock != NULL)
+      current_time = sip_timeout_now ();
+   else
+      current_time = (hrtime_t) now->tv_sec * MILLISEC + now->tv_nsec / MICROSEC;
+#ifdef	__linux__
+   if (timeout_fd != -1)
+      (void) read (timeout_fd, &expirations, sizeof (expirations));
+#endif
+   (void) pthread_mutex_lock (&timeout_mutex);
+   __atomic_store_n (&timeout_wakeup, sip_schedule_to_functions (current_time), __ATOMIC_SEQ_CST);
+   sip_timeout_wake ();
+   (void) pthread_mutex_unlock (&timeout_mutex);
+
+   if (timeout_inline)
+      sip_worker_run (&timeout_workers[0], B_FALSE);
+
+   /* The callbacks may have added timeouts */
+   (void) pthread_mutex_lock (&timeout_mutex);
+   delta = sip_timeout_pending () == 0 ? -1 : timeout_wakeup - __atomic_load_n (&timeout_now, __ATOMIC_RELAXED);
+   (void) pthread_mutex_unlock (&timeout_mutex);
+   if (delta < 0)
+      return (-1);
+   return (delta > INT_MAX ? INT_MAX : (int) delta);
+}
+
+/*
+ * A clock for sip_timer_clock that starts at 0 and only moves when
+ * sip_virtual_clock_advance() is called.
+ */
+uint64_t sip_virtual_clock ()
+{
+   return (__atomic_load_n (&timeout_virtual_now, __ATOMIC_ACQUIRE));
+}
+
+/*
+ * Move sip_virtual_clock() msecs forward. With SIP_STACK_EXTERNAL_TIMER
+ * the timeouts that are due are run before returning (their callbacks
+ * too, unless there are callback threads), otherwise the timer thread
+ * is woken up to run them.
+ */
+void sip_virtual_clock_advance (uint64_t msecs)
+{
+   (void) __atomic_add_fetch (&timeout_virtual_now, msecs, __ATOMIC_ACQ_REL);
+   if (timeout_external)
+   {
+      (void) sip_timer_process (NULL);
+      return;
+   }
+   (void) pthread_mutex_lock (&timeout_mutex);
+   (void) pthread_cond_signal (&timeout_cond_var);
+   (void) pthread_mutex_unlock (&timeout_mutex);
+}
+
+/*
+ * Stop the first nthreads callback threads, the timer thread has exited
+ * if there was one, and free what sip_timeout_init() set up.
+ */
+static void sip_timeout_free (int nthreads)
+{
+   sip_timeout_worker_t *worker;
+   sip_timeout_shard_t *shard;
+   int index;
+
+   __atomic_store_n (&timeout_stop, B_TRUE, __ATOMIC_SEQ_CST);
+   for (index = 0; index < nthreads; index++)
+   {
+      worker = &timeout_workers[index];
+      (void) pthread_mutex_lock (&worker->sip_worker_mutex);
+      __atomic_store_n (&worker->sip_worker_sleeping, 0, __ATOMIC_RELAXED);
+      (void) pthread_cond_signal (&worker->sip_worker_cv);
+      (void) pthread_mutex_unlock (&worker->sip_worker_mutex);
+      (void) pthread_join (worker->sip_worker_thread, NULL);
+   }
+   (void) pthread_mutex_lock (&timeout_mutex);
+   free (timeout_workers);
+   timeout_workers = NULL;
+   timeout_nworkers = 0;
+   for (index = 0; index < timeout_nchunks && index < SIP_TIMEOUT_NCHUNKS; index++)
+   {
+      free (timeout_chunks[index]);
+      timeout_chunks[index] = NULL;
+   }
+   timeout_nchunks = 0;
+   for (index = 0; index < SIP_TIMEOUT_SHARDS; index++)
+   {
+      shard = &timeout_shards[index];
+      shard->sip_shard_free_head = NULL;
+      shard->sip_shard_free_tail = NULL;
+      shard->sip_shard_nfree = 0;
+      shard->sip_shard_count = 0;
+      (void) pthread_mutex_destroy (&shard->sip_shard_mutex);
+   }
+   if (timeout_fd != -1)
+   {
+      (void) close (timeout_fd);
+      timeout_fd = -1;
+   }
+   timeout_external = B_FALSE;
+   timeout_inline = B_FALSE;
+   timeout_clock = NULL;
+   timeout_initialized = B_FALSE;
+   __atomic_store_n (&timeout_stop, B_FALSE, __ATOMIC_SEQ_CST);
+   (void) pthread_mutex_unlock (&timeout_mutex);
+}
+
+/*
+ * The init routine, starts the timer thread, or with external set the
+ * timerfd for sip_timer_process(), and nthreads callback threads. If
+ * nthreads is 0 there are SIP_TIMEOUT_THREADS, or with external none,
+ * sip_timer_process() runs the callbacks. clock, if not NULL, is the
+ * time source in msecs.
+ */
+int sip_timeout_init (int nthreads, boolean_t external, uint64_t (*clock) (void))
 {
-   static boolean_t timout_init = B_FALSE;
-   pthread_t thread1;
+   sip_timeout_worker_t *worker;
+   sip_timeout_shard_t *shard;
+#ifdef	__linux__
+   pthread_condattr_t cattr;
+#endif
+   int level;
+   int index;
+
+   if (nthreads < 0)
+      return (EINVAL);
+   if (nthreads == 0)
+      nthreads = external ? 0 : SIP_TIMEOUT_THREADS;
+   else if (nthreads > SIP_TIMEOUT_MAX_THREADS)
+      nthreads = SIP_TIMEOUT_MAX_THREADS;
 
    (void) pthread_mutex_lock (&timeout_mutex);
-   if (timout_init == B_FALSE)
+   if (timeout_initialized)
    {
-      timout_init = B_TRUE;
       (void) pthread_mutex_unlock (&timeout_mutex);
+      return (0);
    }
-   else
+   timeout_clock = clock;
+   timeout_now = sip_timeout_now ();
+   timeout_wakeup = timeout_now;
+   for (shard = timeout_shards; shard < &timeout_shards[SIP_TIMEOUT_SHARDS]; shard++)
+   {
+      (void) pthread_mutex_init (&shard->sip_shard_mutex, NULL);
+      for (index = 0; index < SIP_WHEEL_L0_SZ; index++)
+         SIP_LIST_INIT (&shard->sip_shard_l0[index]);
+      for (level = 0; level < SIP_WHEEL_LEVELS - 1; level++)
+      {
+         for (index = 0; index < SIP_WHEEL_LN_SZ; index++)
+            SIP_LIST_INIT (&shard->sip_shard_ln[level][index]);
+      }
+      shard->sip_shard_wheel_now = timeout_now;
+   }
+   timeout_workers = calloc (nthreads == 0 ? 1 : nthreads, sizeof (sip_timeout_worker_t));
+   if (timeout_workers == NULL)
+   {
+      (void) pthread_mutex_unlock (&timeout_mutex);
+      sip_timeout_free (0);
+      return (ENOMEM);
+   }
+   for (index = 0; index < (nthreads == 0 ? 1 : nthreads); index++)
+   {
+      worker = &timeout_workers[index];
+      worker->sip_worker_head = &worker->sip_worker_stub;
+      worker->sip_worker_tail = &worker->sip_worker_stub;
+      (void) pthread_mutex_init (&worker->sip_worker_mutex, NULL);
+      (void) pthread_cond_init (&worker->sip_worker_cv, NULL);
+      if (nthreads == 0)
+         break;
+      if (pthread_create (&worker->sip_worker_thread, NULL, sip_worker_thr, worker) != 0)
+      {
+         if (index == 0)
+         {
+            (void) pthread_mutex_unlock (&timeout_mutex);
+            sip_timeout_free (0);
+            return (EAGAIN);
+         }
+         break;
+      }
+   }
+   timeout_nworkers = nthreads == 0 ? 1 : index;
+   timeout_inline = nthreads == 0;
+   timeout_external = external;
+   if (external)
+   {
+#ifdef	__linux__
+      if (clock == NULL)
+         timeout_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+#endif
+      timeout_initialized = B_TRUE;
+      (void) pthread_mutex_unlock (&timeout_mutex);
+      return (0);
+   }
+#ifdef	__linux__
+   (void) pthread_condattr_init (&cattr);
+   (void) pthread_condattr_setclock (&cattr, CLOCK_MONOTONIC);
+   (void) pthread_cond_init (&timeout_cond_var, &cattr);
+   (void) pthread_condattr_destroy (&cattr);
+#endif
+   timeout_initialized = B_TRUE;
+   (void) pthread_mutex_unlock (&timeout_mutex);
+   if (pthread_create (&timeout_thread, NULL, sip_timer_thr, NULL) != 0)
+   {
+      sip_timeout_free (timeout_nworkers);
+      return (EAGAIN);
+   }
+   return (0);
+}
+
+/*
+ * Undo sip_timeout_init(), for a stack that failed to come up: the
+ * threads are stopped and waited for, the pool is freed. No timeout may
+ * be pending.
+ */
+void sip_timeout_fini ()
+{
+   (void) pthread_mutex_lock (&timeout_mutex);
+   if (!timeout_initialized)
    {
       (void) pthread_mutex_unlock (&timeout_mutex);
       return;
    }
-   (void) pthread_create (&thread1, NULL, sip_timer_thr, NULL);
+   __atomic_store_n (&timeout_stop, B_TRUE, __ATOMIC_SEQ_CST);
+   (void) pthread_cond_signal (&timeout_cond_var);
+   (void) pthread_mutex_unlock (&timeout_mutex);
+   if (!timeout_external)
+      (void) pthread_join (timeout_thread, NULL);
+   sip_timeout_free (timeout_inline ? 0 : timeout_nworkers);
 }
@@ -58,6 +58,45 @@ const struct sip_header *sip_get_header (sip_msg_t sip_msg, char *header_name, s
    return (sip_hdr);
 }
 
+/*
+ * Same as sip_get_header(), with the header given by its id.
+ */
+const struct sip_header *sip_get_header_by_id (sip_msg_t sip_msg, sip_header_id_t id, sip_header_t old_header,
+                                               int *error)
+{
+   _sip_msg_t *_sip_msg;
+   const struct sip_header *sip_hdr;
+
+   if (error != NULL)
+      *error = 0;
+   if (sip_msg == NULL || id <= SIP_HDR_UNKNOWN || id >= SIP_HDR_MAX)
+   {
+      if (error != NULL)
+         *error = EINVAL;
+      return (NULL);
+   }
+   _sip_msg = (_sip_msg_t *) sip_msg;
+   (void) pthread_mutex_lock (&_sip_msg->sip_msg_mutex);
+   sip_hdr = (sip_header_t) sip_search_for_header_id (_sip_msg, id, (_sip_header_t *) old_header);
+   (void) pthread_mutex_unlock (&_sip_msg->sip_msg_mutex);
+   if (sip_hdr == NULL && error != NULL)
+      *error = EINVAL;
+   return (sip_hdr);
+}
+
+/*
+ * Return the first value of the first header with the given id.
+ */
+const struct sip_value *sip_get_header_value_by_id (sip_msg_t sip_msg, sip_header_id_t id, int *error)
+{
+   const struct sip_header *sip_hdr;
+
+   sip_hdr = sip_get_header_by_id (sip_msg, id, NULL, error);
+   if (sip_hdr == NULL)
+      return (NULL);
+   return (sip_get_header_value (sip_hdr, error));
+}
+
 /*
  * Return the request line as a string. Caller releases the returned string.
  */
@@ -96,6 +135,27 @@ char *sip_respline_to_str (sip_msg_t sip_msg, int *error)
    return (respstr);
 }
 
+/*
+ * The value after 'value'. Headers with many values are parsed a value at
+ * a time, so the next one may have to be parsed first. 'next' is set by
+ * the parse, it is only read under the message lock.
+ */
+static const struct sip_value *sip_next_parsed_value (const struct sip_value *value)
+{
+   _sip_header_t *_sip_header;
+   const struct sip_value *next;
+
+   _sip_header = (_sip_header_t *) value->parsed_header->sip_header;
+   if (_sip_header->sip_hdr_sipmsg != NULL)
+      (void) pthread_mutex_lock (&_sip_header->sip_hdr_sipmsg->sip_msg_mutex);
+   if (value->next == NULL && _sip_header->sip_hdr_unparsed != NULL)
+      (void) sip_parse_next_value (_sip_header);
+   next = value->next;
+   if (_sip_header->sip_hdr_sipmsg != NULL)
+      (void) pthread_mutex_unlock (&_sip_header->sip_hdr_sipmsg->sip_msg_mutex);
+   return (next);
+}
+
 /*
  * return the first value of the header
  */
@@ -141,7 +201,7 @@ const struct sip_value *sip_get_header_value (const struct sip_header *sip_heade
       return (NULL);
    value = (sip_header_value_t) sip_parsed_header->value;
    while (value != NULL && value->value_state == SIP_VALUE_DELETED)
-      value = value->next;
+      value = sip_next_parsed_value (value);
    if (value != NULL && value->value_state == SIP_VALUE_BAD && error != NULL)
    {
       *error = EPROTO;
@@ -158,7 +218,7 @@ const struct sip_value *sip_get_next_value (sip_header_value_t old_value, int *e
 
    if (error != NULL)
       *error = 0;
-   if (old_value == NULL || old_value->next == NULL)
+   if (old_value == NULL || (value = sip_next_parsed_value (old_value)) == NULL)
    {
       if (error != NULL)
          *error = EINVAL;
@@ -167,9 +227,8 @@ const struct sip_value *sip_get_next_value (sip_header_value_t old_value, int *e
    /*
     * We never free the deleted values so no need to hold a lock.
     */
-   value = (sip_header_value_t) old_value->next;
    while (value != NULL && value->value_state == SIP_VALUE_DELETED)
-      value = value->next;
+      value = sip_next_parsed_value (value);
    if (value != NULL && value->value_state == SIP_VALUE_BAD && error != NULL)
    {
       *error = EPROTO;
@@ -448,6 +507,18 @@ sip_method_t sip_get_request_method (sip_msg_t sip_msg, int *error)
    return (ret);
 }
 
+/*
+ * The request line is split on receipt but its URI is only parsed here,
+ * on first use. Called with the message lock held. NULL with a non-empty
+ * URI means we ran out of memory.
+ */
+static sip_uri_t sip_request_uri_parsed (sip_message_type_t * sip_msg_info)
+{
+   if (sip_msg_info->sip_req_parse_uri == NULL && sip_msg_info->sip_req_uri.sip_str_len > 0)
+      sip_msg_info->sip_req_parse_uri = sip_parse_uri (&sip_msg_info->sip_req_uri, NULL);
+   return (sip_msg_info->sip_req_parse_uri);
+}
+
 /* Return the URI from the request line */
 const sip_str_t *sip_get_request_uri_str (sip_msg_t sip_msg, int *error)
 {
@@ -476,18 +547,21 @@ const sip_str_t *sip_get_request_uri_str (sip_msg_t sip_msg, int *error)
    sip_msg_info = _sip_msg->sip_msg_req_res;
    if (sip_msg_info->is_request)
       ret = &sip_msg_info->sip_req_uri;
-   (void) pthread_mutex_unlock (&_sip_msg->sip_msg_mutex);
 
    /*
-    * If the error is required, check the validity of the URI via
-    * sip_uri_parse().
+    * If the error is required, check the validity of the URI, parsing
+    * it if nobody has yet.
     */
    if (error != NULL)
    {
-      parsed_uri = sip_parse_uri (ret, error);
-      if (parsed_uri != NULL)
-         free (parsed_uri);
+      if (ret == NULL)
+         *error = EINVAL;
+      else if ((parsed_uri = sip_request_uri_parsed (sip_msg_info)) == NULL)
+         *error = ret->sip_str_len > 0 ? ENOMEM : EPROTO;
+      else if (parsed_uri->sip_uri_errflags != 0)
+         *error = EPROTO;
    }
+   (void) pthread_mutex_unlock (&_sip_msg->sip_msg_mutex);
    return (ret);
 }
 
@@ -694,7 +768,7 @@ const sip_str_t *sip_get_route_display_name (sip_header_value_t value, int *erro
 }
 
 /* Get URI from the SIP message */
-const sip_str_t *sip_get_cftruri_from_msg (sip_msg_t sip_msg, int *error, char *hdrname)
+const sip_str_t *sip_get_cftruri_from_msg (sip_msg_t sip_msg, int *error, sip_header_id_t hdrid)
 {
    const sip_hdr_value_t *value;
    const struct sip_header *header;
@@ -708,7 +782,7 @@ const sip_str_t *sip_get_cftruri_from_msg (sip_msg_t sip_msg, int *error, char *
       return (NULL);
    }
 
-   header = sip_get_header (sip_msg, hdrname, NULL, error);
+   header = sip_get_header_by_id (sip_msg, hdrid, NULL, error);
    if (header == NULL)
    {
       if (error != NULL)
@@ -732,7 +806,7 @@ const sip_str_t *sip_get_cftruri_from_msg (sip_msg_t sip_msg, int *error, char *
 }
 
 /* Get display name from the SIP message */
-const sip_str_t *sip_get_cftrname_from_msg (sip_msg_t sip_msg, int *error, char *hdrname)
+const sip_str_t *sip_get_cftrname_from_msg (sip_msg_t sip_msg, int *error, sip_header_id_t hdrid)
 {
    const sip_hdr_value_t *value;
    const struct sip_header *header;
@@ -745,7 +819,7 @@ const sip_str_t *sip_get_cftrname_from_msg (sip_msg_t sip_msg, int *error, char
          *error = EINVAL;
       return (NULL);
    }
-   header = sip_get_header (sip_msg, hdrname, NULL, error);
+   header = sip_get_header_by_id (sip_msg, hdrid, NULL, error);
    if (header == NULL)
    {
       if (error != NULL)
@@ -771,13 +845,13 @@ const sip_str_t *sip_get_cftrname_from_msg (sip_msg_t sip_msg, int *error, char
 /* Get FROM URI */
 const sip_str_t *sip_get_from_uri_str (sip_msg_t sip_msg, int *error)
 {
-   return (sip_get_cftruri_from_msg (sip_msg, error, SIP_FROM));
+   return (sip_get_cftruri_from_msg (sip_msg, error, SIP_HDR_FROM));
 }
 
 /* Get FROM display name */
 const sip_str_t *sip_get_from_display_name (sip_msg_t sip_msg, int *error)
 {
-   return (sip_get_cftrname_from_msg (sip_msg, error, SIP_FROM));
+   return (sip_get_cftrname_from_msg (sip_msg, error, SIP_HDR_FROM));
 }
 
 /* Return the FROM tag */
@@ -794,7 +868,7 @@ const sip_str_t *sip_get_from_tag (sip_msg_t sip_msg, int *error)
          *error = EINVAL;
       return (NULL);
    }
-   header = sip_get_header (sip_msg, SIP_FROM, NULL, error);
+   header = sip_get_header_by_id (sip_msg, SIP_HDR_FROM, NULL, error);
    if (header == NULL)
    {
       if (error != NULL)
@@ -820,13 +894,13 @@ const sip_str_t *sip_get_from_tag (sip_msg_t sip_msg, int *error)
 /* Get TO URI */
 const sip_str_t *sip_get_to_uri_str (sip_msg_t sip_msg, int *error)
 {
-   return (sip_get_cftruri_from_msg (sip_msg, error, SIP_TO));
+   return (sip_get_cftruri_from_msg (sip_msg, error, SIP_HDR_TO));
 }
 
 /* Get TO display name */
 const sip_str_t *sip_get_to_display_name (sip_msg_t sip_msg, int *error)
 {
-   return (sip_get_cftrname_from_msg (sip_msg, error, SIP_TO));
+   return (sip_get_cftrname_from_msg (sip_msg, error, SIP_HDR_TO));
 }
 
 /* Get TO tag */
@@ -843,7 +917,7 @@ const sip_str_t *sip_get_to_tag (sip_msg_t sip_msg, int *error)
          *error = EINVAL;
       return (NULL);
    }
-   header = sip_get_header (sip_msg, SIP_TO, NULL, error);
+   header = sip_get_header_by_id (sip_msg, SIP_HDR_TO, NULL, error);
    if (header == NULL)
    {
       if (error != NULL)
@@ -908,7 +982,7 @@ static void *sip_get_val_from_hdr (sip_hdr_value_t * val, int val_type, boolean_
  * Generic function to get value from a header given the value type and
  * the string info (for multi-string values).
  */
-static void *sip_get_val_from_msg (sip_msg_t msg, char *hdr_name, int val_type,
+static void *sip_get_val_from_msg (sip_msg_t msg, sip_header_id_t hdr_id, int val_type,
                                    boolean_t stype, boolean_t empty_val, int *error)
 {
    const _sip_header_t *header;
@@ -923,7 +997,7 @@ static void *sip_get_val_from_msg (sip_msg_t msg, char *hdr_name, int val_type,
       return (NULL);
    }
 
-   header = sip_get_header (msg, hdr_name, NULL, error);
+   header = sip_get_header_by_id (msg, hdr_id, NULL, error);
    if (header == NULL)
    {
       if (error != NULL)
@@ -946,7 +1020,7 @@ const sip_str_t *sip_get_callid (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_CALL_ID, SIP_STR_VAL, B_FALSE, B_TRUE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_CALL_ID, SIP_STR_VAL, B_FALSE, B_TRUE, error);
    return (r);
 }
 
@@ -968,7 +1042,7 @@ void *sip_get_cseq_val (sip_msg_t msg, int type, int *error)
          *error = EINVAL;
       return (NULL);
    }
-   header = sip_get_header (msg, SIP_CSEQ, NULL, error);
+   header = sip_get_header_by_id (msg, SIP_HDR_CSEQ, NULL, error);
    if (header == NULL)
    {
       if (error != NULL)
@@ -1119,7 +1193,7 @@ int sip_get_maxforward (sip_msg_t sip_msg, int *error)
 {
    int *r;
 
-   r = (int *) sip_get_val_from_msg (sip_msg, SIP_MAX_FORWARDS, SIP_INT_VAL, B_FALSE, B_FALSE, error);
+   r = (int *) sip_get_val_from_msg (sip_msg, SIP_HDR_MAX_FORWARDS, SIP_INT_VAL, B_FALSE, B_FALSE, error);
    if (r == NULL)
       return (-1);
    return (*r);
@@ -1130,7 +1204,7 @@ const sip_str_t *sip_get_content_type (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_CONTENT_TYPE, SIP_STRS_VAL, B_TRUE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_CONTENT_TYPE, SIP_STRS_VAL, B_TRUE, B_FALSE, error);
    return (r);
 }
 
@@ -1139,7 +1213,7 @@ const sip_str_t *sip_get_content_sub_type (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_CONTENT_TYPE, SIP_STRS_VAL, B_FALSE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_CONTENT_TYPE, SIP_STRS_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -1197,7 +1271,7 @@ int sip_get_content_length (sip_msg_t sip_msg, int *error)
 {
    int *r;
 
-   r = (int *) sip_get_val_from_msg (sip_msg, SIP_CONTENT_LENGTH, SIP_INT_VAL, B_FALSE, B_FALSE, error);
+   r = (int *) sip_get_val_from_msg (sip_msg, SIP_HDR_CONTENT_LENGTH, SIP_INT_VAL, B_FALSE, B_FALSE, error);
    if (r == NULL)
       return (-1);
    return (*r);
@@ -1219,7 +1293,7 @@ const sip_str_t *sip_get_event (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_EVENT, SIP_STR_VAL, B_FALSE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_EVENT, SIP_STR_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -1228,7 +1302,7 @@ const sip_str_t *sip_get_substate (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_SUBSCRIPTION_STATE, SIP_STR_VAL, B_FALSE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_SUBSCRIPTION_STATE, SIP_STR_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -1307,7 +1381,7 @@ const sip_str_t *sip_get_content_disp (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_CONTENT_DIS, SIP_STR_VAL, B_FALSE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_CONTENT_DIS, SIP_STR_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -1353,7 +1427,7 @@ static void *sip_get_date_val (sip_msg_t msg, int type, int *error)
          *error = EINVAL;
       return (NULL);
    }
-   header = sip_get_header (msg, SIP_DATE, NULL, error);
+   header = sip_get_header_by_id (msg, SIP_HDR_DATE, NULL, error);
    if (header == NULL)
    {
       if (error != NULL)
@@ -1469,7 +1543,7 @@ int sip_get_expires (sip_msg_t sip_msg, int *error)
 {
    int *r;
 
-   r = (int *) sip_get_val_from_msg (sip_msg, SIP_EXPIRE, SIP_INT_VAL, B_FALSE, B_FALSE, error);
+   r = (int *) sip_get_val_from_msg (sip_msg, SIP_HDR_EXPIRE, SIP_INT_VAL, B_FALSE, B_FALSE, error);
    if (r == NULL)
       return (-1);
    return (*r);
@@ -1490,7 +1564,7 @@ int sip_get_min_expires (sip_msg_t sip_msg, int *error)
 {
    int *r;
 
-   r = (int *) sip_get_val_from_msg (sip_msg, SIP_MIN_EXPIRE, SIP_INT_VAL, B_FALSE, B_FALSE, error);
+   r = (int *) sip_get_val_from_msg (sip_msg, SIP_HDR_MIN_EXPIRE, SIP_INT_VAL, B_FALSE, B_FALSE, error);
    if (r == NULL)
       return (-1);
    return (*r);
@@ -1501,7 +1575,7 @@ const sip_str_t *sip_get_mime_version (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_MIME_VERSION, SIP_STR_VAL, B_FALSE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_MIME_VERSION, SIP_STR_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -1510,7 +1584,7 @@ const sip_str_t *sip_get_org (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_ORGANIZATION, SIP_STR_VAL, B_FALSE, B_TRUE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_ORGANIZATION, SIP_STR_VAL, B_FALSE, B_TRUE, error);
    return (r);
 }
 
@@ -1519,7 +1593,7 @@ const sip_str_t *sip_get_priority (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_PRIORITY, SIP_STR_VAL, B_FALSE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_PRIORITY, SIP_STR_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -1588,7 +1662,7 @@ void *sip_get_rack_val (sip_msg_t msg, int type, int *error)
          *error = EINVAL;
       return (NULL);
    }
-   header = sip_get_header (msg, SIP_RACK, NULL, error);
+   header = sip_get_header_by_id (msg, SIP_HDR_RACK, NULL, error);
    if (header == NULL)
    {
       if (error != NULL)
@@ -1654,7 +1728,7 @@ int sip_get_rseq_resp_num (sip_msg_t sip_msg, int *error)
 {
    int *r;
 
-   r = (int *) sip_get_val_from_msg (sip_msg, SIP_RSEQ, SIP_INT_VAL, B_FALSE, B_FALSE, error);
+   r = (int *) sip_get_val_from_msg (sip_msg, SIP_HDR_RSEQ, SIP_INT_VAL, B_FALSE, B_FALSE, error);
 
    return (r == NULL ? -1 : *r);
 }
@@ -1664,7 +1738,7 @@ const sip_str_t *sip_get_replyto_display_name (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_REPLYTO, SIP_STRS_VAL, B_TRUE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_REPLYTO, SIP_STRS_VAL, B_TRUE, B_FALSE, error);
    return (r);
 }
 
@@ -1673,7 +1747,7 @@ const sip_str_t *sip_get_replyto_uri_str (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_REPLYTO, SIP_STRS_VAL, B_FALSE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_REPLYTO, SIP_STRS_VAL, B_FALSE, B_FALSE, error);
 
    return (r);
 }
@@ -1693,7 +1767,7 @@ int sip_get_retry_after_time (sip_msg_t sip_msg, int *error)
 {
    int *t;
 
-   t = (int *) sip_get_val_from_msg (sip_msg, SIP_RETRY_AFTER, SIP_INTSTR_VAL, B_FALSE, B_FALSE, error);
+   t = (int *) sip_get_val_from_msg (sip_msg, SIP_HDR_RETRY_AFTER, SIP_INTSTR_VAL, B_FALSE, B_FALSE, error);
    if (t == NULL)
       return (-1);
    return (*t);
@@ -1704,7 +1778,7 @@ const sip_str_t *sip_get_retry_after_cmts (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_RETRY_AFTER, SIP_INTSTR_VAL, B_TRUE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_RETRY_AFTER, SIP_INTSTR_VAL, B_TRUE, B_FALSE, error);
    return (r);
 }
 
@@ -1713,7 +1787,7 @@ const sip_str_t *sip_get_subject (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_SUBJECT, SIP_STR_VAL, B_FALSE, B_TRUE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_SUBJECT, SIP_STR_VAL, B_FALSE, B_TRUE, error);
    return (r);
 }
 
@@ -1732,7 +1806,7 @@ const sip_str_t *sip_get_tstamp_delay (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *t;
 
-   t = sip_get_val_from_msg (sip_msg, SIP_TIMESTAMP, SIP_STRS_VAL, B_FALSE, B_FALSE, error);
+   t = sip_get_val_from_msg (sip_msg, SIP_HDR_TIMESTAMP, SIP_STRS_VAL, B_FALSE, B_FALSE, error);
    return (t);
 }
 
@@ -1741,7 +1815,7 @@ const sip_str_t *sip_get_tstamp_value (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *t;
 
-   t = sip_get_val_from_msg (sip_msg, SIP_TIMESTAMP, SIP_STRS_VAL, B_TRUE, B_FALSE, error);
+   t = sip_get_val_from_msg (sip_msg, SIP_HDR_TIMESTAMP, SIP_STRS_VAL, B_TRUE, B_FALSE, error);
    return (t);
 }
 
@@ -1760,7 +1834,7 @@ const sip_str_t *sip_get_server (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_SERVER, SIP_STR_VAL, B_FALSE, B_FALSE, error);
+   r = (sip_str_t *) sip_get_val_from_msg (sip_msg, SIP_HDR_SERVER, SIP_STR_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -1769,7 +1843,7 @@ const sip_str_t *sip_get_user_agent (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = sip_get_val_from_msg (sip_msg, SIP_USER_AGENT, SIP_STR_VAL, B_FALSE, B_FALSE, error);
+   r = sip_get_val_from_msg (sip_msg, SIP_HDR_USER_AGENT, SIP_STR_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -1867,12 +1941,12 @@ const sip_str_t *sip_get_author_scheme (sip_msg_t sip_msg, int *error)
 {
    sip_str_t *r;
 
-   r = sip_get_val_from_msg (sip_msg, SIP_AUTHOR, SIP_AUTH_VAL, B_FALSE, B_FALSE, error);
+   r = sip_get_val_from_msg (sip_msg, SIP_HDR_AUTHOR, SIP_AUTH_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
 /* get authentication parameter */
-static const sip_str_t *sip_get_auth_param (sip_msg_t msg, char *hdr_name, char *pname, int *error)
+static const sip_str_t *sip_get_auth_param (sip_msg_t msg, sip_header_id_t hdr_id, char *pname, int *error)
 {
    const _sip_header_t *header;
    sip_hdr_value_t *value;
@@ -1881,14 +1955,14 @@ static const sip_str_t *sip_get_auth_param (sip_msg_t msg, char *hdr_name, char
    if (error != NULL)
       *error = 0;
 
-   if (msg == NULL || pname == NULL || hdr_name == NULL)
+   if (msg == NULL || pname == NULL)
    {
       if (error != NULL)
          *error = EINVAL;
       return (NULL);
    }
 
-   header = sip_get_header (msg, hdr_name, NULL, error);
+   header = sip_get_header_by_id (msg, hdr_id, NULL, error);
    if (header == NULL)
    {
       if (error != NULL)
@@ -1915,7 +1989,7 @@ const sip_str_t *sip_get_author_param (sip_msg_t sip_msg, char *name, int *error
 {
    const sip_str_t *r;
 
-   r = sip_get_auth_param (sip_msg, SIP_AUTHOR, name, error);
+   r = sip_get_auth_param (sip_msg, SIP_HDR_AUTHOR, name, error);
    return (r);
 }
 
@@ -1942,7 +2016,7 @@ const sip_str_t *sip_get_proxy_authen_scheme (sip_msg_t msg, int *error)
 {
    sip_str_t *r;
 
-   r = sip_get_val_from_msg (msg, SIP_PROXY_AUTHEN, SIP_AUTH_VAL, B_FALSE, B_FALSE, error);
+   r = sip_get_val_from_msg (msg, SIP_HDR_PROXY_AUTHEN, SIP_AUTH_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -1951,7 +2025,7 @@ const sip_str_t *sip_get_proxy_authen_param (sip_msg_t sip_msg, char *name, int
 {
    const sip_str_t *r;
 
-   r = sip_get_auth_param (sip_msg, SIP_PROXY_AUTHEN, name, error);
+   r = sip_get_auth_param (sip_msg, SIP_HDR_PROXY_AUTHEN, name, error);
    return (r);
 }
 
@@ -1960,7 +2034,7 @@ const sip_str_t *sip_get_proxy_author_scheme (sip_msg_t msg, int *error)
 {
    sip_str_t *r;
 
-   r = sip_get_val_from_msg (msg, SIP_PROXY_AUTHOR, SIP_AUTH_VAL, B_FALSE, B_FALSE, error);
+   r = sip_get_val_from_msg (msg, SIP_HDR_PROXY_AUTHOR, SIP_AUTH_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -1969,7 +2043,7 @@ const sip_str_t *sip_get_proxy_author_param (sip_msg_t sip_msg, char *name, int
 {
    const sip_str_t *r;
 
-   r = sip_get_auth_param (sip_msg, SIP_PROXY_AUTHOR, name, error);
+   r = sip_get_auth_param (sip_msg, SIP_HDR_PROXY_AUTHOR, name, error);
    return (r);
 }
 
@@ -1996,7 +2070,7 @@ const sip_str_t *sip_get_www_authen_scheme (sip_msg_t msg, int *error)
 {
    sip_str_t *r;
 
-   r = sip_get_val_from_msg (msg, SIP_WWW_AUTHEN, SIP_AUTH_VAL, B_FALSE, B_FALSE, error);
+   r = sip_get_val_from_msg (msg, SIP_HDR_WWW_AUTHEN, SIP_AUTH_VAL, B_FALSE, B_FALSE, error);
    return (r);
 }
 
@@ -2005,7 +2079,7 @@ const sip_str_t *sip_get_www_authen_param (sip_msg_t sip_msg, char *name, int *e
 {
    const sip_str_t *r;
 
-   r = sip_get_auth_param (sip_msg, SIP_WWW_AUTHEN, name, error);
+   r = sip_get_auth_param (sip_msg, SIP_HDR_WWW_AUTHEN, name, error);
    return (r);
 }
 
@@ -2192,7 +2266,22 @@ char *sip_get_branchid (sip_msg_t sip_msg, int *error)
    _sip_msg = (_sip_msg_t *) sip_msg;
 
    (void) pthread_mutex_lock (&_sip_msg->sip_msg_mutex);
-   header = sip_search_for_header (_sip_msg, SIP_VIA, NULL);
+   if (_sip_msg->sip_msg_core_parsed)
+   {
+      param_value = _sip_msg->sip_msg_core.sip_core_branch;
+      via_value = _sip_msg->sip_msg_core.sip_core_via;
+      if (param_value == NULL)
+      {
+         /* As below: no Via or no branch, or a Via that did not parse */
+         if (error != NULL)
+            *error = (_sip_msg->sip_msg_core.sip_core_via_hdr != NULL &&
+                      (via_value == NULL || via_value->sip_value_state == SIP_VALUE_BAD)) ? EPROTO : EINVAL;
+         (void) pthread_mutex_unlock (&_sip_msg->sip_msg_mutex);
+         return (NULL);
+      }
+      goto copy;
+   }
+   header = sip_search_for_header_id (_sip_msg, SIP_HDR_VIA, NULL);
    if (header == NULL)
    {
       if (error != NULL)
@@ -2232,6 +2321,7 @@ char *sip_get_branchid (sip_msg_t sip_msg, int *error)
       return (NULL);
    }
 
+ copy:
    bid = (char *) malloc (param_value->sip_str_len + 1);
    if (bid == NULL)
    {
@@ -2265,7 +2355,7 @@ int sip_add_branchid_to_via (sip_msg_t sip_msg, char *branchid)
       return (EINVAL);
    _sip_msg = (_sip_msg_t *) sip_msg;
    (void) pthread_mutex_lock (&_sip_msg->sip_msg_mutex);
-   via_hdr = (sip_header_t) sip_search_for_header (_sip_msg, SIP_VIA, NULL);
+   via_hdr = (sip_header_t) sip_search_for_header_id (_sip_msg, SIP_HDR_VIA, NULL);
    (void) pthread_mutex_unlock (&_sip_msg->sip_msg_mutex);
    if (via_hdr == NULL)
       return (EINVAL);
@@ -2298,11 +2388,11 @@ int sip_get_num_via (sip_msg_t sip_msg, int *error)
    }
    _sip_msg = (_sip_msg_t *) sip_msg;
    (void) pthread_mutex_lock (&_sip_msg->sip_msg_mutex);
-   hdr = (sip_header_t) sip_search_for_header (_sip_msg, SIP_VIA, NULL);
+   hdr = (sip_header_t) sip_search_for_header_id (_sip_msg, SIP_HDR_VIA, NULL);
    while (hdr != NULL)
    {
       via_cnt++;
-      hdr = (sip_header_t) sip_search_for_header (_sip_msg, SIP_VIA, hdr);
+      hdr = (sip_header_t) sip_search_for_header_id (_sip_msg, SIP_HDR_VIA, hdr);
    }
    (void) pthread_mutex_unlock (&_sip_msg->sip_msg_mutex);
    return (via_cnt);
@@ -2329,7 +2419,9 @@ const struct sip_uri *sip_get_request_uri (sip_msg_t sip_msg, int *error)
    sip_msg_info = _sip_msg->sip_msg_req_res;
    if (sip_msg_info != NULL && sip_msg_info->is_request)
    {
-      ret = sip_msg_info->sip_req_parse_uri;
+      ret = sip_request_uri_parsed (sip_msg_info);
+      if (ret == NULL && sip_msg_info->sip_req_uri.sip_str_len > 0 && error != NULL)
+         *error = ENOMEM;
    }
    else
    {
@@ -2402,13 +2494,14 @@ void sip_clear_stale_data (sip_conn_object_t obj)
    pvt_data = (sip_conn_obj_pvt_t *) * obj_val;
    (void) pthread_mutex_lock (&pvt_data->sip_conn_obj_reass_lock);
    reass = pvt_data->sip_conn_obj_reass;
-   if (reass->sip_reass_msg != NULL)
+   if (reass->sip_reass_chunk != NULL)
    {
-      assert (reass->sip_reass_msglen > 0);
-      free (reass->sip_reass_msg);
-      reass->sip_reass_msglen = 0;
+      sip_reass_chunk_rele (reass->sip_reass_chunk);
+      reass->sip_reass_chunk = NULL;
    }
-   assert (reass->sip_reass_msglen == 0);
+   reass->sip_reass_start = 0;
+   reass->sip_reass_end = 0;
+   bzero (&reass->sip_reass_frame, sizeof (reass->sip_reass_frame));
    (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_reass_lock);
 }
 
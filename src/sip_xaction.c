@@ -32,13 +32,12 @@
 #define	RFC_3261_BRANCH "z9hG4bK"
 
 /* The transaction hash table */
-sip_hash_t sip_xaction_hash[SIP_HASH_SZ];
+sip_hash_t sip_xaction_hash;
 
 int (*sip_xaction_ulp_trans_err) (sip_transaction_t, int, void *) = NULL;
 void (*sip_xaction_ulp_state_cb) (sip_transaction_t, sip_msg_t, int, int) = NULL;
 
 int sip_xaction_add (sip_xaction_t *, char *, _sip_msg_t *, sip_method_t);
-static boolean_t sip_is_conn_obj_cache (sip_conn_object_t, void *);
 
 /* Get the md5 hash of the required fields */
 int sip_find_md5_digest (char *bid, _sip_msg_t * msg, uint16_t * hindex, sip_method_t method)
@@ -57,7 +56,23 @@ int sip_find_md5_digest (char *bid, _sip_msg_t * msg, uint16_t * hindex, sip_met
       const sip_str_t *to_uri = NULL;
       int cseq;
       int error = 0;
+      const sip_msg_core_t *core = &msg->sip_msg_core;
 
+      if (msg->sip_msg_core_parsed)
+      {
+         if (core->sip_core_to == NULL || core->sip_core_to->sip_value_state == SIP_VALUE_BAD ||
+             core->sip_core_cseq == NULL || core->sip_core_cseq->sip_value_state == SIP_VALUE_BAD ||
+             core->sip_core_cseq->cseq_num < 0)
+         {
+            return (EINVAL);
+         }
+         to_uri = &core->sip_core_to->cftr_uri;
+         cseq = core->sip_core_cseq->cseq_num;
+         via = core->sip_core_via_hdr;
+         from = core->sip_core_from_hdr;
+         cid = core->sip_core_callid_hdr;
+         goto hash;
+      }
       /*
        * Since the response might contain parameters not in the
        * request, just use the to URI.
@@ -69,10 +84,11 @@ int sip_find_md5_digest (char *bid, _sip_msg_t * msg, uint16_t * hindex, sip_met
       if (cseq < 0 || error != 0)
          return (EINVAL);
       (void) pthread_mutex_lock (&msg->sip_msg_mutex);
-      via = sip_search_for_header (msg, SIP_VIA, NULL);
-      from = sip_search_for_header (msg, SIP_FROM, NULL);
-      cid = sip_search_for_header (msg, SIP_CALL_ID, NULL);
+      via = sip_search_for_header_id (msg, SIP_HDR_VIA, NULL);
+      from = sip_search_for_header_id (msg, SIP_HDR_FROM, NULL);
+      cid = sip_search_for_header_id (msg, SIP_HDR_CALL_ID, NULL);
       (void) pthread_mutex_unlock (&msg->sip_msg_mutex);
+    hash:
       if (via == NULL || from == NULL || cid == NULL)
          return (EINVAL);
       sip_md5_hash (via->sip_hdr_start,
@@ -93,7 +109,11 @@ int sip_find_md5_digest (char *bid, _sip_msg_t * msg, uint16_t * hindex, sip_met
    return (0);
 }
 
-/* Add object to the connection cache object. Not checking for duplicates!! */
+/*
+ * Add object to the connection cache object. The transaction's
+ * sip_xaction_conn_obj is set iff it is on that object's list, so
+ * this is constant time.
+ */
 int sip_add_conn_obj_cache (sip_conn_object_t obj, void *cobj)
 {
    void **obj_val;
@@ -104,89 +124,58 @@ int sip_add_conn_obj_cache (sip_conn_object_t obj, void *cobj)
    /* Is already cached */
    if (sip_trans->sip_xaction_conn_obj != NULL)
    {
-      if (sip_is_conn_obj_cache (sip_trans->sip_xaction_conn_obj, (void *) sip_trans))
-      {
+      if (sip_trans->sip_xaction_conn_obj == obj)
          return (0);
-      }
       /* Transaction has cached a different conn_obj, release it */
       sip_del_conn_obj_cache (sip_trans->sip_xaction_conn_obj, (void *) sip_trans);
    }
 
-   xaction_list = malloc (sizeof (sip_conn_cache_t));
-   if (xaction_list == NULL)
-      return (ENOMEM);
-   xaction_list->obj = cobj;
-   xaction_list->next = xaction_list->prev = NULL;
-
    obj_val = (void *) obj;
    pvt_data = (sip_conn_obj_pvt_t *) * obj_val;
    if (pvt_data == NULL)
-   {
-      free (xaction_list);
       return (EINVAL);
-   }
+   xaction_list = &sip_trans->sip_xaction_conn_link;
+   xaction_list->obj = cobj;
+   xaction_list->prev = NULL;
    (void) pthread_mutex_lock (&pvt_data->sip_conn_obj_cache_lock);
-
-   if (pvt_data->sip_conn_obj_cache == NULL)
-   {
-      pvt_data->sip_conn_obj_cache = xaction_list;
-   }
-   else
-   {
-      xaction_list->next = pvt_data->sip_conn_obj_cache;
+   xaction_list->next = pvt_data->sip_conn_obj_cache;
+   if (pvt_data->sip_conn_obj_cache != NULL)
       pvt_data->sip_conn_obj_cache->prev = xaction_list;
-      pvt_data->sip_conn_obj_cache = xaction_list;
-   }
+   pvt_data->sip_conn_obj_cache = xaction_list;
    sip_refhold_conn (obj);
    sip_trans->sip_xaction_conn_obj = obj;
    (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_cache_lock);
    return (0);
 }
 
-/*
- * Walk thru the list of transactions that have cached this obj and
- * and return true if 'cobj' is one of them.
- */
-static boolean_t sip_is_conn_obj_cache (sip_conn_object_t obj, void *cobj)
+/* Take a transaction off of the list, with sip_conn_obj_cache_lock held */
+static void sip_unlink_conn_obj_cache (sip_conn_obj_pvt_t * pvt_data, sip_conn_cache_t * xaction_list)
 {
-   void **obj_val;
-   sip_conn_obj_pvt_t *pvt_data;
-   sip_conn_cache_t *xaction_list;
-   sip_xaction_t *trans;
-   sip_xaction_t *ctrans = (sip_xaction_t *) cobj;
-
-   obj_val = (void *) obj;
-   pvt_data = (sip_conn_obj_pvt_t *) * obj_val;
-   if (pvt_data == NULL)
-      return (B_FALSE);
-   (void) pthread_mutex_lock (&pvt_data->sip_conn_obj_cache_lock);
-   xaction_list = pvt_data->sip_conn_obj_cache;
-   while (xaction_list != NULL)
+   if (xaction_list->prev == NULL)
    {
-      trans = (sip_xaction_t *) xaction_list->obj;
-      if (ctrans != trans)
-      {
-         xaction_list = xaction_list->next;
-         continue;
-      }
-      (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_cache_lock);
-      return (B_TRUE);
+      assert (pvt_data->sip_conn_obj_cache == xaction_list);
+      pvt_data->sip_conn_obj_cache = xaction_list->next;
    }
-   (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_cache_lock);
-   return (B_FALSE);
+   else
+   {
+      xaction_list->prev->next = xaction_list->next;
+   }
+   if (xaction_list->next != NULL)
+      xaction_list->next->prev = xaction_list->prev;
+   xaction_list->prev = NULL;
+   xaction_list->next = NULL;
+   xaction_list->obj = NULL;
 }
 
-
 /*
- * Walk thru the list of transactions that have cached this obj and
- * refrele the objs.
+ * Remove 'cobj' from the list of transactions that have cached this obj
+ * and refrele the obj. If 'cobj' is NULL, do it for all of them.
  */
 void sip_del_conn_obj_cache (sip_conn_object_t obj, void *cobj)
 {
    void **obj_val;
    sip_conn_obj_pvt_t *pvt_data;
    sip_conn_cache_t *xaction_list;
-   sip_conn_cache_t *tmp_list;
    sip_xaction_t *trans;
    sip_xaction_t *ctrans = NULL;
 
@@ -205,93 +194,69 @@ void sip_del_conn_obj_cache (sip_conn_object_t obj, void *cobj)
       return;
    }
    (void) pthread_mutex_lock (&pvt_data->sip_conn_obj_cache_lock);
-   xaction_list = pvt_data->sip_conn_obj_cache;
-   while (xaction_list != NULL)
+   if (ctrans != NULL)
    {
-      tmp_list = xaction_list;
-      trans = (sip_xaction_t *) xaction_list->obj;
-      assert (trans != NULL);
-      if (ctrans != NULL && ctrans != trans)
+      /* Not on this list, possibly released by sip_conn_destroyed() */
+      if (ctrans->sip_xaction_conn_obj == obj)
       {
-         xaction_list = xaction_list->next;
-         continue;
+         sip_unlink_conn_obj_cache (pvt_data, &ctrans->sip_xaction_conn_link);
+         sip_refrele_conn (obj);
+         ctrans->sip_xaction_conn_obj = NULL;
       }
-      if (ctrans == NULL)
-         (void) pthread_mutex_lock (&trans->sip_xaction_mutex);
+      (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_cache_lock);
+      return;
+   }
+   while ((xaction_list = pvt_data->sip_conn_obj_cache) != NULL)
+   {
+      trans = (sip_xaction_t *) xaction_list->obj;
+      assert (trans != NULL);
+      (void) pthread_mutex_lock (&trans->sip_xaction_mutex);
       assert (trans->sip_xaction_conn_obj == obj);
+      sip_unlink_conn_obj_cache (pvt_data, xaction_list);
       sip_refrele_conn (obj);
       trans->sip_xaction_conn_obj = NULL;
-      if (ctrans == NULL)
-         (void) pthread_mutex_unlock (&trans->sip_xaction_mutex);
-      xaction_list = xaction_list->next;
-
-      /* Take the obj out of the list */
-      if (tmp_list == pvt_data->sip_conn_obj_cache)
-      {
-         if (xaction_list == NULL)
-         {
-            pvt_data->sip_conn_obj_cache = NULL;
-         }
-         else
-         {
-            xaction_list->prev = NULL;
-            pvt_data->sip_conn_obj_cache = xaction_list;
-         }
-      }
-      else if (xaction_list == NULL)
-      {
-         assert (tmp_list->prev != NULL);
-         tmp_list->prev->next = NULL;
-      }
-      else
-      {
-         assert (tmp_list->prev != NULL);
-         tmp_list->prev->next = xaction_list;
-         xaction_list->prev = tmp_list->prev;
-      }
-      tmp_list->prev = NULL;
-      tmp_list->next = NULL;
-      tmp_list->obj = NULL;
-
-      free (tmp_list);
+      (void) pthread_mutex_unlock (&trans->sip_xaction_mutex);
    }
    (void) pthread_mutex_unlock (&pvt_data->sip_conn_obj_cache_lock);
 }
 
 /*
- * Check for a transaction match. Passed to sip_hash_find().
+ * Check for a transaction match. Passed to sip_hash_find(), which holds
+ * no lock; the transaction may be on its way out, in which case the
+ * reference can't be taken.
  */
 boolean_t sip_xaction_match (void *obj, void *hindex)
 {
    sip_xaction_t *tmp = (sip_xaction_t *) obj;
 
-   tmp = (sip_xaction_t *) obj;
-
-   if (SIP_IS_XACTION_TERMINATED (tmp->sip_xaction_state))
+   if (SIP_IS_XACTION_TERMINATED (__atomic_load_n (&tmp->sip_xaction_state, __ATOMIC_RELAXED)))
       return (B_FALSE);
    if (bcmp (tmp->sip_xaction_hash_digest, hindex, sizeof (tmp->sip_xaction_hash_digest)) == 0)
-   {
-      SIP_XACTION_REFCNT_INCR (tmp);
-      return (B_TRUE);
-   }
+      return (sip_ref_get (&tmp->sip_xaction_ref_cnt));
    return (B_FALSE);
 }
 
 
-/* Find a transaction */
-static sip_xaction_t *sip_xaction_find (char *branchid, _sip_msg_t * msg, int which)
+/* Work out the digest a transaction for msg is hashed on */
+static int sip_xaction_digest (char *branchid, _sip_msg_t * msg, int which, uint16_t * hash_index)
 {
-   sip_xaction_t *tmp;
-   uint16_t hash_index[8];
-   int hindex;
    sip_method_t method;
    int error;
    sip_message_type_t *sip_msg_info;
 
    sip_msg_info = msg->sip_msg_req_res;
-   method = sip_get_callseq_method ((sip_msg_t) msg, &error);
-   if (error != 0)
-      return (NULL);
+   if (msg->sip_msg_core_parsed)
+   {
+      if (msg->sip_msg_core.sip_core_cseq == NULL || msg->sip_msg_core.sip_core_cseq->sip_value_state == SIP_VALUE_BAD)
+         return (EPROTO);
+      method = msg->sip_msg_core.sip_core_cseq->cseq_method;
+   }
+   else
+   {
+      method = sip_get_callseq_method ((sip_msg_t) msg, &error);
+      if (error != 0)
+         return (error);
+   }
 
    /*
     * If we are getting a ACK/CANCEL we need to match with the
@@ -301,11 +266,184 @@ static sip_xaction_t *sip_xaction_find (char *branchid, _sip_msg_t * msg, int wh
    {
       method = INVITE;
    }
-   if (sip_find_md5_digest (branchid, msg, hash_index, method) != 0)
+   return (sip_find_md5_digest (branchid, msg, hash_index, method));
+}
+
+/* The transaction a received message belongs to */
+#define	SIP_XACTION_RECV_WHICH(msg)					\
+	((msg)->sip_msg_req_res->is_request ? SIP_SERVER_TRANSACTION :	\
+	SIP_CLIENT_TRANSACTION)
+
+/* Find a transaction */
+static sip_xaction_t *sip_xaction_find (char *branchid, _sip_msg_t * msg, int which)
+{
+   uint16_t hash_index[8];
+
+   if ((msg->sip_msg_digests & SIP_MSG_XACTION_DIGEST) && which == SIP_XACTION_RECV_WHICH (msg))
+      return ((sip_xaction_t *) sip_hash_find (&sip_xaction_hash, (void *) msg->sip_msg_xaction_digest,
+                                               sip_xaction_match));
+   if (sip_xaction_digest (branchid, msg, which, hash_index) != 0)
       return (NULL);
-   hindex = SIP_DIGEST_TO_HASH (hash_index);
-   tmp = (sip_xaction_t *) sip_hash_find (sip_xaction_hash, (void *) hash_index, hindex, sip_xaction_match);
-   return (tmp);
+   return ((sip_xaction_t *) sip_hash_find (&sip_xaction_hash, (void *) hash_index, sip_xaction_match));
+}
+
+/*
+ * Work out the digest of the transaction the received msg belongs to and
+ * start bringing in its slot, for sip_xaction_get() to use shortly.
+ */
+void sip_xaction_prefetch (_sip_msg_t * msg)
+{
+   char *branchid;
+
+   branchid = sip_get_branchid ((sip_msg_t) msg, NULL);
+   if (sip_xaction_digest (branchid, msg, SIP_XACTION_RECV_WHICH (msg), msg->sip_msg_xaction_digest) == 0)
+   {
+      msg->sip_msg_digests |= SIP_MSG_XACTION_DIGEST;
+      sip_hash_prefetch (&sip_xaction_hash, msg->sip_msg_xaction_digest);
+   }
+   if (branchid != NULL)
+      free (branchid);
+}
+
+/* The method named by the len bytes at p, UNKNOWN if none */
+static sip_method_t sip_xaction_method_of (const char *p, size_t len)
+{
+   int i;
+
+   for (i = 1; i < MAX_SIP_METHODS; i++)
+   {
+      if ((size_t) sip_methods[i].len == len && strncmp (sip_methods[i].name, p, len) == 0)
+         return ((sip_method_t) i);
+   }
+   return (UNKNOWN);
+}
+
+/*
+ * Find the branch parameter in the top Via value [p, e), which is the
+ * rest of the first Via header line. Sets *blen and returns where the
+ * branch starts, or NULL.
+ */
+static const char *sip_xaction_via_branch (const char *p, const char *e, size_t * blen)
+{
+   const char *b;
+
+   while (p < e && *p != ',')
+   {
+      if (*p++ != ';')
+         continue;
+      while (p < e && (*p == ' ' || *p == '\t'))
+         p++;
+      if (e - p < 6 || strncasecmp (p, "branch", 6) != 0)
+         continue;
+      p += 6;
+      while (p < e && (*p == ' ' || *p == '\t'))
+         p++;
+      if (p == e || *p++ != '=')
+         return (NULL);
+      while (p < e && (*p == ' ' || *p == '\t'))
+         p++;
+      for (b = p; p < e && *p != ';' && *p != ',' && *p != ' ' && *p != '\t' && *p != '\r'; p++)
+         ;
+      *blen = p - b;
+      return (*blen > 0 ? b : NULL);
+   }
+   return (NULL);
+}
+
+/*
+ * Absorb a retransmitted request without parsing it. The datagram
+ * [buf, buf + len) is only scanned for its method, the top Via branch and
+ * the CSeq method; if these name a live server transaction, its last
+ * response is sent again or, in the other states, the request is dropped,
+ * just as sip_xaction_input() would do once the message is parsed. Only
+ * RFC 3261 branches are looked at and ACK and CANCEL, which change the
+ * transaction, are left to the parser. Returns B_TRUE if the caller can
+ * discard the datagram.
+ */
+boolean_t sip_xaction_absorb (sip_conn_object_t conn_obj, const char *buf, size_t len)
+{
+   const char *end = buf + len;
+   const char *line;
+   const char *e;
+   const char *v;
+   const char *branch = NULL;
+   size_t blen = 0;
+   sip_method_t method;
+   sip_method_t req_cseq = UNKNOWN;
+   boolean_t via_seen = B_FALSE;
+   sip_xaction_t *trans;
+   _sip_msg_t *last_msg;
+   uint16_t hash_index[8];
+
+   /* The request line */
+   if ((e = memchr (buf, ' ', len)) == NULL)
+      return (B_FALSE);
+   method = sip_xaction_method_of (buf, e - buf);
+   if (method == UNKNOWN || method == ACK || method == CANCEL)
+      return (B_FALSE);
+   if ((line = memchr (e, '\n', end - e)) == NULL)
+      return (B_FALSE);
+   for (line++; line < end && (!via_seen || req_cseq == UNKNOWN); line = e + 1)
+   {
+      if ((e = memchr (line, '\n', end - line)) == NULL)
+         e = end;
+      if (e == line || (e == line + 1 && *line == '\r'))
+         break;
+      if (!via_seen && (v = sip_reass_hdr_value (line, e, "via", 'v')) != NULL)
+      {
+         via_seen = B_TRUE;
+         branch = sip_xaction_via_branch (v, e, &blen);
+         if (branch == NULL || blen < strlen (RFC_3261_BRANCH) ||
+             strncmp (branch, RFC_3261_BRANCH, strlen (RFC_3261_BRANCH)) != 0)
+         {
+            return (B_FALSE);
+         }
+      }
+      else if ((v = sip_reass_hdr_value (line, e, "cseq", '\0')) != NULL)
+      {
+         while (v < e && *v >= '0' && *v <= '9')
+            v++;
+         while (v < e && (*v == ' ' || *v == '\t'))
+            v++;
+         for (line = v; v < e && *v != ' ' && *v != '\t' && *v != '\r'; v++)
+            ;
+         req_cseq = sip_xaction_method_of (line, v - line);
+         if (req_cseq != method)
+            return (B_FALSE);
+      }
+   }
+   if (branch == NULL || req_cseq == UNKNOWN)
+      return (B_FALSE);
+
+   /* As sip_find_md5_digest() does for an RFC 3261 branch */
+   sip_md5_hash ((char *) branch, blen, (char *) &method, sizeof (sip_method_t),
+                 NULL, 0, NULL, 0, NULL, 0, NULL, 0, (uchar_t *) hash_index);
+   trans = (sip_xaction_t *) sip_hash_find (&sip_xaction_hash, (void *) hash_index, sip_xaction_match);
+   if (trans == NULL)
+      return (B_FALSE);
+   (void) pthread_mutex_lock (&trans->sip_xaction_mutex);
+   switch (trans->sip_xaction_state)
+   {
+   case SIPS_SRV_INV_PROCEEDING:
+   case SIPS_SRV_INV_COMPLETED:
+   case SIPS_SRV_NONINV_PROCEEDING:
+   case SIPS_SRV_NONINV_COMPLETED:
+      last_msg = trans->sip_xaction_last_msg;
+      if (last_msg != NULL)
+         (void) sip_stack_send (conn_obj, last_msg->sip_msg_buf, last_msg->sip_msg_len);
+      break;
+   case SIPS_SRV_CONFIRMED:
+   case SIPS_SRV_TRYING:
+      break;
+   default:
+      /* A client transaction with this branch, not ours to absorb */
+      (void) pthread_mutex_unlock (&trans->sip_xaction_mutex);
+      SIP_XACTION_REFCNT_DECR (trans);
+      return (B_FALSE);
+   }
+   (void) pthread_mutex_unlock (&trans->sip_xaction_mutex);
+   SIP_XACTION_REFCNT_DECR (trans);
+   return (B_TRUE);
 }
 
 /*
@@ -464,52 +602,47 @@ sip_xaction_t *sip_xaction_get (sip_conn_object_t obj, sip_msg_t msg, boolean_t
 
 
 /*
- * Delete a transaction if the reference count is 0. Passed to
- * sip_hash_delete().
+ * The transaction can be removed if the reference count is 0, mark it
+ * so that lookups can't take a new one. Passed to sip_hash_remove().
  */
-boolean_t sip_xaction_remove (void *obj, void *hindex, int *found)
+boolean_t sip_xaction_unused (void *obj)
 {
    sip_xaction_t *tmp = (sip_xaction_t *) obj;
 
-   *found = 0;
-
-   tmp = (sip_xaction_t *) obj;
+   return (sip_ref_kill (&tmp->sip_xaction_ref_cnt));
+}
 
-   if (bcmp (tmp->sip_xaction_hash_digest, hindex, sizeof (tmp->sip_xaction_hash_digest)) == 0)
+/* Free a transaction that has been taken off of the hash table */
+static void sip_xaction_free (sip_xaction_t * tmp)
+{
+   (void) pthread_mutex_destroy (&tmp->sip_xaction_mutex);
+   SIP_CANCEL_TIMER (tmp->sip_xaction_TA);
+   SIP_CANCEL_TIMER (tmp->sip_xaction_TB);
+   SIP_CANCEL_TIMER (tmp->sip_xaction_TD);
+   SIP_CANCEL_TIMER (tmp->sip_xaction_TE);
+   SIP_CANCEL_TIMER (tmp->sip_xaction_TF);
+   SIP_CANCEL_TIMER (tmp->sip_xaction_TG);
+   SIP_CANCEL_TIMER (tmp->sip_xaction_TH);
+   SIP_CANCEL_TIMER (tmp->sip_xaction_TI);
+   SIP_CANCEL_TIMER (tmp->sip_xaction_TJ);
+   SIP_CANCEL_TIMER (tmp->sip_xaction_TK);
+   free (tmp->sip_xaction_branch_id);
+   if (tmp->sip_xaction_last_msg != NULL)
    {
-      *found = 1;
-      if (tmp->sip_xaction_ref_cnt != 0)
-         return (B_FALSE);
-      (void) pthread_mutex_destroy (&tmp->sip_xaction_mutex);
-      SIP_CANCEL_TIMER (tmp->sip_xaction_TA);
-      SIP_CANCEL_TIMER (tmp->sip_xaction_TB);
-      SIP_CANCEL_TIMER (tmp->sip_xaction_TD);
-      SIP_CANCEL_TIMER (tmp->sip_xaction_TE);
-      SIP_CANCEL_TIMER (tmp->sip_xaction_TF);
-      SIP_CANCEL_TIMER (tmp->sip_xaction_TG);
-      SIP_CANCEL_TIMER (tmp->sip_xaction_TH);
-      SIP_CANCEL_TIMER (tmp->sip_xaction_TI);
-      SIP_CANCEL_TIMER (tmp->sip_xaction_TJ);
-      SIP_CANCEL_TIMER (tmp->sip_xaction_TK);
-      free (tmp->sip_xaction_branch_id);
-      if (tmp->sip_xaction_last_msg != NULL)
-      {
-         SIP_MSG_REFCNT_DECR (tmp->sip_xaction_last_msg);
-         tmp->sip_xaction_last_msg = NULL;
-      }
-      if (tmp->sip_xaction_orig_msg != NULL)
-      {
-         SIP_MSG_REFCNT_DECR (tmp->sip_xaction_orig_msg);
-         tmp->sip_xaction_orig_msg = NULL;
-      }
-      if (tmp->sip_xaction_conn_obj != NULL)
-      {
-         sip_del_conn_obj_cache (tmp->sip_xaction_conn_obj, (void *) tmp);
-      }
-      free (tmp);
-      return (B_TRUE);
+      SIP_MSG_REFCNT_DECR (tmp->sip_xaction_last_msg);
+      tmp->sip_xaction_last_msg = NULL;
    }
-   return (B_FALSE);
+   if (tmp->sip_xaction_orig_msg != NULL)
+   {
+      SIP_MSG_REFCNT_DECR (tmp->sip_xaction_orig_msg);
+      tmp->sip_xaction_orig_msg = NULL;
+   }
+   if (tmp->sip_xaction_conn_obj != NULL)
+   {
+      sip_del_conn_obj_cache (tmp->sip_xaction_conn_obj, (void *) tmp);
+   }
+   /* Lookups that raced with the removal may still be looking at it */
+   sip_epoch_retire (&tmp->sip_xaction_epoch_node, (void *) tmp, free);
 }
 
 /*
@@ -517,11 +650,8 @@ boolean_t sip_xaction_remove (void *obj, void *hindex, int *found)
  */
 void sip_xaction_delete (sip_xaction_t * trans)
 {
-   int hindex;
-
-   hindex = SIP_DIGEST_TO_HASH (trans->sip_xaction_hash_digest);
-
-   sip_hash_delete (sip_xaction_hash, trans->sip_xaction_hash_digest, hindex, sip_xaction_remove);
+   if (sip_hash_remove (&sip_xaction_hash, (void *) trans, sip_xaction_unused))
+      sip_xaction_free (trans);
 }
 
 /*
@@ -537,7 +667,7 @@ int sip_xaction_add (sip_xaction_t * trans, char *branchid, _sip_msg_t * msg, si
    /* trans is not in the list as yet, so no need to hold the lock */
    bcopy (hash_index, trans->sip_xaction_hash_digest, sizeof (hash_index));
 
-   if (sip_hash_add (sip_xaction_hash, (void *) trans, SIP_DIGEST_TO_HASH (hash_index)) != 0)
+   if (sip_hash_add (&sip_xaction_hash, (void *) trans, hash_index) != 0)
    {
       return (ENOMEM);
    }
@@ -589,23 +719,33 @@ char *sip_get_xaction_state (int state)
 }
 
 /*
- * Initialize the hash table etc.
+ * Initialize the hash table etc. 'hash_size' is the initial capacity of
+ * the transaction table, 0 for the default.
  */
-void
+int
 sip_xaction_init (int (*ulp_trans_err) (sip_transaction_t, int, void *),
-                  void (*ulp_state_cb) (sip_transaction_t, sip_msg_t, int, int))
+                  void (*ulp_state_cb) (sip_transaction_t, sip_msg_t, int, int), int hash_size)
 {
-   int cnt;
+   int ret;
 
-   for (cnt = 0; cnt < SIP_HASH_SZ; cnt++)
+   if ((ret = sip_hash_init (&sip_xaction_hash, hash_size, offsetof (sip_xaction_t, sip_xaction_hash_link))) != 0)
+      return (ret);
+   if ((ret = sip_timeout_affinity (sip_xaction_state_timer_fire, sip_xaction_timer_key)) != 0)
    {
-      sip_xaction_hash[cnt].hash_count = 0;
-      sip_xaction_hash[cnt].hash_head = NULL;
-      sip_xaction_hash[cnt].hash_tail = NULL;
-      (void) pthread_mutex_init (&sip_xaction_hash[cnt].sip_hash_mutex, NULL);
+      sip_hash_fini (&sip_xaction_hash);
+      return (ret);
    }
    if (ulp_trans_err != NULL)
       sip_xaction_ulp_trans_err = ulp_trans_err;
    if (ulp_state_cb != NULL)
       sip_xaction_ulp_state_cb = ulp_state_cb;
+   return (0);
+}
+
+/* Undo sip_xaction_init(), no transaction may have been created */
+void sip_xaction_fini ()
+{
+   sip_hash_fini (&sip_xaction_hash);
+   sip_xaction_ulp_trans_err = NULL;
+   sip_xaction_ulp_state_cb = NULL;
 }
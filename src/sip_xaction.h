@@ -37,6 +37,8 @@ extern "C"
 #include <string.h>
 #include "sip_miscdefs.h"
 #include "sip_msg.h"
+#include "sip_hash.h"
+#include "sip_epoch.h"
 
 /* Various transaction timers */
    typedef enum sip_timer_type_s
@@ -53,17 +55,30 @@ extern "C"
       SIP_XACTION_TIMER_K
    } sip_xaction_timer_type_t;
 
+#define	SIP_XACTION_NTIMERS	(SIP_XACTION_TIMER_K + 1)
 
-/* Increment transaction reference count */
+/* Arg to the timer fire routine */
+   typedef struct sip_xaction_timer_obj_s
+   {
+      sip_xaction_timer_type_t sip_xaction_timer_type;
+      struct sip_xaction *sip_trans;
+      int sip_xaction_timer_xport;
+   } sip_xaction_time_obj_t;
+
+
+/*
+ * Increment transaction reference count. The count is atomic since
+ * lookups take their reference without a lock (sip_xaction_match()).
+ */
 #define	SIP_XACTION_REFCNT_INCR(trans)	\
-	(trans)->sip_xaction_ref_cnt++;
+	(void) __atomic_add_fetch(&(trans)->sip_xaction_ref_cnt, 1, __ATOMIC_RELAXED);
 
 /* Decrement transaction reference count */
 #define	SIP_XACTION_REFCNT_DECR(trans)	{				\
 	(void) pthread_mutex_lock(&((trans)->sip_xaction_mutex));	\
 	assert((trans)->sip_xaction_ref_cnt > 0);			\
-	(trans)->sip_xaction_ref_cnt--;					\
-	if ((trans)->sip_xaction_ref_cnt == 0 && 			\
+	if (__atomic_sub_fetch(&(trans)->sip_xaction_ref_cnt, 1,	\
+	    __ATOMIC_ACQ_REL) == 0 &&					\
 	    SIP_IS_XACTION_TERMINATED((trans)->sip_xaction_state)) {	\
 		(void) pthread_mutex_unlock(&((trans)->sip_xaction_mutex));\
 		sip_xaction_delete(trans);				\
@@ -87,6 +102,7 @@ extern "C"
       _sip_msg_t *sip_xaction_orig_msg; /* orig request msg. */
       _sip_msg_t *sip_xaction_last_msg; /* last msg sent */
       sip_conn_object_t sip_xaction_conn_obj;
+      sip_conn_cache_t sip_xaction_conn_link;   /* on conn_obj's cache list */
       int sip_xaction_state;    /* Transaction State */
       sip_method_t sip_xaction_method;
       uint32_t sip_xaction_ref_cnt;
@@ -101,15 +117,22 @@ extern "C"
       sip_timer_t sip_xaction_TI;
       sip_timer_t sip_xaction_TJ;
       sip_timer_t sip_xaction_TK;
+      /* The args of the timers, by sip_xaction_timer_type_t */
+      sip_xaction_time_obj_t sip_xaction_timer_obj[SIP_XACTION_NTIMERS];
       void *sip_xaction_ctxt;   /* currently unused */
+      sip_hash_link_t sip_xaction_hash_link;    /* in sip_xaction_hash */
+      sip_epoch_node_t sip_xaction_epoch_node;  /* to free once unused */
    } sip_xaction_t;
 
-   extern void sip_xaction_init (int (*ulp_trans_err) (sip_transaction_t,
-                                                       int, void *), void (*ulp_state_cb)
-                                 (sip_transaction_t, sip_msg_t, int, int));
+   extern int sip_xaction_init (int (*ulp_trans_err) (sip_transaction_t,
+                                                      int, void *), void (*ulp_state_cb)
+                                (sip_transaction_t, sip_msg_t, int, int), int);
+   extern void sip_xaction_fini ();
    extern int sip_xaction_output (sip_conn_object_t, sip_xaction_t *, _sip_msg_t *);
    extern int sip_xaction_input (sip_conn_object_t, sip_xaction_t *, _sip_msg_t **);
    extern sip_xaction_t *sip_xaction_get (sip_conn_object_t, sip_msg_t, boolean_t, int, int *);
+   extern void sip_xaction_prefetch (_sip_msg_t *);
+   extern boolean_t sip_xaction_absorb (sip_conn_object_t, const char *, size_t);
    extern void sip_xaction_delete (sip_xaction_t *);
    extern char *sip_get_xaction_state (int);
    extern int (*sip_xaction_ulp_trans_err) (sip_transaction_t, int, void *);
@@ -117,6 +140,8 @@ extern "C"
    extern void sip_del_conn_obj_cache (sip_conn_object_t, void *);
    extern int sip_add_conn_obj_cache (sip_conn_object_t, void *);
    extern void sip_xaction_terminate (sip_xaction_t *, _sip_msg_t *, int);
+   extern void sip_xaction_state_timer_fire (void *);
+   extern void *sip_xaction_timer_key (void *);
 #ifdef	__cplusplus
 }
 #endif
@@ -79,14 +79,6 @@
 #define	MIN(a, b)	(((a) < (b)) ? (a):(b))
 #endif
 
-/* Arg to the timer fire routine */
-typedef struct sip_xaction_timer_obj_s
-{
-   sip_xaction_timer_type_t sip_xaction_timer_type;
-   sip_xaction_t *sip_trans;
-   int sip_xaction_timer_xport;
-} sip_xaction_time_obj_t;
-
 int sip_xaction_output (sip_conn_object_t, sip_xaction_t *, _sip_msg_t *);
 int sip_xaction_input (sip_conn_object_t, sip_xaction_t *, _sip_msg_t **);
 void sip_xaction_terminate (sip_xaction_t *, _sip_msg_t *, int);
@@ -101,20 +93,21 @@ static int sip_srv_xaction_inv_res (sip_conn_object_t, sip_xaction_t *, _sip_msg
 static int sip_srv_xaction_noninv_res (sip_conn_object_t, sip_xaction_t *, _sip_msg_t *);
 static int sip_create_send_nonOKack (sip_conn_object_t, sip_xaction_t *, _sip_msg_t *, boolean_t);
 void sip_xaction_state_timer_fire (void *);
+void *sip_xaction_timer_key (void *);
 
-static sip_xaction_time_obj_t *sip_setup_timer (sip_conn_object_t, sip_xaction_t *, _sip_msg_t *, sip_timer_t, int);
+static sip_xaction_time_obj_t *sip_setup_timer (sip_conn_object_t, sip_xaction_t *, _sip_msg_t *, sip_timer_t *, int);
 
-/* Return a timer object */
+/*
+ * Return the timer object for a timer, it is part of the transaction so
+ * arming a timer never allocates.
+ */
 static sip_xaction_time_obj_t *sip_setup_timer (sip_conn_object_t conn_obj, sip_xaction_t * sip_trans,
-                                                _sip_msg_t * sip_msg, sip_timer_t timer, int type)
+                                                _sip_msg_t * sip_msg, sip_timer_t * timer, int type)
 {
-   sip_xaction_time_obj_t *sip_timer_obj = NULL;
+   sip_xaction_time_obj_t *sip_timer_obj = &sip_trans->sip_xaction_timer_obj[type];
 
-   sip_timer_obj = (sip_xaction_time_obj_t *) malloc (sizeof (sip_xaction_time_obj_t));
-   if (sip_timer_obj == NULL)
-      return (NULL);
-   if (SIP_IS_TIMER_RUNNING (timer))
-      SIP_CANCEL_TIMER (timer);
+   if (SIP_IS_TIMER_RUNNING (*timer))
+      SIP_CANCEL_TIMER (*timer);
    sip_timer_obj->sip_xaction_timer_type = type;
    sip_timer_obj->sip_xaction_timer_xport = sip_conn_transport (conn_obj);
    sip_timer_obj->sip_trans = sip_trans;
@@ -179,20 +172,10 @@ static int sip_clnt_xaction_output (sip_conn_object_t conn_obj, sip_xaction_t *
        */
       if (!isreliable)
       {
-         timer_obj_A = sip_setup_timer (conn_obj, sip_trans, msg, sip_trans->sip_xaction_TA, SIP_XACTION_TIMER_A);
-         if (timer_obj_A == NULL)
-         {
-            error = ENOMEM;
-            goto error_ret;
-         }
+         timer_obj_A = sip_setup_timer (conn_obj, sip_trans, msg, &sip_trans->sip_xaction_TA, SIP_XACTION_TIMER_A);
       }
 
-      timer_obj_B = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TB, SIP_XACTION_TIMER_B);
-      if (timer_obj_B == NULL)
-      {
-         error = ENOMEM;
-         goto error_ret;
-      }
+      timer_obj_B = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TB, SIP_XACTION_TIMER_B);
       if (timer_obj_A != NULL)
       {
          SIP_SCHED_TIMER (sip_trans->sip_xaction_TA, timer_obj_A, sip_xaction_state_timer_fire);
@@ -218,20 +201,10 @@ static int sip_clnt_xaction_output (sip_conn_object_t conn_obj, sip_xaction_t *
        */
       if (!isreliable)
       {
-         timer_obj_E = sip_setup_timer (conn_obj, sip_trans, msg, sip_trans->sip_xaction_TE, SIP_XACTION_TIMER_E);
-         if (timer_obj_E == NULL)
-         {
-            error = ENOMEM;
-            goto error_ret;
-         }
+         timer_obj_E = sip_setup_timer (conn_obj, sip_trans, msg, &sip_trans->sip_xaction_TE, SIP_XACTION_TIMER_E);
       }
       /* Start transaction Timer F */
-      timer_obj_F = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TF, SIP_XACTION_TIMER_F);
-      if (timer_obj_F == NULL)
-      {
-         error = ENOMEM;
-         goto error_ret;
-      }
+      timer_obj_F = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TF, SIP_XACTION_TIMER_F);
       if (timer_obj_E != NULL)
       {
          SIP_SCHED_TIMER (sip_trans->sip_xaction_TE, timer_obj_E, sip_xaction_state_timer_fire);
@@ -260,14 +233,6 @@ static int sip_clnt_xaction_output (sip_conn_object_t conn_obj, sip_xaction_t *
 
  error_ret:
    (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-   if (timer_obj_A != NULL)
-      free (timer_obj_A);
-   if (timer_obj_B != NULL)
-      free (timer_obj_B);
-   if (timer_obj_E != NULL)
-      free (timer_obj_E);
-   if (timer_obj_F != NULL)
-      free (timer_obj_F);
    return (error);
 }
 
@@ -329,29 +294,16 @@ static int sip_srv_xaction_inv_res (sip_conn_object_t conn_obj, sip_xaction_t *
          /* For unreliable transport start timer G */
          if (!isreliable)
          {
-            timer_obj_G = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TG, SIP_XACTION_TIMER_G);
-            if (timer_obj_G == NULL)
-            {
-               (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               return (ENOMEM);
-            }
+            timer_obj_G = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TG, SIP_XACTION_TIMER_G);
          }
          /* Start Timer H */
-         timer_obj_H = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TH, SIP_XACTION_TIMER_H);
-         if (timer_obj_H == NULL)
-         {
-            if (timer_obj_G != NULL)
-               free (timer_obj_G);
-            (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-            return (ENOMEM);
-         }
+         timer_obj_H = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TH, SIP_XACTION_TIMER_H);
          if (timer_obj_G != NULL)
          {
             SIP_SCHED_TIMER (sip_trans->sip_xaction_TG, timer_obj_G, sip_xaction_state_timer_fire);
             if (!SIP_IS_TIMER_RUNNING (sip_trans->sip_xaction_TG))
             {
                (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               free (timer_obj_G);
                return (ENOMEM);
             }
          }
@@ -361,12 +313,8 @@ static int sip_srv_xaction_inv_res (sip_conn_object_t conn_obj, sip_xaction_t *
             if (!SIP_IS_TIMER_RUNNING (sip_trans->sip_xaction_TH))
             {
                if (timer_obj_G != NULL)
-               {
                   SIP_CANCEL_TIMER (sip_trans->sip_xaction_TG);
-                  free (timer_obj_G);
-               }
                (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               free (timer_obj_H);
                return (ENOMEM);
             }
          }
@@ -420,17 +368,11 @@ static int sip_srv_xaction_noninv_res (sip_conn_object_t conn_obj, sip_xaction_t
          /* For unreliable transports, start Timer J */
          if (!isreliable)
          {
-            timer_obj_J = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TJ, SIP_XACTION_TIMER_J);
-            if (timer_obj_J == NULL)
-            {
-               (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               return (ENOMEM);
-            }
+            timer_obj_J = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TJ, SIP_XACTION_TIMER_J);
             SIP_SCHED_TIMER (sip_trans->sip_xaction_TJ, timer_obj_J, sip_xaction_state_timer_fire);
             if (!SIP_IS_TIMER_RUNNING (sip_trans->sip_xaction_TJ))
             {
                (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               free (timer_obj_J);
                return (ENOMEM);
             }
             sip_trans->sip_xaction_state = SIPS_SRV_NONINV_COMPLETED;
@@ -459,17 +401,11 @@ static int sip_srv_xaction_noninv_res (sip_conn_object_t conn_obj, sip_xaction_t
          /* For unreliable transports, start Timer J */
          if (!isreliable)
          {
-            timer_obj_J = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TJ, SIP_XACTION_TIMER_J);
-            if (timer_obj_J == NULL)
-            {
-               (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               return (ENOMEM);
-            }
+            timer_obj_J = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TJ, SIP_XACTION_TIMER_J);
             SIP_SCHED_TIMER (sip_trans->sip_xaction_TJ, timer_obj_J, sip_xaction_state_timer_fire);
             if (!SIP_IS_TIMER_RUNNING (sip_trans->sip_xaction_TJ))
             {
                (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               free (timer_obj_J);
                return (ENOMEM);
             }
             sip_trans->sip_xaction_state = SIPS_SRV_NONINV_COMPLETED;
@@ -591,17 +527,11 @@ static int sip_srv_xaction_input (sip_conn_object_t conn_obj, sip_xaction_t * si
           * For unreliable transports, start TIMER I and
           * transition to CONFIRMED state.
           */
-         timer_obj_I = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TI, SIP_XACTION_TIMER_I);
-         if (timer_obj_I == NULL)
-         {
-            (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-            return (ENOMEM);
-         }
+         timer_obj_I = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TI, SIP_XACTION_TIMER_I);
          SIP_SCHED_TIMER (sip_trans->sip_xaction_TI, timer_obj_I, sip_xaction_state_timer_fire);
          if (!SIP_IS_TIMER_RUNNING (sip_trans->sip_xaction_TI))
          {
             (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-            free (timer_obj_I);
             return (ENOMEM);
          }
          sip_trans->sip_xaction_state = SIPS_SRV_CONFIRMED;
@@ -777,17 +707,11 @@ static int sip_clnt_xaction_inv_res (sip_conn_object_t conn_obj, sip_xaction_t *
           */
          if (!isreliable)
          {
-            timer_obj_D = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TD, SIP_XACTION_TIMER_D);
-            if (timer_obj_D == NULL)
-            {
-               (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               return (ENOMEM);
-            }
+            timer_obj_D = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TD, SIP_XACTION_TIMER_D);
             SIP_SCHED_TIMER (sip_trans->sip_xaction_TD, timer_obj_D, sip_xaction_state_timer_fire);
             if (!SIP_IS_TIMER_RUNNING (sip_trans->sip_xaction_TD))
             {
                (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               free (timer_obj_D);
                return (ENOMEM);
             }
             sip_trans->sip_xaction_state = SIPS_CLNT_INV_COMPLETED;
@@ -829,17 +753,11 @@ static int sip_clnt_xaction_inv_res (sip_conn_object_t conn_obj, sip_xaction_t *
           */
          if (!isreliable)
          {
-            timer_obj_D = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TD, SIP_XACTION_TIMER_D);
-            if (timer_obj_D == NULL)
-            {
-               (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               return (ENOMEM);
-            }
+            timer_obj_D = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TD, SIP_XACTION_TIMER_D);
             SIP_SCHED_TIMER (sip_trans->sip_xaction_TD, timer_obj_D, sip_xaction_state_timer_fire);
             if (!SIP_IS_TIMER_RUNNING (sip_trans->sip_xaction_TD))
             {
                (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               free (timer_obj_D);
                return (ENOMEM);
             }
             sip_trans->sip_xaction_state = SIPS_CLNT_INV_COMPLETED;
@@ -922,17 +840,11 @@ static int sip_clnt_xaction_noninv_res (sip_conn_object_t conn_obj, sip_xaction_
          /* Start timer K for unreliable transports */
          if (!isreliable)
          {
-            timer_obj_K = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TK, SIP_XACTION_TIMER_K);
-            if (timer_obj_K == NULL)
-            {
-               (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               return (ENOMEM);
-            }
+            timer_obj_K = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TK, SIP_XACTION_TIMER_K);
             SIP_SCHED_TIMER (sip_trans->sip_xaction_TK, timer_obj_K, sip_xaction_state_timer_fire);
             if (!SIP_IS_TIMER_RUNNING (sip_trans->sip_xaction_TK))
             {
                (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               free (timer_obj_K);
                return (ENOMEM);
             }
             sip_trans->sip_xaction_state = SIPS_CLNT_NONINV_COMPLETED;
@@ -955,17 +867,11 @@ static int sip_clnt_xaction_noninv_res (sip_conn_object_t conn_obj, sip_xaction_
          /* Start timer K for unreliable transports */
          if (!isreliable)
          {
-            timer_obj_K = sip_setup_timer (conn_obj, sip_trans, NULL, sip_trans->sip_xaction_TK, SIP_XACTION_TIMER_K);
-            if (timer_obj_K == NULL)
-            {
-               (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               return (ENOMEM);
-            }
+            timer_obj_K = sip_setup_timer (conn_obj, sip_trans, NULL, &sip_trans->sip_xaction_TK, SIP_XACTION_TIMER_K);
             SIP_SCHED_TIMER (sip_trans->sip_xaction_TK, timer_obj_K, sip_xaction_state_timer_fire);
             if (!SIP_IS_TIMER_RUNNING (sip_trans->sip_xaction_TK))
             {
                (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
-               free (timer_obj_K);
                return (ENOMEM);
             }
             sip_trans->sip_xaction_state = SIPS_CLNT_NONINV_COMPLETED;
@@ -1032,6 +938,12 @@ void sip_xaction_terminate (sip_xaction_t * sip_trans, _sip_msg_t * msg, int tra
  * --------------------------- Timer Routine ---------------------------
  */
 
+/* The timers of a transaction all run on the same timer thread */
+void *sip_xaction_timer_key (void *args)
+{
+   return (((sip_xaction_time_obj_t *) args)->sip_trans);
+}
+
 void sip_xaction_state_timer_fire (void *args)
 {
    sip_xaction_time_obj_t *time_obj = (sip_xaction_time_obj_t *) args;
@@ -1071,7 +983,6 @@ void sip_xaction_state_timer_fire (void *args)
             sip_xaction_ulp_trans_err (sip_trans, 0, NULL);
          }
          sip_xaction_delete (sip_trans);
-         free (time_obj);
          return;
       }
       SIP_SET_TIMEOUT (sip_trans->sip_xaction_TA, 2 * SIP_GET_TIMEOUT (sip_trans->sip_xaction_TA));
@@ -1091,7 +1002,6 @@ void sip_xaction_state_timer_fire (void *args)
             sip_xaction_ulp_trans_err (sip_trans, 0, NULL);
          }
          sip_xaction_delete (sip_trans);
-         free (time_obj);
          return;
       }
       (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
@@ -1111,7 +1021,6 @@ void sip_xaction_state_timer_fire (void *args)
             sip_xaction_ulp_trans_err (sip_trans, 0, NULL);
          }
          sip_xaction_delete (sip_trans);
-         free (time_obj);
          return;
       }
       break;
@@ -1151,7 +1060,6 @@ void sip_xaction_state_timer_fire (void *args)
             sip_xaction_ulp_trans_err (sip_trans, 0, NULL);
          }
          sip_xaction_delete (sip_trans);
-         free (time_obj);
          return;
       }
       SIP_SET_TIMEOUT (sip_trans->sip_xaction_TE, MIN (SIP_TIMER_T2, 2 * SIP_GET_TIMEOUT (sip_trans->sip_xaction_TE)));
@@ -1171,7 +1079,6 @@ void sip_xaction_state_timer_fire (void *args)
             sip_xaction_ulp_trans_err (sip_trans, 0, NULL);
          }
          sip_xaction_delete (sip_trans);
-         free (time_obj);
          return;
       }
       (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
@@ -1193,7 +1100,6 @@ void sip_xaction_state_timer_fire (void *args)
             sip_xaction_ulp_trans_err (sip_trans, 0, NULL);
          }
          sip_xaction_delete (sip_trans);
-         free (time_obj);
          return;
       }
       break;
@@ -1223,7 +1129,6 @@ void sip_xaction_state_timer_fire (void *args)
             sip_xaction_ulp_trans_err (sip_trans, 0, NULL);
          }
          sip_xaction_delete (sip_trans);
-         free (time_obj);
          return;
       }
       SIP_SET_TIMEOUT (sip_trans->sip_xaction_TG, MIN (SIP_TIMER_T2, 2 * SIP_GET_TIMEOUT (sip_trans->sip_xaction_TG)));
@@ -1242,7 +1147,6 @@ void sip_xaction_state_timer_fire (void *args)
             sip_xaction_ulp_trans_err (sip_trans, 0, NULL);
          }
          sip_xaction_delete (sip_trans);
-         free (time_obj);
          return;
       }
       (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
@@ -1263,7 +1167,6 @@ void sip_xaction_state_timer_fire (void *args)
             sip_xaction_ulp_trans_err (sip_trans, 0, NULL);
          }
          sip_xaction_delete (sip_trans);
-         free (time_obj);
          return;
       }
       break;
@@ -1302,7 +1205,6 @@ void sip_xaction_state_timer_fire (void *args)
          sip_xaction_ulp_state_cb ((sip_transaction_t) sip_trans, NULL, prev_state, sip_trans->sip_xaction_state);
       }
       sip_xaction_delete (sip_trans);
-      free (time_obj);
       return;
    }
    (void) pthread_mutex_unlock (&sip_trans->sip_xaction_mutex);
@@ -1310,5 +1212,4 @@ void sip_xaction_state_timer_fire (void *args)
    {
       sip_xaction_ulp_state_cb ((sip_transaction_t) sip_trans, NULL, prev_state, sip_trans->sip_xaction_state);
    }
-   free (time_obj);
 }